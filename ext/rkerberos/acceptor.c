@@ -0,0 +1,887 @@
+#include <rkerberos.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+
+VALUE cKrb5Acceptor, cKrb5AcceptorResult;
+
+// The library's default clock skew, used when its own time check is off.
+#define RKRB5_ACCEPTOR_SKEW 300
+
+// The result of verifying one AP-REQ, before conversion to Ruby objects.
+typedef struct {
+  krb5_error_code kerror;
+  const char* func;
+  krb5_ticket* ticket;
+  krb5_authenticator* authenticator;
+  char* client;
+  char* server;
+  krb5_pac pac;
+} RKRB5_AP_RESULT;
+
+// Function prototypes
+static void rkrb5_acceptor_slot_free(RKRB5_ACCEPTOR_SLOT*);
+
+// Free function for the Kerberos::Krb5::Acceptor class.
+static void rkrb5_acceptor_free(RUBY_KRB5_ACCEPTOR* ptr){
+  int i;
+
+  if(!ptr)
+    return;
+
+  for(i = 0; i < ptr->idle_count; i++)
+    rkrb5_acceptor_slot_free(&ptr->idle[i]);
+
+  if(ptr->server)
+    krb5_free_principal(ptr->ctx, ptr->server);
+
+  // The slots' handles are closed, so this is the last one.
+  if(ptr->keytab){
+    rkrb5_kt_clear_memory(ptr->ctx, ptr->keytab);
+    krb5_kt_close(ptr->ctx, ptr->keytab);
+  }
+
+#ifdef HAVE_KRB5_RC_RESOLVE_FULL
+  if(ptr->library_rcache)
+    krb5_rc_close(ptr->ctx, ptr->library_rcache);
+#endif
+
+  if(ptr->ctx)
+    krb5_free_context(ptr->ctx);
+
+  free(ptr->idle);
+  free(ptr->rcache_name);
+
+  pthread_mutex_destroy(&ptr->lock);
+
+  free(ptr);
+}
+
+// Allocation function for the Kerberos::Krb5::Acceptor class.
+static VALUE rkrb5_acceptor_allocate(VALUE klass){
+  RUBY_KRB5_ACCEPTOR* ptr = malloc(sizeof(RUBY_KRB5_ACCEPTOR));
+  memset(ptr, 0, sizeof(RUBY_KRB5_ACCEPTOR));
+  pthread_mutex_init(&ptr->lock, NULL);
+  return Data_Wrap_Struct(klass, 0, rkrb5_acceptor_free, ptr);
+}
+
+// Frees a slot's context along with the keytab handle resolved in it.
+static void rkrb5_acceptor_slot_free(RKRB5_ACCEPTOR_SLOT* slot){
+  if(!slot->ctx)
+    return;
+
+  if(slot->keytab)
+    krb5_kt_close(slot->ctx, slot->keytab);
+
+  krb5_free_context(slot->ctx);
+
+  memset(slot, 0, sizeof(RKRB5_ACCEPTOR_SLOT));
+}
+
+/*
+ * Takes an idle slot from the acceptor, or an empty one if there are none.
+ * Empty slots are set up by rkrb5_acceptor_rd_req. Safe to call without
+ * the GVL.
+ */
+static void rkrb5_acceptor_slot_get(RUBY_KRB5_ACCEPTOR* ptr, RKRB5_ACCEPTOR_SLOT* slot){
+  pthread_mutex_lock(&ptr->lock);
+
+  if(ptr->idle_count > 0)
+    *slot = ptr->idle[--ptr->idle_count];
+  else
+    memset(slot, 0, sizeof(RKRB5_ACCEPTOR_SLOT));
+
+  ptr->busy++;
+
+  pthread_mutex_unlock(&ptr->lock);
+}
+
+// Returns a slot to the acceptor's idle list. Safe to call without the GVL.
+static void rkrb5_acceptor_slot_put(RUBY_KRB5_ACCEPTOR* ptr, RKRB5_ACCEPTOR_SLOT* slot){
+  RKRB5_ACCEPTOR_SLOT* idle;
+
+  pthread_mutex_lock(&ptr->lock);
+
+  ptr->busy--;
+
+  if(slot->ctx && ptr->idle_count == ptr->idle_capacity){
+    idle = realloc(ptr->idle, sizeof(RKRB5_ACCEPTOR_SLOT) * (ptr->idle_capacity + 4));
+
+    if(idle){
+      ptr->idle = idle;
+      ptr->idle_capacity += 4;
+    }
+  }
+
+  if(slot->ctx && ptr->idle_count < ptr->idle_capacity){
+    ptr->idle[ptr->idle_count++] = *slot;
+    memset(slot, 0, sizeof(RKRB5_ACCEPTOR_SLOT));
+  }
+
+  pthread_mutex_unlock(&ptr->lock);
+
+  rkrb5_acceptor_slot_free(slot);
+}
+
+// Sets up an empty slot with a context and keytab handle of its own.
+static krb5_error_code rkrb5_acceptor_slot_init(RUBY_KRB5_ACCEPTOR* ptr, RKRB5_ACCEPTOR_SLOT* slot, const char** func){
+  krb5_error_code kerror;
+
+  *func = "krb5_init_context";
+
+  if((kerror = krb5_init_context(&slot->ctx)))
+    return kerror;
+
+  *func = "krb5_kt_resolve";
+
+  return krb5_kt_resolve(slot->ctx, ptr->keytab_name, &slot->keytab);
+}
+
+/*
+ * Gives +auth_context+ the library replay cache, if the acceptor uses one.
+ * Otherwise the library's own time and replay checks are turned off, and
+ * rkrb5_acceptor_rd_req checks the clock skew itself.
+ *
+ * Where krb5_rc_resolve_full exists, every slot shares the acceptor's one
+ * handle, since each handle to a legacy replay cache keeps a table of its
+ * own and would miss tokens replayed to another slot. Newer libraries only
+ * offer the default replay cache, which keeps all of its state on disk, so
+ * a handle is opened per request and closed along with the auth context.
+ */
+static krb5_error_code rkrb5_acceptor_set_rcache(RUBY_KRB5_ACCEPTOR* ptr, krb5_context ctx, krb5_auth_context auth_context, const char** func){
+  krb5_error_code kerror;
+  krb5_int32 flags;
+#ifndef HAVE_KRB5_RC_RESOLVE_FULL
+  krb5_rcache rcache;
+#endif
+
+  if(!ptr->rcache_name){
+    *func = "krb5_auth_con_getflags";
+
+    if((kerror = krb5_auth_con_getflags(ctx, auth_context, &flags)))
+      return kerror;
+
+    *func = "krb5_auth_con_setflags";
+
+    return krb5_auth_con_setflags(ctx, auth_context, flags & ~KRB5_AUTH_CONTEXT_DO_TIME);
+  }
+
+#ifdef HAVE_KRB5_RC_RESOLVE_FULL
+  *func = "krb5_auth_con_setrcache";
+
+  return krb5_auth_con_setrcache(ctx, auth_context, ptr->library_rcache);
+#else
+  *func = "krb5_rc_default";
+
+  if((kerror = krb5_rc_default(ctx, &rcache)))
+    return kerror;
+
+  // This only stores the handle, so it can't fail and leak it.
+  *func = "krb5_auth_con_setrcache";
+
+  return krb5_auth_con_setrcache(ctx, auth_context, rcache);
+#endif
+}
+
+/*
+ * Parses the PAC in a decrypted ticket's authorization data, if it has one,
+ * and verifies its server checksum with the key the ticket was encrypted
+ * in, so that Result#pac can be trusted. Does not need the GVL.
+ */
+static krb5_error_code rkrb5_acceptor_pac(RKRB5_ACCEPTOR_SLOT* slot, RKRB5_AP_RESULT* result){
+  krb5_ticket* ticket = result->ticket;
+  krb5_authdata** pac_data = NULL;
+  krb5_keytab_entry entry;
+  krb5_error_code kerror;
+
+  result->func = "krb5_find_authdata";
+
+  kerror = krb5_find_authdata(
+    slot->ctx,
+    ticket->enc_part2->authorization_data,
+    NULL,
+    KRB5_AUTHDATA_WIN2K_PAC,
+    &pac_data
+  );
+
+  if(kerror || !pac_data)
+    return kerror;
+
+  // Only one PAC is ever issued, so a second could only have been added to
+  // confuse whoever reads the first.
+  if(pac_data[1]){
+    krb5_free_authdata(slot->ctx, pac_data);
+    result->func = "ticket has more than one PAC";
+    return KRB5KRB_AP_ERR_MODIFIED;
+  }
+
+  result->func = "krb5_pac_parse";
+
+  kerror = krb5_pac_parse(slot->ctx, pac_data[0]->contents, pac_data[0]->length, &result->pac);
+  krb5_free_authdata(slot->ctx, pac_data);
+
+  if(kerror)
+    return kerror;
+
+  result->func = "krb5_kt_get_entry";
+
+  kerror = krb5_kt_get_entry(
+    slot->ctx,
+    slot->keytab,
+    ticket->server,
+    ticket->enc_part.kvno,
+    ticket->enc_part.enctype,
+    &entry
+  );
+
+  if(kerror)
+    return kerror;
+
+  result->func = "krb5_pac_verify";
+
+  kerror = krb5_pac_verify(
+    slot->ctx,
+    result->pac,
+    ticket->enc_part2->times.authtime,
+    ticket->enc_part2->client,
+    &entry.key,
+    NULL
+  );
+
+  krb5_kt_free_entry(slot->ctx, &entry);
+
+  return kerror;
+}
+
+/*
+ * Verifies a single AP-REQ using +slot+, setting it up first if needed.
+ * Does not need the GVL. On success +result+ holds the decrypted ticket,
+ * which must be released with rkrb5_acceptor_result_free.
+ *
+ * The replay cache and keytab are set up once per slot. A new auth context
+ * is used for each request, since krb5_rd_req leaves the per-request
+ * authenticator and keys in it.
+ */
+static void rkrb5_acceptor_rd_req(RUBY_KRB5_ACCEPTOR* ptr, RKRB5_ACCEPTOR_SLOT* slot, const char* token, long length, RKRB5_AP_RESULT* result){
+  krb5_auth_context auth_context = NULL;
+  krb5_data request;
+
+  memset(result, 0, sizeof(RKRB5_AP_RESULT));
+
+  if(!slot->ctx){
+    if((result->kerror = rkrb5_acceptor_slot_init(ptr, slot, &result->func)))
+      return;
+  }
+
+  result->func = "krb5_auth_con_init";
+
+  if((result->kerror = krb5_auth_con_init(slot->ctx, &auth_context)))
+    return;
+
+  if((result->kerror = rkrb5_acceptor_set_rcache(ptr, slot->ctx, auth_context, &result->func)))
+    goto cleanup;
+
+  request.magic = 0;
+  request.length = (unsigned int)length;
+  request.data = (char*)token;
+
+  result->func = "krb5_rd_req";
+
+  result->kerror = krb5_rd_req(
+    slot->ctx,
+    &auth_context,
+    &request,
+    ptr->server,
+    slot->keytab,
+    NULL,
+    &result->ticket
+  );
+
+  if(result->kerror)
+    goto cleanup;
+
+  result->func = "krb5_auth_con_getauthenticator";
+
+  if((result->kerror = krb5_auth_con_getauthenticator(slot->ctx, auth_context, &result->authenticator)))
+    goto cleanup;
+
+  result->func = "krb5_unparse_name";
+
+  if((result->kerror = krb5_unparse_name(slot->ctx, result->ticket->enc_part2->client, &result->client)))
+    goto cleanup;
+
+  if((result->kerror = krb5_unparse_name(slot->ctx, result->ticket->server, &result->server)))
+    goto cleanup;
+
+  // Without a library replay cache the library skipped its time check, and
+  // a memory replay cache is checked here instead.
+  if(!ptr->rcache_name){
+    krb5_authenticator* authenticator = result->authenticator;
+    krb5_timestamp now;
+
+    result->func = "krb5_timeofday";
+
+    if((result->kerror = krb5_timeofday(slot->ctx, &now)))
+      goto cleanup;
+
+    result->func = "krb5_rd_req";
+
+    if(labs((long)now - (long)authenticator->ctime) > ptr->skew)
+      result->kerror = KRB5KRB_AP_ERR_SKEW;
+    else if(ptr->rcache && rkrb5_rcache_replay(ptr->rcache, result->client, result->server, authenticator->ctime, authenticator->cusec))
+      result->kerror = KRB5KRB_AP_ERR_REPEAT;
+  }
+
+  cleanup:
+
+#ifdef HAVE_KRB5_RC_RESOLVE_FULL
+  // The replay cache belongs to the acceptor, so detach it before freeing.
+  if(ptr->library_rcache)
+    krb5_auth_con_setrcache(slot->ctx, auth_context, NULL);
+#endif
+
+  krb5_auth_con_free(slot->ctx, auth_context);
+
+  if(!result->kerror)
+    result->kerror = rkrb5_acceptor_pac(slot, result);
+}
+
+// Frees whatever rkrb5_acceptor_rd_req stored in +result+.
+static void rkrb5_acceptor_result_free(krb5_context ctx, RKRB5_AP_RESULT* result){
+  if(result->client)
+    krb5_free_unparsed_name(ctx, result->client);
+
+  if(result->server)
+    krb5_free_unparsed_name(ctx, result->server);
+
+  if(result->authenticator)
+    krb5_free_authenticator(ctx, result->authenticator);
+
+  if(result->ticket)
+    krb5_free_ticket(ctx, result->ticket);
+
+  if(result->pac)
+    krb5_pac_free(ctx, result->pac);
+
+  memset(result, 0, sizeof(RKRB5_AP_RESULT));
+}
+
+static VALUE rkrb5_acceptor_time(krb5_timestamp t){
+  return t ? rb_time_new(t, 0) : Qnil;
+}
+
+/*
+ * Converts a successful result into a Kerberos::Krb5::Acceptor::Result
+ * object. Requires the GVL.
+ */
+static VALUE rkrb5_acceptor_result_new(krb5_context ctx, RKRB5_AP_RESULT* result){
+  krb5_enc_tkt_part* part = result->ticket->enc_part2;
+  VALUE v_result, v_authdata;
+  int i;
+
+  v_result = rb_class_new_instance(0, NULL, cKrb5AcceptorResult);
+  v_authdata = rb_ary_new();
+
+  for(i = 0; part->authorization_data && part->authorization_data[i]; i++){
+    krb5_authdata* ad = part->authorization_data[i];
+    VALUE v_data = rb_str_new((char*)ad->contents, ad->length);
+
+    rb_obj_freeze(v_data);
+    rb_ary_push(v_authdata, rb_obj_freeze(rb_ary_new3(2, INT2FIX(ad->ad_type), v_data)));
+  }
+
+  rb_iv_set(v_result, "@client", rb_str_new2(result->client));
+  rb_iv_set(v_result, "@server", rb_str_new2(result->server));
+  rb_iv_set(v_result, "@authtime", rkrb5_acceptor_time(part->times.authtime));
+  rb_iv_set(v_result, "@starttime", rkrb5_acceptor_time(part->times.starttime));
+  rb_iv_set(v_result, "@endtime", rkrb5_acceptor_time(part->times.endtime));
+  rb_iv_set(v_result, "@flags", UINT2NUM((krb5_ui_4)part->flags));
+  rb_iv_set(v_result, "@enctype", INT2FIX(part->session->enctype));
+  rb_iv_set(v_result, "@authdata", rb_obj_freeze(v_authdata));
+  rb_iv_set(v_result, "@pac", result->pac ? rkrb5_pac_new(ctx, result->pac) : Qnil);
+
+  return v_result;
+}
+
+// Arguments for, and results of, a single Acceptor#verify call.
+typedef struct {
+  RUBY_KRB5_ACCEPTOR* ptr;
+  RKRB5_ACCEPTOR_SLOT slot;
+  VALUE v_token;
+  RKRB5_AP_RESULT result;
+} RKRB5_VERIFY;
+
+static void* rkrb5_acceptor_verify_nogvl(void* arg){
+  RKRB5_VERIFY* v = arg;
+  rkrb5_acceptor_rd_req(v->ptr, &v->slot, RSTRING_PTR(v->v_token), RSTRING_LEN(v->v_token), &v->result);
+  return NULL;
+}
+
+static VALUE rkrb5_acceptor_verify_call(VALUE v_arg){
+  RKRB5_VERIFY* v = (RKRB5_VERIFY*)v_arg;
+
+  rb_thread_call_without_gvl(rkrb5_acceptor_verify_nogvl, v, RUBY_UBF_IO, NULL);
+
+  if(v->result.kerror)
+    rb_raise(cKrb5Exception, "%s: %s", v->result.func, error_message(v->result.kerror));
+
+  return rkrb5_acceptor_result_new(v->slot.ctx, &v->result);
+}
+
+static VALUE rkrb5_acceptor_verify_ensure(VALUE v_arg){
+  RKRB5_VERIFY* v = (RKRB5_VERIFY*)v_arg;
+
+  if(v->slot.ctx)
+    rkrb5_acceptor_result_free(v->slot.ctx, &v->result);
+
+  rkrb5_acceptor_slot_put(v->ptr, &v->slot);
+
+  return Qnil;
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5::Acceptor.new(:keytab => nil, :rcache => nil, :server => nil)
+ *
+ * Creates and returns a new Kerberos::Krb5::Acceptor, which verifies the
+ * AP-REQ messages that clients send to a Kerberos service.
+ *
+ * The +keytab+, a Keytab object or name, is read into memory once here, so
+ * later changes to it are not seen. If no keytab is given the default
+ * keytab is used.
+ *
+ * The +rcache+ is a Kerberos::Krb5::ReplayCache, or the name of a library
+ * replay cache. The default is 'dfl:', the library's file based replay
+ * cache, which syncs to disk for every ticket. For busy servers a :memory
+ * ReplayCache is much faster. Use 'none:' to turn off replay detection.
+ * MIT krb5 1.18 and later can't open replay caches by name, so there only
+ * 'dfl:' and 'none:' are accepted, and 'dfl:' is whatever KRB5RCACHENAME
+ * or the default_rcache_name setting selects.
+ *
+ * If a +server+ principal is given, only tickets for that principal are
+ * accepted. Otherwise a ticket for any principal in the keytab will do.
+ */
+static VALUE rkrb5_acceptor_initialize(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5_ACCEPTOR* ptr;
+  krb5_error_code kerror;
+  krb5_keytab keytab;
+  const char* func;
+  krb5_deltat skew = RKRB5_ACCEPTOR_SKEW;
+  VALUE v_opts, v_keytab = Qnil, v_rcache = Qnil, v_server = Qnil;
+
+  Data_Get_Struct(self, RUBY_KRB5_ACCEPTOR, ptr);
+
+  rb_scan_args(argc, argv, "01", &v_opts);
+
+  if(ptr->ctx)
+    rb_raise(cKrb5Exception, "acceptor already initialized");
+
+  if(!NIL_P(v_opts)){
+    Check_Type(v_opts, T_HASH);
+
+    v_keytab = rb_hash_aref2(v_opts, "keytab");
+    v_rcache = rb_hash_aref2(v_opts, "rcache");
+    v_server = rb_hash_aref2(v_opts, "server");
+
+    if(rb_obj_is_kind_of(v_keytab, cKrb5Keytab))
+      v_keytab = rb_iv_get(v_keytab, "@name");
+
+    if(!NIL_P(v_keytab))
+      Check_Type(v_keytab, T_STRING);
+
+    if(rb_obj_is_kind_of(v_rcache, cKrb5ReplayCache)){
+      Data_Get_Struct(v_rcache, RUBY_KRB5_RCACHE, ptr->rcache);
+
+      if(!ptr->rcache->type)
+        rb_raise(cKrb5Exception, "replay cache not initialized");
+
+      // Keep the replay cache alive for as long as the acceptor.
+      rb_iv_set(self, "@rcache", v_rcache);
+      v_rcache = rb_str_new2(ptr->rcache->name);
+
+      if(ptr->rcache->type != RKRB5_RC_MEMORY)
+        ptr->rcache = NULL;
+      else
+        skew = ptr->rcache->window;
+    }
+
+    if(!NIL_P(v_rcache))
+      Check_Type(v_rcache, T_STRING);
+
+    if(!NIL_P(v_server))
+      Check_Type(v_server, T_STRING);
+  }
+
+  ptr->skew = skew;
+
+  // No library replay cache is used for 'none:'.
+  if(NIL_P(v_rcache))
+    ptr->rcache_name = strdup("dfl:");
+  else if(strcmp(StringValueCStr(v_rcache), "none:"))
+    ptr->rcache_name = strdup(StringValueCStr(v_rcache));
+
+#ifndef HAVE_KRB5_RC_RESOLVE_FULL
+  if(ptr->rcache_name && strcmp(ptr->rcache_name, "dfl:"))
+    rb_raise(cKrb5Exception, "only 'dfl:' and 'none:' replay caches are supported by this krb5 library");
+#endif
+
+  kerror = krb5_init_context(&ptr->ctx);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_init_context: %s", error_message(kerror));
+
+#ifdef HAVE_KRB5_RC_RESOLVE_FULL
+  if(ptr->rcache_name){
+    kerror = krb5_rc_resolve_full(ptr->ctx, &ptr->library_rcache, ptr->rcache_name);
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "krb5_rc_resolve_full: %s", error_message(kerror));
+
+    kerror = krb5_rc_recover_or_initialize(ptr->ctx, ptr->library_rcache, ptr->skew);
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "krb5_rc_recover_or_initialize: %s", error_message(kerror));
+  }
+#endif
+
+  if(!NIL_P(v_server)){
+    kerror = krb5_parse_name(ptr->ctx, StringValueCStr(v_server), &ptr->server);
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "krb5_parse_name: %s", error_message(kerror));
+  }
+
+  if(NIL_P(v_keytab))
+    kerror = krb5_kt_default(ptr->ctx, &keytab);
+  else
+    kerror = krb5_kt_resolve(ptr->ctx, StringValueCStr(v_keytab), &keytab);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_kt_resolve: %s", error_message(kerror));
+
+  rkrb5_kt_memory_name(ptr->keytab_name, sizeof(ptr->keytab_name), "rkerberos_acceptor");
+
+  kerror = rkrb5_kt_load_memory(ptr->ctx, keytab, ptr->keytab_name, &ptr->keytab, &func);
+  krb5_kt_close(ptr->ctx, keytab);
+
+  if(kerror){
+    ptr->keytab = NULL;
+    rb_raise(cKrb5Exception, "%s: %s", func, error_message(kerror));
+  }
+
+  return self;
+}
+
+/*
+ * call-seq:
+ *   acceptor.verify(token)
+ *
+ * Verifies +token+, the AP-REQ sent by a client, and returns an
+ * Acceptor::Result describing the ticket. Raises a Krb5::Exception if the
+ * token is invalid, expired, replayed or for a principal not in the keytab.
+ *
+ * The GVL is released while verifying, and each call uses a krb5_context
+ * from a pool kept by the acceptor, so this method may be called from
+ * several threads at once.
+ */
+static VALUE rkrb5_acceptor_verify(VALUE self, VALUE v_token){
+  RUBY_KRB5_ACCEPTOR* ptr;
+  RKRB5_VERIFY v;
+
+  Data_Get_Struct(self, RUBY_KRB5_ACCEPTOR, ptr);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  Check_Type(v_token, T_STRING);
+
+  memset(&v, 0, sizeof(v));
+  v.ptr = ptr;
+  v.v_token = rb_str_new_frozen(v_token);
+
+  rkrb5_acceptor_slot_get(ptr, &v.slot);
+
+  return rb_ensure(rkrb5_acceptor_verify_call, (VALUE)&v, rkrb5_acceptor_verify_ensure, (VALUE)&v);
+}
+
+// State shared by the worker threads of Acceptor#verify_many.
+typedef struct {
+  RUBY_KRB5_ACCEPTOR* ptr;
+  char* tokens;
+  long* offsets;
+  long count;
+  int concurrency;
+  RKRB5_AP_RESULT* results;
+} RKRB5_VERIFY_MANY;
+
+// Each worker takes its own slot, and so its own context, for the batch.
+static void* rkrb5_acceptor_verify_many_setup(void* data){
+  RKRB5_VERIFY_MANY* many = data;
+  RKRB5_ACCEPTOR_SLOT* slot = malloc(sizeof(RKRB5_ACCEPTOR_SLOT));
+
+  if(slot)
+    rkrb5_acceptor_slot_get(many->ptr, slot);
+
+  return slot;
+}
+
+static void rkrb5_acceptor_verify_many_run(void* data, void* state, long i){
+  RKRB5_VERIFY_MANY* many = data;
+  long offset = many->offsets[i];
+
+  if(!state){
+    many->results[i].kerror = ENOMEM;
+    many->results[i].func = "malloc";
+    return;
+  }
+
+  rkrb5_acceptor_rd_req(many->ptr, state, many->tokens + offset, many->offsets[i + 1] - offset, &many->results[i]);
+}
+
+static void rkrb5_acceptor_verify_many_teardown(void* data, void* state){
+  RKRB5_VERIFY_MANY* many = data;
+
+  if(state){
+    rkrb5_acceptor_slot_put(many->ptr, state);
+    free(state);
+  }
+}
+
+static VALUE rkrb5_acceptor_verify_many_results(VALUE v_arg){
+  RKRB5_VERIFY_MANY* many = (RKRB5_VERIFY_MANY*)v_arg;
+  RKRB5_POOL_JOB job;
+  VALUE v_results;
+  long i, started;
+
+  job.count = many->count;
+  job.concurrency = many->concurrency;
+  job.data = many;
+  job.setup = rkrb5_acceptor_verify_many_setup;
+  job.run = rkrb5_acceptor_verify_many_run;
+  job.teardown = rkrb5_acceptor_verify_many_teardown;
+
+  started = rkrb5_pool_run(&job);
+
+  // Raise if we were interrupted before every token was tried.
+  if(started < many->count)
+    rb_thread_check_ints();
+
+  v_results = rb_ary_new2(many->count);
+
+  for(i = 0; i < many->count; i++){
+    RKRB5_AP_RESULT* result = &many->results[i];
+
+    if(i >= started){
+      rb_ary_push(v_results, rb_exc_new_cstr(cKrb5Exception, "verify_many: interrupted before this token was verified"));
+    }
+    else if(result->kerror){
+      rb_ary_push(v_results, rb_exc_new_str(
+        cKrb5Exception,
+        rb_sprintf("%s: %s", result->func, error_message(result->kerror))
+      ));
+    }
+    else{
+      rb_ary_push(v_results, rkrb5_acceptor_result_new(many->ptr->ctx, result));
+    }
+  }
+
+  return v_results;
+}
+
+// The results were made in the workers' contexts, but freeing them only
+// releases memory, so the acceptor's own context will do.
+static VALUE rkrb5_acceptor_verify_many_cleanup(VALUE v_arg){
+  RKRB5_VERIFY_MANY* many = (RKRB5_VERIFY_MANY*)v_arg;
+  long i;
+
+  for(i = 0; i < many->count; i++)
+    rkrb5_acceptor_result_free(many->ptr->ctx, &many->results[i]);
+
+  free(many->results);
+  free(many->offsets);
+  free(many->tokens);
+
+  pthread_mutex_lock(&many->ptr->lock);
+  many->ptr->busy--;
+  pthread_mutex_unlock(&many->ptr->lock);
+
+  return Qnil;
+}
+
+/*
+ * call-seq:
+ *   acceptor.verify_many(tokens, :concurrency => nil)
+ *
+ * Verifies each AP-REQ in the +tokens+ array, spreading the work across up
+ * to +concurrency+ native threads without holding the GVL. Each thread uses
+ * its own context. The default concurrency is the number of online CPUs.
+ *
+ * Returns an array with an element for each token, in the same order.
+ * Each element is either an Acceptor::Result, or the Krb5::Exception that
+ * Acceptor#verify would have raised for that token. If the calling thread
+ * is interrupted, tokens that were never tried get an exception saying so.
+ *
+ * Example:
+ *
+ *   acceptor.verify_many(tokens).each_with_index{ |result, i|
+ *     reject(requests[i]) if result.is_a?(Exception)
+ *   }
+ */
+static VALUE rkrb5_acceptor_verify_many(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5_ACCEPTOR* ptr;
+  RKRB5_VERIFY_MANY many;
+  VALUE v_tokens, v_opts, v_concurrency = Qnil, v_token;
+  long i, size = 0;
+
+  Data_Get_Struct(self, RUBY_KRB5_ACCEPTOR, ptr);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  rb_scan_args(argc, argv, "11", &v_tokens, &v_opts);
+
+  Check_Type(v_tokens, T_ARRAY);
+
+  memset(&many, 0, sizeof(many));
+  many.ptr = ptr;
+  many.concurrency = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+  if(many.concurrency < 1)
+    many.concurrency = 1;
+
+  if(!NIL_P(v_opts)){
+    Check_Type(v_opts, T_HASH);
+    v_concurrency = rb_hash_aref2(v_opts, "concurrency");
+
+    if(!NIL_P(v_concurrency)){
+      many.concurrency = NUM2INT(v_concurrency);
+
+      if(many.concurrency < 1)
+        rb_raise(rb_eArgError, "concurrency must be a positive number");
+    }
+  }
+
+  for(i = 0; i < RARRAY_LEN(v_tokens); i++){
+    v_token = rb_ary_entry(v_tokens, i);
+    Check_Type(v_token, T_STRING);
+    size += RSTRING_LEN(v_token);
+  }
+
+  many.count = RARRAY_LEN(v_tokens);
+
+  if(many.count == 0)
+    return rb_ary_new();
+
+  // The workers read malloc'd copies of the tokens, since Ruby strings may
+  // be changed or moved by the GC while the GVL is released. Nothing below
+  // raises until the ensure function is in place to free them.
+  many.results = calloc(many.count, sizeof(RKRB5_AP_RESULT));
+  many.offsets = malloc(sizeof(long) * (many.count + 1));
+  many.tokens = malloc(size ? size : 1);
+
+  if(!many.results || !many.offsets || !many.tokens){
+    free(many.results);
+    free(many.offsets);
+    free(many.tokens);
+    rb_raise(rb_eNoMemError, "failed to allocate memory");
+  }
+
+  many.offsets[0] = 0;
+
+  for(i = 0; i < many.count; i++){
+    v_token = RARRAY_AREF(v_tokens, i);
+    memcpy(many.tokens + many.offsets[i], RSTRING_PTR(v_token), RSTRING_LEN(v_token));
+    many.offsets[i + 1] = many.offsets[i] + RSTRING_LEN(v_token);
+  }
+
+  // Count the batch as a use, so the acceptor can't be closed under it.
+  pthread_mutex_lock(&ptr->lock);
+  ptr->busy++;
+  pthread_mutex_unlock(&ptr->lock);
+
+  return rb_ensure(rkrb5_acceptor_verify_many_results, (VALUE)&many, rkrb5_acceptor_verify_many_cleanup, (VALUE)&many);
+}
+
+/*
+ * call-seq:
+ *   acceptor.close
+ *
+ * Closes the acceptor, freeing its contexts and the in-memory keytab.
+ * Raises an error if a verification is still in progress.
+ */
+static VALUE rkrb5_acceptor_close(VALUE self){
+  RUBY_KRB5_ACCEPTOR* ptr;
+  int i, busy;
+
+  Data_Get_Struct(self, RUBY_KRB5_ACCEPTOR, ptr);
+
+  pthread_mutex_lock(&ptr->lock);
+  busy = ptr->busy;
+  pthread_mutex_unlock(&ptr->lock);
+
+  if(busy)
+    rb_raise(cKrb5Exception, "acceptor is in use by another thread");
+
+  if(!ptr->ctx)
+    return Qtrue;
+
+  for(i = 0; i < ptr->idle_count; i++)
+    rkrb5_acceptor_slot_free(&ptr->idle[i]);
+
+  if(ptr->server)
+    krb5_free_principal(ptr->ctx, ptr->server);
+
+  // The slots' handles are closed, so this is the last one.
+  if(ptr->keytab){
+    rkrb5_kt_clear_memory(ptr->ctx, ptr->keytab);
+    krb5_kt_close(ptr->ctx, ptr->keytab);
+  }
+
+#ifdef HAVE_KRB5_RC_RESOLVE_FULL
+  if(ptr->library_rcache)
+    krb5_rc_close(ptr->ctx, ptr->library_rcache);
+
+  ptr->library_rcache = NULL;
+#endif
+
+  krb5_free_context(ptr->ctx);
+  free(ptr->rcache_name);
+
+  ptr->rcache_name = NULL;
+  ptr->idle_count = 0;
+  ptr->server = NULL;
+  ptr->keytab = NULL;
+  ptr->ctx = NULL;
+
+  return Qtrue;
+}
+
+void Init_acceptor(){
+  /* The Kerberos::Krb5::Acceptor class verifies tickets presented to a service. */
+  cKrb5Acceptor = rb_define_class_under(cKrb5, "Acceptor", rb_cObject);
+
+  /* The Kerberos::Krb5::Acceptor::Result class describes a verified ticket. */
+  cKrb5AcceptorResult = rb_define_class_under(cKrb5Acceptor, "Result", rb_cObject);
+
+  // Allocation Function
+  rb_define_alloc_func(cKrb5Acceptor, rkrb5_acceptor_allocate);
+
+  // Constructor
+  rb_define_method(cKrb5Acceptor, "initialize", rkrb5_acceptor_initialize, -1);
+
+  // Instance Methods
+  rb_define_method(cKrb5Acceptor, "close", rkrb5_acceptor_close, 0);
+  rb_define_method(cKrb5Acceptor, "verify", rkrb5_acceptor_verify, 1);
+  rb_define_method(cKrb5Acceptor, "verify_many", rkrb5_acceptor_verify_many, -1);
+
+  // Result Accessors
+  rb_define_attr(cKrb5AcceptorResult, "client", 1, 0);
+  rb_define_attr(cKrb5AcceptorResult, "server", 1, 0);
+  rb_define_attr(cKrb5AcceptorResult, "authtime", 1, 0);
+  rb_define_attr(cKrb5AcceptorResult, "starttime", 1, 0);
+  rb_define_attr(cKrb5AcceptorResult, "endtime", 1, 0);
+  rb_define_attr(cKrb5AcceptorResult, "flags", 1, 0);
+  rb_define_attr(cKrb5AcceptorResult, "enctype", 1, 0);
+  rb_define_attr(cKrb5AcceptorResult, "authdata", 1, 0);
+  rb_define_attr(cKrb5AcceptorResult, "pac", 1, 0);
+}
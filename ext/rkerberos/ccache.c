@@ -2,6 +2,39 @@
 
 VALUE cKrb5CCache;
 
+// Arguments for krb5_get_credentials, which runs without the GVL.
+typedef struct {
+  krb5_context ctx;
+  krb5_flags options;
+  krb5_ccache ccache;
+  krb5_creds* in_creds;
+  krb5_creds* out_creds;
+  krb5_error_code kerror;
+} RKRB5_GET_CREDS;
+
+// Cursor state for CredentialsCache.each_in_collection.
+typedef struct {
+  krb5_context ctx;
+  krb5_cccol_cursor cursor;
+} RKRB5_CCCOL_ITER;
+
+// Cursor state for CredentialsCache#each and CredentialsCache#export.
+typedef struct {
+  RUBY_KRB5_CCACHE* ptr;
+  krb5_cc_cursor cursor;
+  VALUE v_buf;
+  krb5_ui_4 count;
+} RKRB5_CC_ITER;
+
+// Bounds checked cursor over a blob passed to CredentialsCache.import.
+typedef struct {
+  const unsigned char* p;
+  long left;
+} RKRB5_READER;
+
+// Header of the blobs produced by CredentialsCache#export.
+#define RKRB5_EXPORT_MAGIC "RKC\x01"
+
 // Free function for the Kerberos::Krb5::CCache class.
 static void rkrb5_ccache_free(RUBY_KRB5_CCACHE* ptr){
   if(!ptr)
@@ -50,10 +83,17 @@ static VALUE rkrb5_ccache_initialize(int argc, VALUE* argv, VALUE self){
 
   rb_scan_args(argc, argv, "02", &v_principal, &v_name);
 
-  // Convert the principal name to a principal object
-  if(RTEST(v_principal)){
+  if(RTEST(v_principal))
     Check_Type(v_principal, T_STRING);
 
+  // Initialize the context
+  kerror = krb5_init_context(&ptr->ctx);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_init_context: %s", error_message(kerror));
+
+  // Convert the principal name to a principal object
+  if(RTEST(v_principal)){
     kerror = krb5_parse_name(
       ptr->ctx,
       StringValueCStr(v_principal),
@@ -64,12 +104,6 @@ static VALUE rkrb5_ccache_initialize(int argc, VALUE* argv, VALUE self){
       rb_raise(cKrb5Exception, "krb5_parse_name: %s", error_message(kerror));
   }
 
-  // Initialize the context
-  kerror = krb5_init_context(&ptr->ctx);
-
-  if(kerror)
-    rb_raise(cKrb5Exception, "krb5_init_context: %s", error_message(kerror));
-
   // Set the credentials cache using the default cache if no name is provided
   if(NIL_P(v_name)){
     kerror = krb5_cc_default(ptr->ctx, &ptr->ccache);
@@ -229,21 +263,1105 @@ static VALUE rkrb5_ccache_destroy(VALUE self){
   return v_bool;
 }
 
-void Init_ccache(){
-  /* The Kerberos::Krb5::CredentialsCache class encapsulates a Kerberos credentials cache. */
-  cKrb5CCache = rb_define_class_under(cKrb5, "CredentialsCache", rb_cObject);
+static VALUE rkrb5_ccache_each_yield(VALUE v_arg){
+  RUBY_KRB5_CCACHE* ptr = ((RKRB5_CC_ITER*)v_arg)->ptr;
+  krb5_cc_cursor* cursor = &((RKRB5_CC_ITER*)v_arg)->cursor;
+  krb5_error_code kerror;
+  krb5_creds creds;
 
-  // Allocation Function
-  rb_define_alloc_func(cKrb5CCache, rkrb5_ccache_allocate);
+  while((kerror = krb5_cc_next_cred(ptr->ctx, ptr->ccache, cursor, &creds)) == 0){
+    // Skip the configuration entries that some cache types store as creds.
+    if(krb5_is_config_principal(ptr->ctx, creds.server)){
+      krb5_free_cred_contents(ptr->ctx, &creds);
+      continue;
+    }
 
-  // Constructor
-  rb_define_method(cKrb5CCache, "initialize", rkrb5_ccache_initialize, -1);
+    rb_yield(rkrb5_creds_new(ptr->ctx, &creds));
+  }
+
+  if(kerror != KRB5_CC_END)
+    rb_raise(cKrb5Exception, "krb5_cc_next_cred: %s", error_message(kerror));
+
+  return Qnil;
+}
+
+static VALUE rkrb5_ccache_each_end(VALUE v_arg){
+  RUBY_KRB5_CCACHE* ptr = ((RKRB5_CC_ITER*)v_arg)->ptr;
+  krb5_cc_end_seq_get(ptr->ctx, ptr->ccache, &((RKRB5_CC_ITER*)v_arg)->cursor);
+  return Qnil;
+}
+
+/*
+ * call-seq:
+ *   ccache.each{ |creds| p creds }
+ *
+ * Iterates over each ticket in the credentials cache, yielding a
+ * Kerberos::Krb5::Credentials object for each one. The objects take over
+ * the credentials read from the cache as-is; the ticket itself is only
+ * turned into a Ruby string if Credentials#ticket is called.
+ *
+ * Example:
+ *
+ *   ccache = Kerberos::Krb5::CredentialsCache.new
+ *   tgt = ccache.find{ |creds| creds.server =~ /^krbtgt\// }
+ *   puts "expires at #{tgt.endtime}" if tgt
+ */
+static VALUE rkrb5_ccache_each(VALUE self){
+  RUBY_KRB5_CCACHE* ptr;
+  RKRB5_CC_ITER iter;
+  krb5_error_code kerror;
+
+  RETURN_ENUMERATOR(self, 0, 0);
+
+  Data_Get_Struct(self, RUBY_KRB5_CCACHE, ptr);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  iter.ptr = ptr;
+
+  kerror = krb5_cc_start_seq_get(ptr->ctx, ptr->ccache, &iter.cursor);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_cc_start_seq_get: %s", error_message(kerror));
+
+  rb_ensure(rkrb5_ccache_each_yield, (VALUE)&iter, rkrb5_ccache_each_end, (VALUE)&iter);
+
+  return self;
+}
+
+static void* rkrb5_ccache_get_credentials_nogvl(void* arg){
+  RKRB5_GET_CREDS* gc = arg;
+
+  gc->kerror = krb5_get_credentials(
+    gc->ctx,
+    gc->options,
+    gc->ccache,
+    gc->in_creds,
+    &gc->out_creds
+  );
+
+  return NULL;
+}
+
+/*
+ * call-seq:
+ *   ccache.get_credentials(server, options = {})
+ *
+ * Returns a Kerberos::Krb5::Credentials object holding a service ticket for
+ * the +server+ principal, e.g. 'HTTP/www.example.com@EXAMPLE.COM', for the
+ * primary principal of the cache.
+ *
+ * The cache is checked first. If no valid ticket is found one is requested
+ * from the KDC using the ticket granting ticket in the cache, and the new
+ * ticket is stored back into the cache. The KDC exchange runs without
+ * holding the GVL.
+ *
+ * The following options are supported:
+ *
+ *   :cache_only => true  - only look in the cache, never contact the KDC
+ *   :no_store   => true  - don't store a newly acquired ticket in the cache
+ *   :enctype    => n     - request a session key of this encryption type
+ *
+ * Each CredentialsCache object has its own context and should not be used
+ * from more than one thread at a time. To fan out requests from several
+ * threads, open a CredentialsCache object per thread on the same cache name.
+ */
+static VALUE rkrb5_ccache_get_credentials(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5_CCACHE* ptr;
+  RKRB5_GET_CREDS gc;
+  krb5_error_code kerror;
+  krb5_creds in_creds, creds;
+  VALUE v_server, v_opts;
+
+  Data_Get_Struct(self, RUBY_KRB5_CCACHE, ptr);
+
+  rb_scan_args(argc, argv, "11", &v_server, &v_opts);
+
+  Check_Type(v_server, T_STRING);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  memset(&gc, 0, sizeof(gc));
+  memset(&in_creds, 0, sizeof(in_creds));
+
+  if(!NIL_P(v_opts)){
+    VALUE v_enctype;
+
+    Check_Type(v_opts, T_HASH);
+
+    if(RTEST(rb_hash_aref2(v_opts, "cache_only")))
+      gc.options |= KRB5_GC_CACHED;
+
+    if(RTEST(rb_hash_aref2(v_opts, "no_store")))
+      gc.options |= KRB5_GC_NO_STORE;
+
+    v_enctype = rb_hash_aref2(v_opts, "enctype");
+
+    if(!NIL_P(v_enctype))
+      in_creds.keyblock.enctype = NUM2INT(v_enctype);
+  }
+
+  kerror = krb5_parse_name(ptr->ctx, StringValueCStr(v_server), &in_creds.server);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_parse_name: %s", error_message(kerror));
+
+  kerror = krb5_cc_get_principal(ptr->ctx, ptr->ccache, &in_creds.client);
+
+  if(kerror){
+    krb5_free_principal(ptr->ctx, in_creds.server);
+    rb_raise(cKrb5Exception, "krb5_cc_get_principal: %s", error_message(kerror));
+  }
+
+  gc.ctx = ptr->ctx;
+  gc.ccache = ptr->ccache;
+  gc.in_creds = &in_creds;
+
+  rb_thread_call_without_gvl(rkrb5_ccache_get_credentials_nogvl, &gc, RUBY_UBF_IO, NULL);
+
+  krb5_free_principal(ptr->ctx, in_creds.client);
+  krb5_free_principal(ptr->ctx, in_creds.server);
+
+  if(gc.kerror)
+    rb_raise(cKrb5Exception, "krb5_get_credentials: %s", error_message(gc.kerror));
+
+  // Only the contents are handed over, so release the struct first.
+  creds = *gc.out_creds;
+  free(gc.out_creds);
+
+  return rkrb5_creds_new(ptr->ctx, &creds);
+}
+
+// Singleton Methods
+
+// Private function that allocates a CredentialsCache with a fresh context.
+static VALUE rkrb5_ccache_create(VALUE klass, RUBY_KRB5_CCACHE** pptr){
+  krb5_error_code kerror;
+  VALUE v_ccache = rkrb5_ccache_allocate(klass);
+
+  Data_Get_Struct(v_ccache, RUBY_KRB5_CCACHE, *pptr);
+
+  kerror = krb5_init_context(&(*pptr)->ctx);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_init_context: %s", error_message(kerror));
+
+  return v_ccache;
+}
+
+// Ensure function for the block forms. The block may already have destroyed
+// or closed the cache itself, which is fine.
+static VALUE rkrb5_ccache_setup_ensure(VALUE v_ccache){
+  RUBY_KRB5_CCACHE* ptr;
+
+  Data_Get_Struct(v_ccache, RUBY_KRB5_CCACHE, ptr);
+
+  if(!ptr->ctx)
+    return Qnil;
+
+  return rkrb5_ccache_destroy(v_ccache);
+}
+
+// Private function that initializes a newly created cache for +v_principal+,
+// if one was given. If a block was given the cache is yielded and the
+// block's value is returned in its place.
+static VALUE rkrb5_ccache_setup(VALUE v_ccache, RUBY_KRB5_CCACHE* ptr, VALUE v_principal){
+  krb5_error_code kerror;
+
+  if(RTEST(v_principal)){
+    Check_Type(v_principal, T_STRING);
+
+    kerror = krb5_parse_name(ptr->ctx, StringValueCStr(v_principal), &ptr->principal);
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "krb5_parse_name: %s", error_message(kerror));
+
+    kerror = krb5_cc_initialize(ptr->ctx, ptr->ccache, ptr->principal);
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "krb5_cc_initialize: %s", error_message(kerror));
+  }
+
+  if(rb_block_given_p())
+    return rb_ensure(rb_yield, v_ccache, rkrb5_ccache_setup_ensure, v_ccache);
+
+  return v_ccache;
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5::CredentialsCache.new_unique(type = 'MEMORY', principal = nil)
+ *   Kerberos::Krb5::CredentialsCache.new_unique(type = 'MEMORY', principal = nil){ |ccache| ... } => obj
+ *
+ * Creates a new credentials cache of +type+ (e.g. 'MEMORY', 'FILE',
+ * 'KEYRING' or 'KCM') with a name that is guaranteed not to clash with any
+ * existing cache. If a +principal+ is given the cache is initialized for it.
+ *
+ * If a block is given the cache is yielded and destroyed when the block
+ * returns, and the value of the block is returned.
+ */
+static VALUE rkrb5_s_ccache_new_unique(int argc, VALUE* argv, VALUE klass){
+  RUBY_KRB5_CCACHE* ptr;
+  krb5_error_code kerror;
+  VALUE v_type, v_principal, v_ccache;
+  const char* type = "MEMORY";
+
+  rb_scan_args(argc, argv, "02", &v_type, &v_principal);
+
+  if(!NIL_P(v_type)){
+    Check_Type(v_type, T_STRING);
+    type = StringValueCStr(v_type);
+  }
+
+  v_ccache = rkrb5_ccache_create(klass, &ptr);
+
+  kerror = krb5_cc_new_unique(ptr->ctx, type, NULL, &ptr->ccache);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_cc_new_unique: %s", error_message(kerror));
+
+  return rkrb5_ccache_setup(v_ccache, ptr, v_principal);
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5::CredentialsCache.memory(principal = nil)
+ *   Kerberos::Krb5::CredentialsCache.memory(principal = nil){ |ccache| ... } => obj
+ *
+ * Creates a new, uniquely named MEMORY: credentials cache. This is the
+ * cheapest cache type, since nothing is written to disk, and is a good
+ * choice for short lived, per request caches.
+ *
+ * A memory cache lives until it is destroyed, even after the object is
+ * closed, so call CredentialsCache#destroy when done or use the block form,
+ * which destroys the cache when the block returns and returns the value of
+ * the block.
+ */
+static VALUE rkrb5_s_ccache_memory(int argc, VALUE* argv, VALUE klass){
+  VALUE v_principal;
+  VALUE v_args[2];
+
+  rb_scan_args(argc, argv, "01", &v_principal);
+
+  v_args[0] = rb_str_new2("MEMORY");
+  v_args[1] = v_principal;
+
+  return rkrb5_s_ccache_new_unique(2, v_args, klass);
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5::CredentialsCache.keyring(name, principal = nil)
+ *
+ * Opens the kernel keyring credentials cache +name+. The 'KEYRING:' prefix
+ * is added if +name+ doesn't already have it, so 'persistent:1000' and
+ * 'KEYRING:persistent:1000' are equivalent.
+ *
+ * If a +principal+ is given the cache is initialized for it, which destroys
+ * any existing contents. Otherwise the cache is left as it is.
+ */
+static VALUE rkrb5_s_ccache_keyring(int argc, VALUE* argv, VALUE klass){
+  RUBY_KRB5_CCACHE* ptr;
+  krb5_error_code kerror;
+  VALUE v_name, v_principal, v_ccache;
+
+  rb_scan_args(argc, argv, "11", &v_name, &v_principal);
+
+  Check_Type(v_name, T_STRING);
+
+  if(strncmp(RSTRING_PTR(v_name), "KEYRING:", 8) != 0)
+    v_name = rb_str_plus(rb_str_new2("KEYRING:"), v_name);
+
+  v_ccache = rkrb5_ccache_create(klass, &ptr);
+
+  kerror = krb5_cc_resolve(ptr->ctx, StringValueCStr(v_name), &ptr->ccache);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_cc_resolve: %s", error_message(kerror));
+
+  return rkrb5_ccache_setup(v_ccache, ptr, v_principal);
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5::CredentialsCache.open(name = nil)
+ *
+ * Opens an existing credentials cache by +name+, in "type:residual" format,
+ * or the default cache if no name is given. Unlike CredentialsCache.new the
+ * cache is never reinitialized, so any tickets in it are preserved.
+ */
+static VALUE rkrb5_s_ccache_open(int argc, VALUE* argv, VALUE klass){
+  RUBY_KRB5_CCACHE* ptr;
+  krb5_error_code kerror;
+  VALUE v_name, v_ccache;
+
+  rb_scan_args(argc, argv, "01", &v_name);
+
+  if(!NIL_P(v_name))
+    Check_Type(v_name, T_STRING);
+
+  v_ccache = rkrb5_ccache_create(klass, &ptr);
+
+  if(NIL_P(v_name)){
+    kerror = krb5_cc_default(ptr->ctx, &ptr->ccache);
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "krb5_cc_default: %s", error_message(kerror));
+  }
+  else{
+    kerror = krb5_cc_resolve(ptr->ctx, StringValueCStr(v_name), &ptr->ccache);
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "krb5_cc_resolve: %s", error_message(kerror));
+  }
+
+  return v_ccache;
+}
+
+/*
+ * call-seq:
+ *   ccache.name
+ *
+ * Returns the full name of the credentials cache in "type:residual" format,
+ * e.g. "MEMORY:aBc123". This can be passed to CredentialsCache.open, or set
+ * as KRB5CCNAME for a child process.
+ */
+static VALUE rkrb5_ccache_name(VALUE self){
+  RUBY_KRB5_CCACHE* ptr;
+  krb5_error_code kerror;
+  char* name;
+  VALUE v_name;
+
+  Data_Get_Struct(self, RUBY_KRB5_CCACHE, ptr);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  kerror = krb5_cc_get_full_name(ptr->ctx, ptr->ccache, &name);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_cc_get_full_name: %s", error_message(kerror));
+
+  v_name = rb_str_new2(name);
+  krb5_free_string(ptr->ctx, name);
+
+  return v_name;
+}
+
+static VALUE rkrb5_s_ccache_each_in_collection_yield(VALUE v_arg){
+  RKRB5_CCCOL_ITER* iter = (RKRB5_CCCOL_ITER*)v_arg;
+  RUBY_KRB5_CCACHE* ptr;
+  krb5_error_code kerror;
+  krb5_ccache ccache;
+  char* name;
+  VALUE v_ccache;
+
+  while((kerror = krb5_cccol_cursor_next(iter->ctx, iter->cursor, &ccache)) == 0 && ccache){
+    kerror = krb5_cc_get_full_name(iter->ctx, ccache, &name);
+    krb5_cc_close(iter->ctx, ccache);
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "krb5_cc_get_full_name: %s", error_message(kerror));
+
+    // Every CredentialsCache object owns its context, so the cache is
+    // resolved again by name in the new object's context.
+    v_ccache = rkrb5_ccache_create(cKrb5CCache, &ptr);
+    kerror = krb5_cc_resolve(ptr->ctx, name, &ptr->ccache);
+    krb5_free_string(iter->ctx, name);
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "krb5_cc_resolve: %s", error_message(kerror));
+
+    rb_yield(v_ccache);
+  }
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_cccol_cursor_next: %s", error_message(kerror));
+
+  return Qnil;
+}
+
+static VALUE rkrb5_s_ccache_each_in_collection_end(VALUE v_arg){
+  RKRB5_CCCOL_ITER* iter = (RKRB5_CCCOL_ITER*)v_arg;
+
+  krb5_cccol_cursor_free(iter->ctx, &iter->cursor);
+  krb5_free_context(iter->ctx);
+
+  return Qnil;
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5::CredentialsCache.each_in_collection{ |ccache| ... }
+ *
+ * Iterates over every credentials cache in the cache collection, yielding
+ * a CredentialsCache object for each one. This includes all the caches of
+ * collection-aware types such as DIR:, KEYRING: and KCM:, as well as the
+ * default cache.
+ *
+ * Example:
+ *
+ *   ccache = Kerberos::Krb5::CredentialsCache.each_in_collection.find{ |cc|
+ *     cc.primary_principal == 'alice@EXAMPLE.COM' rescue false
+ *   }
+ */
+static VALUE rkrb5_s_ccache_each_in_collection(VALUE klass){
+  RKRB5_CCCOL_ITER iter;
+  krb5_error_code kerror;
+
+  RETURN_ENUMERATOR(klass, 0, 0);
+
+  kerror = krb5_init_context(&iter.ctx);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_init_context: %s", error_message(kerror));
+
+  kerror = krb5_cccol_cursor_new(iter.ctx, &iter.cursor);
+
+  if(kerror){
+    krb5_free_context(iter.ctx);
+    rb_raise(cKrb5Exception, "krb5_cccol_cursor_new: %s", error_message(kerror));
+  }
+
+  rb_ensure(
+    rkrb5_s_ccache_each_in_collection_yield, (VALUE)&iter,
+    rkrb5_s_ccache_each_in_collection_end, (VALUE)&iter
+  );
+
+  return klass;
+}
+
+/*
+ * call-seq:
+ *   ccache.switch_to
+ *
+ * Makes this cache the primary cache of its collection, so that it becomes
+ * the default cache for this and other processes using the collection.
+ * Only collection-aware cache types such as DIR:, KEYRING: and KCM:
+ * support this.
+ */
+static VALUE rkrb5_ccache_switch_to(VALUE self){
+  RUBY_KRB5_CCACHE* ptr;
+  krb5_error_code kerror;
+
+  Data_Get_Struct(self, RUBY_KRB5_CCACHE, ptr);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  kerror = krb5_cc_switch(ptr->ctx, ptr->ccache);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_cc_switch: %s", error_message(kerror));
+
+  return self;
+}
+
+/*
+ * call-seq:
+ *   ccache.copy_to(other)
+ *
+ * Copies every ticket in this cache into +other+, which may be another
+ * CredentialsCache object or a cache name in "type:residual" format. The
+ * target cache is first initialized for the primary principal of this
+ * cache, so any tickets it held before are discarded.
+ *
+ * Combined with CredentialsCache.memory this lets one set of tickets,
+ * obtained with a single KDC exchange, seed any number of caches.
+ *
+ * Example:
+ *
+ *   master = Kerberos::Krb5::CredentialsCache.open
+ *   workers = 8.times.map{
+ *     Kerberos::Krb5::CredentialsCache.memory.tap{ |cc| master.copy_to(cc) }
+ *   }
+ */
+static VALUE rkrb5_ccache_copy_to(VALUE self, VALUE v_other){
+  RUBY_KRB5_CCACHE* ptr;
+  krb5_error_code kerror;
+  krb5_principal principal;
+  krb5_ccache out;
+  const char* func;
+
+  Data_Get_Struct(self, RUBY_KRB5_CCACHE, ptr);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  if(rb_obj_is_kind_of(v_other, cKrb5CCache)){
+    RUBY_KRB5_CCACHE* optr;
+    char* name;
+
+    Data_Get_Struct(v_other, RUBY_KRB5_CCACHE, optr);
+
+    if(!optr->ctx)
+      rb_raise(cKrb5Exception, "no context has been established");
+
+    kerror = krb5_cc_get_full_name(optr->ctx, optr->ccache, &name);
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "krb5_cc_get_full_name: %s", error_message(kerror));
+
+    // A ccache handle belongs to the context it was resolved in.
+    kerror = krb5_cc_resolve(ptr->ctx, name, &out);
+    krb5_free_string(optr->ctx, name);
+  }
+  else{
+    Check_Type(v_other, T_STRING);
+    kerror = krb5_cc_resolve(ptr->ctx, StringValueCStr(v_other), &out);
+  }
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_cc_resolve: %s", error_message(kerror));
+
+  func = "krb5_cc_get_principal";
+  kerror = krb5_cc_get_principal(ptr->ctx, ptr->ccache, &principal);
+
+  if(!kerror){
+    func = "krb5_cc_initialize";
+    kerror = krb5_cc_initialize(ptr->ctx, out, principal);
+
+    if(!kerror){
+      func = "krb5_cc_copy_creds";
+      kerror = krb5_cc_copy_creds(ptr->ctx, ptr->ccache, out);
+    }
+
+    krb5_free_principal(ptr->ctx, principal);
+  }
+
+  krb5_cc_close(ptr->ctx, out);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "%s: %s", func, error_message(kerror));
+
+  return v_other;
+}
+
+/*
+ * call-seq:
+ *   ccache.store(creds)
+ *
+ * Stores the Kerberos::Krb5::Credentials object +creds+ in this cache. The
+ * cache must already be initialized, e.g. by CredentialsCache.new or
+ * CredentialsCache.memory with a principal.
+ */
+static VALUE rkrb5_ccache_store(VALUE self, VALUE v_creds){
+  RUBY_KRB5_CCACHE* ptr;
+  RUBY_KRB5_CREDS* cptr;
+  krb5_error_code kerror;
+
+  Data_Get_Struct(self, RUBY_KRB5_CCACHE, ptr);
+
+  if(!rb_obj_is_kind_of(v_creds, cKrb5Creds))
+    rb_raise(rb_eTypeError, "argument must be a Kerberos::Krb5::Credentials object");
+
+  Data_Get_Struct(v_creds, RUBY_KRB5_CREDS, cptr);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  kerror = krb5_cc_store_cred(ptr->ctx, ptr->ccache, &cptr->creds);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_cc_store_cred: %s", error_message(kerror));
+
+  return self;
+}
+
+/*
+ * call-seq:
+ *   ccache.retrieve(server)
+ *
+ * Looks up the ticket for the +server+ principal issued to the primary
+ * principal of this cache, and returns it as a Kerberos::Krb5::Credentials
+ * object. Returns nil if the cache holds no such ticket.
+ *
+ * Unlike CredentialsCache#get_credentials this never contacts the KDC.
+ */
+static VALUE rkrb5_ccache_retrieve(VALUE self, VALUE v_server){
+  RUBY_KRB5_CCACHE* ptr;
+  krb5_error_code kerror;
+  krb5_creds mcreds, creds;
+
+  Data_Get_Struct(self, RUBY_KRB5_CCACHE, ptr);
+
+  Check_Type(v_server, T_STRING);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  memset(&mcreds, 0, sizeof(mcreds));
+
+  kerror = krb5_parse_name(ptr->ctx, StringValueCStr(v_server), &mcreds.server);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_parse_name: %s", error_message(kerror));
+
+  kerror = krb5_cc_get_principal(ptr->ctx, ptr->ccache, &mcreds.client);
+
+  if(kerror){
+    krb5_free_principal(ptr->ctx, mcreds.server);
+    rb_raise(cKrb5Exception, "krb5_cc_get_principal: %s", error_message(kerror));
+  }
+
+  kerror = krb5_cc_retrieve_cred(
+    ptr->ctx,
+    ptr->ccache,
+    KRB5_TC_SUPPORTED_KTYPES,
+    &mcreds,
+    &creds
+  );
+
+  krb5_free_principal(ptr->ctx, mcreds.client);
+  krb5_free_principal(ptr->ctx, mcreds.server);
+
+  if(kerror == KRB5_CC_NOTFOUND || kerror == KRB5_CC_END)
+    return Qnil;
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_cc_retrieve_cred: %s", error_message(kerror));
+
+  return rkrb5_creds_new(ptr->ctx, &creds);
+}
+
+// Credentials serialization. All integers are 32 bit, big endian, and
+// variable length fields are prefixed with their length.
+
+static void rkrb5_write_u32(VALUE v_buf, krb5_ui_4 n){
+  unsigned char b[4];
+
+  b[0] = (n >> 24) & 0xff;
+  b[1] = (n >> 16) & 0xff;
+  b[2] = (n >> 8) & 0xff;
+  b[3] = n & 0xff;
+
+  rb_str_buf_cat(v_buf, (char*)b, 4);
+}
+
+static void rkrb5_write_bytes(VALUE v_buf, const void* data, unsigned int length){
+  rkrb5_write_u32(v_buf, length);
+
+  if(length)
+    rb_str_buf_cat(v_buf, data, length);
+}
+
+static void rkrb5_write_principal(VALUE v_buf, krb5_context ctx, krb5_principal principal){
+  krb5_error_code kerror;
+  char* name;
+
+  kerror = krb5_unparse_name(ctx, principal, &name);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_unparse_name: %s", error_message(kerror));
+
+  rkrb5_write_bytes(v_buf, name, (unsigned int)strlen(name));
+  krb5_free_unparsed_name(ctx, name);
+}
+
+static void rkrb5_write_creds(VALUE v_buf, krb5_context ctx, krb5_creds* creds){
+  krb5_ui_4 n;
+
+  rkrb5_write_principal(v_buf, ctx, creds->client);
+  rkrb5_write_principal(v_buf, ctx, creds->server);
+
+  rkrb5_write_u32(v_buf, (krb5_ui_4)creds->keyblock.enctype);
+  rkrb5_write_bytes(v_buf, creds->keyblock.contents, creds->keyblock.length);
+
+  rkrb5_write_u32(v_buf, (krb5_ui_4)creds->times.authtime);
+  rkrb5_write_u32(v_buf, (krb5_ui_4)creds->times.starttime);
+  rkrb5_write_u32(v_buf, (krb5_ui_4)creds->times.endtime);
+  rkrb5_write_u32(v_buf, (krb5_ui_4)creds->times.renew_till);
+
+  rkrb5_write_u32(v_buf, creds->is_skey);
+  rkrb5_write_u32(v_buf, (krb5_ui_4)creds->ticket_flags);
+
+  for(n = 0; creds->addresses && creds->addresses[n]; n++);
+  rkrb5_write_u32(v_buf, n);
+
+  for(n = 0; creds->addresses && creds->addresses[n]; n++){
+    rkrb5_write_u32(v_buf, (krb5_ui_4)creds->addresses[n]->addrtype);
+    rkrb5_write_bytes(v_buf, creds->addresses[n]->contents, creds->addresses[n]->length);
+  }
+
+  rkrb5_write_bytes(v_buf, creds->ticket.data, creds->ticket.length);
+  rkrb5_write_bytes(v_buf, creds->second_ticket.data, creds->second_ticket.length);
+
+  for(n = 0; creds->authdata && creds->authdata[n]; n++);
+  rkrb5_write_u32(v_buf, n);
+
+  for(n = 0; creds->authdata && creds->authdata[n]; n++){
+    rkrb5_write_u32(v_buf, (krb5_ui_4)creds->authdata[n]->ad_type);
+    rkrb5_write_bytes(v_buf, creds->authdata[n]->contents, creds->authdata[n]->length);
+  }
+}
+
+static int rkrb5_read_u32(RKRB5_READER* r, krb5_ui_4* n){
+  if(r->left < 4)
+    return 0;
+
+  *n = ((krb5_ui_4)r->p[0] << 24) | ((krb5_ui_4)r->p[1] << 16) |
+    ((krb5_ui_4)r->p[2] << 8) | (krb5_ui_4)r->p[3];
+
+  r->p += 4;
+  r->left -= 4;
+
+  return 1;
+}
+
+// Reads a length prefixed field into a new, NUL terminated buffer.
+static int rkrb5_read_bytes(RKRB5_READER* r, unsigned char** data, unsigned int* length){
+  krb5_ui_4 n;
+
+  *data = NULL;
+
+  if(!rkrb5_read_u32(r, &n) || n > (krb5_ui_4)r->left)
+    return 0;
+
+  *length = n;
+
+  if(!(*data = malloc(n + 1)))
+    return 0;
+
+  memcpy(*data, r->p, n);
+  (*data)[n] = 0;
+
+  r->p += n;
+  r->left -= n;
+
+  return 1;
+}
+
+static int rkrb5_read_data(RKRB5_READER* r, krb5_data* data){
+  return rkrb5_read_bytes(r, (unsigned char**)&data->data, &data->length);
+}
+
+static int rkrb5_read_principal(RKRB5_READER* r, krb5_context ctx, krb5_principal* principal){
+  unsigned char* name;
+  unsigned int length;
+  krb5_error_code kerror;
+
+  if(!rkrb5_read_bytes(r, &name, &length))
+    return 0;
+
+  kerror = krb5_parse_name(ctx, (char*)name, principal);
+  free(name);
+
+  return kerror == 0;
+}
+
+// Fills +creds+, which must be zeroed, from the reader. On failure the
+// caller frees whatever was filled in with krb5_free_cred_contents.
+static int rkrb5_read_creds(RKRB5_READER* r, krb5_context ctx, krb5_creds* creds){
+  krb5_ui_4 n, i, v;
+
+  if(!rkrb5_read_principal(r, ctx, &creds->client) || !rkrb5_read_principal(r, ctx, &creds->server))
+    return 0;
+
+  if(!rkrb5_read_u32(r, &v))
+    return 0;
+
+  creds->keyblock.enctype = (krb5_enctype)v;
+
+  if(!rkrb5_read_bytes(r, &creds->keyblock.contents, &creds->keyblock.length))
+    return 0;
+
+  if(!rkrb5_read_u32(r, &v)) return 0;
+  creds->times.authtime = (krb5_timestamp)v;
+
+  if(!rkrb5_read_u32(r, &v)) return 0;
+  creds->times.starttime = (krb5_timestamp)v;
+
+  if(!rkrb5_read_u32(r, &v)) return 0;
+  creds->times.endtime = (krb5_timestamp)v;
+
+  if(!rkrb5_read_u32(r, &v)) return 0;
+  creds->times.renew_till = (krb5_timestamp)v;
+
+  if(!rkrb5_read_u32(r, &v)) return 0;
+  creds->is_skey = v;
+
+  if(!rkrb5_read_u32(r, &v)) return 0;
+  creds->ticket_flags = (krb5_flags)v;
+
+  // Each list entry takes at least 8 bytes, which bounds the allocation.
+  if(!rkrb5_read_u32(r, &n) || n > (krb5_ui_4)r->left / 8)
+    return 0;
+
+  if(n){
+    if(!(creds->addresses = calloc(n + 1, sizeof(krb5_address*))))
+      return 0;
+
+    for(i = 0; i < n; i++){
+      if(!(creds->addresses[i] = calloc(1, sizeof(krb5_address))))
+        return 0;
+
+      if(!rkrb5_read_u32(r, &v))
+        return 0;
+
+      creds->addresses[i]->addrtype = (krb5_addrtype)v;
+
+      if(!rkrb5_read_bytes(r, &creds->addresses[i]->contents, &creds->addresses[i]->length))
+        return 0;
+    }
+  }
+
+  if(!rkrb5_read_data(r, &creds->ticket) || !rkrb5_read_data(r, &creds->second_ticket))
+    return 0;
+
+  if(!rkrb5_read_u32(r, &n) || n > (krb5_ui_4)r->left / 8)
+    return 0;
+
+  if(n){
+    if(!(creds->authdata = calloc(n + 1, sizeof(krb5_authdata*))))
+      return 0;
+
+    for(i = 0; i < n; i++){
+      if(!(creds->authdata[i] = calloc(1, sizeof(krb5_authdata))))
+        return 0;
+
+      if(!rkrb5_read_u32(r, &v))
+        return 0;
+
+      creds->authdata[i]->ad_type = (krb5_authdatatype)v;
+
+      if(!rkrb5_read_bytes(r, &creds->authdata[i]->contents, &creds->authdata[i]->length))
+        return 0;
+    }
+  }
+
+  return 1;
+}
+
+static VALUE rkrb5_ccache_export_each(VALUE v_arg){
+  RKRB5_CC_ITER* iter = (RKRB5_CC_ITER*)v_arg;
+  RUBY_KRB5_CCACHE* ptr = iter->ptr;
+  krb5_error_code kerror;
+  krb5_creds creds;
+
+  while((kerror = krb5_cc_next_cred(ptr->ctx, ptr->ccache, &iter->cursor, &creds)) == 0){
+    // The block only sees what #each yields, so configuration entries are
+    // left out when filtering rather than always being exported.
+    if(rb_block_given_p() && krb5_is_config_principal(ptr->ctx, creds.server)){
+      krb5_free_cred_contents(ptr->ctx, &creds);
+      continue;
+    }
+
+    if(rb_block_given_p()){
+      RUBY_KRB5_CREDS* cptr;
+      VALUE v_creds = rkrb5_creds_new(ptr->ctx, &creds);
+
+      if(!RTEST(rb_yield(v_creds)))
+        continue;
+
+      Data_Get_Struct(v_creds, RUBY_KRB5_CREDS, cptr);
+      rkrb5_write_creds(iter->v_buf, ptr->ctx, &cptr->creds);
+    }
+    else{
+      rkrb5_write_creds(iter->v_buf, ptr->ctx, &creds);
+      krb5_free_cred_contents(ptr->ctx, &creds);
+    }
+
+    iter->count++;
+  }
+
+  if(kerror != KRB5_CC_END)
+    rb_raise(cKrb5Exception, "krb5_cc_next_cred: %s", error_message(kerror));
+
+  return Qnil;
+}
+
+/*
+ * call-seq:
+ *   ccache.export
+ *   ccache.export{ |creds| ... }
+ *
+ * Returns every ticket in the cache, serialized as a compact binary string
+ * that can be sent to another process and loaded with
+ * CredentialsCache.import. If a block is given, only the tickets for which
+ * the block returns a true value are exported. As with #each, the block is
+ * not given the configuration entries some cache types keep, and they are
+ * not exported when a block is used.
+ *
+ * The blob contains session keys, so treat it with the same care as the
+ * cache itself.
+ *
+ * Example:
+ *
+ *   blob = ccache.export{ |creds| creds.server.start_with?('krbtgt/') }
+ *   socket.write([blob.bytesize].pack('N') + blob)
+ */
+static VALUE rkrb5_ccache_export(VALUE self){
+  RUBY_KRB5_CCACHE* ptr;
+  RKRB5_CC_ITER iter;
+  krb5_error_code kerror;
+  unsigned char* p;
+
+  Data_Get_Struct(self, RUBY_KRB5_CCACHE, ptr);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  memset(&iter, 0, sizeof(iter));
+  iter.ptr = ptr;
+  iter.v_buf = rb_str_buf_new(4096);
+
+  rb_str_buf_cat(iter.v_buf, RKRB5_EXPORT_MAGIC, 4);
+  rkrb5_write_u32(iter.v_buf, 0);
+
+  kerror = krb5_cc_start_seq_get(ptr->ctx, ptr->ccache, &iter.cursor);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_cc_start_seq_get: %s", error_message(kerror));
+
+  rb_ensure(rkrb5_ccache_export_each, (VALUE)&iter, rkrb5_ccache_each_end, (VALUE)&iter);
+
+  // Fill in the number of credentials now that we know it.
+  p = (unsigned char*)RSTRING_PTR(iter.v_buf) + 4;
+  p[0] = (iter.count >> 24) & 0xff;
+  p[1] = (iter.count >> 16) & 0xff;
+  p[2] = (iter.count >> 8) & 0xff;
+  p[3] = iter.count & 0xff;
+
+  return iter.v_buf;
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5::CredentialsCache.import(blob, principal = nil)
+ *   Kerberos::Krb5::CredentialsCache.import(blob, principal = nil){ |ccache| ... } => obj
+ *
+ * Creates a new MEMORY: credentials cache and fills it with the tickets
+ * in +blob+, as returned by CredentialsCache#export. The cache is
+ * initialized for +principal+, or for the client of the first ticket in
+ * the blob if no principal is given.
+ *
+ * As with CredentialsCache.memory, the cache lives until it is destroyed.
+ * If a block is given the cache is yielded and destroyed when the block
+ * returns, and the value of the block is returned.
+ */
+static VALUE rkrb5_s_ccache_import(int argc, VALUE* argv, VALUE klass){
+  RUBY_KRB5_CCACHE* ptr;
+  RKRB5_READER reader;
+  krb5_error_code kerror = 0;
+  krb5_ui_4 count, i;
+  krb5_creds creds;
+  const char* func = NULL;
+  VALUE v_blob, v_principal, v_ccache;
+
+  rb_scan_args(argc, argv, "11", &v_blob, &v_principal);
+
+  Check_Type(v_blob, T_STRING);
+
+  if(!NIL_P(v_principal))
+    Check_Type(v_principal, T_STRING);
+
+  reader.p = (const unsigned char*)RSTRING_PTR(v_blob);
+  reader.left = RSTRING_LEN(v_blob);
+
+  if(reader.left < 4 || memcmp(reader.p, RKRB5_EXPORT_MAGIC, 4) != 0)
+    rb_raise(cKrb5Exception, "invalid credentials blob");
+
+  reader.p += 4;
+  reader.left -= 4;
+
+  if(!rkrb5_read_u32(&reader, &count))
+    rb_raise(cKrb5Exception, "invalid credentials blob");
+
+  v_ccache = rkrb5_ccache_create(klass, &ptr);
+
+  kerror = krb5_cc_new_unique(ptr->ctx, "MEMORY", NULL, &ptr->ccache);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_cc_new_unique: %s", error_message(kerror));
+
+  for(i = 0; i < count; i++){
+    memset(&creds, 0, sizeof(creds));
+
+    if(!rkrb5_read_creds(&reader, ptr->ctx, &creds)){
+      krb5_free_cred_contents(ptr->ctx, &creds);
+      break;
+    }
+
+    if(i == 0){
+      if(NIL_P(v_principal)){
+        kerror = krb5_copy_principal(ptr->ctx, creds.client, &ptr->principal);
+        func = "krb5_copy_principal";
+      }
+      else{
+        kerror = krb5_parse_name(ptr->ctx, StringValueCStr(v_principal), &ptr->principal);
+        func = "krb5_parse_name";
+      }
+
+      if(!kerror){
+        kerror = krb5_cc_initialize(ptr->ctx, ptr->ccache, ptr->principal);
+        func = "krb5_cc_initialize";
+      }
+    }
+
+    if(!kerror){
+      kerror = krb5_cc_store_cred(ptr->ctx, ptr->ccache, &creds);
+      func = "krb5_cc_store_cred";
+    }
+
+    krb5_free_cred_contents(ptr->ctx, &creds);
+
+    if(kerror)
+      break;
+  }
+
+  // Don't leave a half filled memory cache behind.
+  if(i < count || (count == 0 && NIL_P(v_principal))){
+    krb5_cc_destroy(ptr->ctx, ptr->ccache);
+    ptr->ccache = NULL;
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "%s: %s", func, error_message(kerror));
+    else if(count)
+      rb_raise(cKrb5Exception, "invalid credentials blob");
+    else
+      rb_raise(cKrb5Exception, "no credentials to import and no principal given");
+  }
+
+  // The cache is already initialized unless the blob was empty.
+  return rkrb5_ccache_setup(v_ccache, ptr, count ? Qnil : v_principal);
+}
+
+void Init_ccache(){
+  /* The Kerberos::Krb5::CredentialsCache class encapsulates a Kerberos credentials cache. */
+  cKrb5CCache = rb_define_class_under(cKrb5, "CredentialsCache", rb_cObject);
+
+  // Allocation Function
+  rb_define_alloc_func(cKrb5CCache, rkrb5_ccache_allocate);
+
+  // Mixins
+  rb_include_module(cKrb5CCache, rb_mEnumerable);
+
+  // Constructor
+  rb_define_method(cKrb5CCache, "initialize", rkrb5_ccache_initialize, -1);
+
+  // Singleton Methods
+  rb_define_singleton_method(cKrb5CCache, "each_in_collection", rkrb5_s_ccache_each_in_collection, 0);
+  rb_define_singleton_method(cKrb5CCache, "import", rkrb5_s_ccache_import, -1);
+  rb_define_singleton_method(cKrb5CCache, "keyring", rkrb5_s_ccache_keyring, -1);
+  rb_define_singleton_method(cKrb5CCache, "memory", rkrb5_s_ccache_memory, -1);
+  rb_define_singleton_method(cKrb5CCache, "new_unique", rkrb5_s_ccache_new_unique, -1);
+  rb_define_singleton_method(cKrb5CCache, "open", rkrb5_s_ccache_open, -1);
 
   // Instance Methods
   rb_define_method(cKrb5CCache, "close", rkrb5_ccache_close, 0);
+  rb_define_method(cKrb5CCache, "copy_to", rkrb5_ccache_copy_to, 1);
   rb_define_method(cKrb5CCache, "default_name", rkrb5_ccache_default_name, 0);
   rb_define_method(cKrb5CCache, "destroy", rkrb5_ccache_destroy, 0);
+  rb_define_method(cKrb5CCache, "each", rkrb5_ccache_each, 0);
+  rb_define_method(cKrb5CCache, "export", rkrb5_ccache_export, 0);
+  rb_define_method(cKrb5CCache, "get_credentials", rkrb5_ccache_get_credentials, -1);
+  rb_define_method(cKrb5CCache, "name", rkrb5_ccache_name, 0);
   rb_define_method(cKrb5CCache, "primary_principal", rkrb5_ccache_primary_principal, 0);
+  rb_define_method(cKrb5CCache, "retrieve", rkrb5_ccache_retrieve, 1);
+  rb_define_method(cKrb5CCache, "store", rkrb5_ccache_store, 1);
+  rb_define_method(cKrb5CCache, "switch_to", rkrb5_ccache_switch_to, 0);
 
   // Aliases
   rb_define_alias(cKrb5CCache, "delete", "destroy");
@@ -0,0 +1,328 @@
+#include <rkerberos.h>
+
+VALUE cKrb5Creds;
+
+// Credentials objects outlive the cache and context they were read from, so
+// names are unparsed and contents freed using a context of their own.
+static krb5_context creds_ctx = NULL;
+
+static krb5_context rkrb5_creds_context(){
+  krb5_error_code kerror;
+
+  if(!creds_ctx){
+    kerror = krb5_init_context(&creds_ctx);
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "krb5_init_context: %s", error_message(kerror));
+  }
+
+  return creds_ctx;
+}
+
+// Free function for the Kerberos::Krb5::Credentials class.
+static void rkrb5_creds_free(RUBY_KRB5_CREDS* ptr){
+  if(!ptr)
+    return;
+
+  if(creds_ctx)
+    krb5_free_cred_contents(creds_ctx, &ptr->creds);
+
+  free(ptr);
+}
+
+// Allocation function for the Kerberos::Krb5::Credentials class.
+static VALUE rkrb5_creds_allocate(VALUE klass){
+  RUBY_KRB5_CREDS* ptr = malloc(sizeof(RUBY_KRB5_CREDS));
+  memset(ptr, 0, sizeof(RUBY_KRB5_CREDS));
+  return Data_Wrap_Struct(klass, 0, rkrb5_creds_free, ptr);
+}
+
+static VALUE rkrb5_creds_create(VALUE v_arg){
+  rkrb5_creds_context();
+  return rkrb5_creds_allocate(cKrb5Creds);
+}
+
+/*
+ * Creates a Credentials object that takes ownership of the contents of
+ * +creds+ without copying them. On return +creds+ is zeroed and must not be
+ * freed by the caller. If the object can't be made, the contents are freed
+ * with +ctx+ before the error is raised, so they never leak.
+ */
+VALUE rkrb5_creds_new(krb5_context ctx, krb5_creds* creds){
+  RUBY_KRB5_CREDS* ptr;
+  VALUE v_creds;
+  int state = 0;
+
+  v_creds = rb_protect(rkrb5_creds_create, Qnil, &state);
+
+  if(state){
+    krb5_free_cred_contents(ctx, creds);
+    memset(creds, 0, sizeof(krb5_creds));
+    rb_jump_tag(state);
+  }
+
+  Data_Get_Struct(v_creds, RUBY_KRB5_CREDS, ptr);
+
+  ptr->creds = *creds;
+  memset(creds, 0, sizeof(krb5_creds));
+
+  return v_creds;
+}
+
+static VALUE rkrb5_creds_unparse(krb5_principal principal){
+  krb5_error_code kerror;
+  char* name;
+  VALUE v_name;
+
+  if(!principal)
+    return Qnil;
+
+  kerror = krb5_unparse_name(rkrb5_creds_context(), principal, &name);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_unparse_name: %s", error_message(kerror));
+
+  v_name = rb_str_new2(name);
+  krb5_free_unparsed_name(creds_ctx, name);
+
+  return v_name;
+}
+
+static VALUE rkrb5_creds_time(krb5_timestamp t){
+  if(!t)
+    return Qnil;
+
+  return rb_time_new(t, 0);
+}
+
+/*
+ * call-seq:
+ *   creds.client
+ *
+ * Returns the name of the client principal.
+ */
+static VALUE rkrb5_creds_client(VALUE self){
+  RUBY_KRB5_CREDS* ptr;
+  Data_Get_Struct(self, RUBY_KRB5_CREDS, ptr);
+  return rkrb5_creds_unparse(ptr->creds.client);
+}
+
+/*
+ * call-seq:
+ *   creds.server
+ *
+ * Returns the name of the service principal the ticket is for, e.g.
+ * 'krbtgt/YOUR.REALM@YOUR.REALM'.
+ */
+static VALUE rkrb5_creds_server(VALUE self){
+  RUBY_KRB5_CREDS* ptr;
+  Data_Get_Struct(self, RUBY_KRB5_CREDS, ptr);
+  return rkrb5_creds_unparse(ptr->creds.server);
+}
+
+/*
+ * call-seq:
+ *   creds.authtime
+ *
+ * Returns the time of the initial authentication as a Time object.
+ */
+static VALUE rkrb5_creds_authtime(VALUE self){
+  RUBY_KRB5_CREDS* ptr;
+  Data_Get_Struct(self, RUBY_KRB5_CREDS, ptr);
+  return rkrb5_creds_time(ptr->creds.times.authtime);
+}
+
+/*
+ * call-seq:
+ *   creds.starttime
+ *
+ * Returns the time from which the ticket is valid, or nil if not set.
+ */
+static VALUE rkrb5_creds_starttime(VALUE self){
+  RUBY_KRB5_CREDS* ptr;
+  Data_Get_Struct(self, RUBY_KRB5_CREDS, ptr);
+  return rkrb5_creds_time(ptr->creds.times.starttime);
+}
+
+/*
+ * call-seq:
+ *   creds.endtime
+ *
+ * Returns the time at which the ticket expires.
+ */
+static VALUE rkrb5_creds_endtime(VALUE self){
+  RUBY_KRB5_CREDS* ptr;
+  Data_Get_Struct(self, RUBY_KRB5_CREDS, ptr);
+  return rkrb5_creds_time(ptr->creds.times.endtime);
+}
+
+/*
+ * call-seq:
+ *   creds.renew_till
+ *
+ * Returns the time until which the ticket may be renewed, or nil if the
+ * ticket is not renewable.
+ */
+static VALUE rkrb5_creds_renew_till(VALUE self){
+  RUBY_KRB5_CREDS* ptr;
+  Data_Get_Struct(self, RUBY_KRB5_CREDS, ptr);
+  return rkrb5_creds_time(ptr->creds.times.renew_till);
+}
+
+/*
+ * call-seq:
+ *   creds.flags
+ *
+ * Returns the ticket flags as an integer. See the TKT_FLG constants.
+ */
+static VALUE rkrb5_creds_flags(VALUE self){
+  RUBY_KRB5_CREDS* ptr;
+  Data_Get_Struct(self, RUBY_KRB5_CREDS, ptr);
+  return UINT2NUM((krb5_ui_4)ptr->creds.ticket_flags);
+}
+
+/*
+ * call-seq:
+ *   creds.enctype
+ *
+ * Returns the encryption type of the session key.
+ */
+static VALUE rkrb5_creds_enctype(VALUE self){
+  RUBY_KRB5_CREDS* ptr;
+  Data_Get_Struct(self, RUBY_KRB5_CREDS, ptr);
+  return INT2FIX(ptr->creds.keyblock.enctype);
+}
+
+/*
+ * call-seq:
+ *   creds.ticket
+ *
+ * Returns the encoded ticket as a binary string. The string is built on
+ * each call, so avoid calling this unless the ticket itself is needed.
+ */
+static VALUE rkrb5_creds_ticket(VALUE self){
+  RUBY_KRB5_CREDS* ptr;
+  Data_Get_Struct(self, RUBY_KRB5_CREDS, ptr);
+  return rb_str_new(ptr->creds.ticket.data, ptr->creds.ticket.length);
+}
+
+/*
+ * call-seq:
+ *   creds.expired?
+ *
+ * Returns whether or not the ticket has reached its end time.
+ */
+static VALUE rkrb5_creds_expired(VALUE self){
+  RUBY_KRB5_CREDS* ptr;
+  krb5_timestamp now;
+  krb5_error_code kerror;
+
+  Data_Get_Struct(self, RUBY_KRB5_CREDS, ptr);
+
+  kerror = krb5_timeofday(rkrb5_creds_context(), &now);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_timeofday: %s", error_message(kerror));
+
+  return ptr->creds.times.endtime <= now ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *   creds.renewable?
+ *
+ * Returns whether or not the ticket has the renewable flag set.
+ */
+static VALUE rkrb5_creds_renewable(VALUE self){
+  RUBY_KRB5_CREDS* ptr;
+  Data_Get_Struct(self, RUBY_KRB5_CREDS, ptr);
+  return (ptr->creds.ticket_flags & TKT_FLG_RENEWABLE) ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *   creds.forwardable?
+ *
+ * Returns whether or not the ticket has the forwardable flag set.
+ */
+static VALUE rkrb5_creds_forwardable(VALUE self){
+  RUBY_KRB5_CREDS* ptr;
+  Data_Get_Struct(self, RUBY_KRB5_CREDS, ptr);
+  return (ptr->creds.ticket_flags & TKT_FLG_FORWARDABLE) ? Qtrue : Qfalse;
+}
+
+/*
+ * A custom inspect method for nicer output.
+ */
+static VALUE rkrb5_creds_inspect(VALUE self){
+  VALUE v_str;
+
+  v_str = rb_str_new2("#<");
+  rb_str_buf_cat2(v_str, rb_obj_classname(self));
+  rb_str_buf_cat2(v_str, " ");
+
+  rb_str_buf_cat2(v_str, "client=");
+  rb_str_buf_append(v_str, rb_inspect(rkrb5_creds_client(self)));
+  rb_str_buf_cat2(v_str, " ");
+
+  rb_str_buf_cat2(v_str, "server=");
+  rb_str_buf_append(v_str, rb_inspect(rkrb5_creds_server(self)));
+  rb_str_buf_cat2(v_str, " ");
+
+  rb_str_buf_cat2(v_str, "endtime=");
+  rb_str_buf_append(v_str, rb_inspect(rkrb5_creds_endtime(self)));
+  rb_str_buf_cat2(v_str, " ");
+
+  rb_str_buf_cat2(v_str, "enctype=");
+  rb_str_buf_append(v_str, rb_inspect(rkrb5_creds_enctype(self)));
+
+  rb_str_buf_cat2(v_str, ">");
+
+  return v_str;
+}
+
+void Init_credentials(){
+  /* The Kerberos::Krb5::Credentials class encapsulates a single ticket held in a credentials cache. */
+  cKrb5Creds = rb_define_class_under(cKrb5, "Credentials", rb_cObject);
+
+  // Allocation Function
+  rb_define_alloc_func(cKrb5Creds, rkrb5_creds_allocate);
+
+  // Instance Methods
+  rb_define_method(cKrb5Creds, "authtime", rkrb5_creds_authtime, 0);
+  rb_define_method(cKrb5Creds, "client", rkrb5_creds_client, 0);
+  rb_define_method(cKrb5Creds, "enctype", rkrb5_creds_enctype, 0);
+  rb_define_method(cKrb5Creds, "endtime", rkrb5_creds_endtime, 0);
+  rb_define_method(cKrb5Creds, "expired?", rkrb5_creds_expired, 0);
+  rb_define_method(cKrb5Creds, "flags", rkrb5_creds_flags, 0);
+  rb_define_method(cKrb5Creds, "forwardable?", rkrb5_creds_forwardable, 0);
+  rb_define_method(cKrb5Creds, "inspect", rkrb5_creds_inspect, 0);
+  rb_define_method(cKrb5Creds, "renew_till", rkrb5_creds_renew_till, 0);
+  rb_define_method(cKrb5Creds, "renewable?", rkrb5_creds_renewable, 0);
+  rb_define_method(cKrb5Creds, "server", rkrb5_creds_server, 0);
+  rb_define_method(cKrb5Creds, "starttime", rkrb5_creds_starttime, 0);
+  rb_define_method(cKrb5Creds, "ticket", rkrb5_creds_ticket, 0);
+
+  // Ticket flag constants
+
+  /* Ticket may be forwarded */
+  rb_define_const(cKrb5Creds, "TKT_FLG_FORWARDABLE", INT2FIX(TKT_FLG_FORWARDABLE));
+
+  /* Ticket has been forwarded */
+  rb_define_const(cKrb5Creds, "TKT_FLG_FORWARDED", INT2FIX(TKT_FLG_FORWARDED));
+
+  /* Ticket may be proxied */
+  rb_define_const(cKrb5Creds, "TKT_FLG_PROXIABLE", INT2FIX(TKT_FLG_PROXIABLE));
+
+  /* Ticket is a proxy */
+  rb_define_const(cKrb5Creds, "TKT_FLG_PROXY", INT2FIX(TKT_FLG_PROXY));
+
+  /* Ticket may be renewed */
+  rb_define_const(cKrb5Creds, "TKT_FLG_RENEWABLE", INT2FIX(TKT_FLG_RENEWABLE));
+
+  /* Ticket was issued by an AS exchange */
+  rb_define_const(cKrb5Creds, "TKT_FLG_INITIAL", INT2FIX(TKT_FLG_INITIAL));
+
+  /* Client was preauthenticated */
+  rb_define_const(cKrb5Creds, "TKT_FLG_PRE_AUTH", INT2FIX(TKT_FLG_PRE_AUTH));
+}
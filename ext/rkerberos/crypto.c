@@ -0,0 +1,528 @@
+#include <rkerberos.h>
+
+VALUE cKrb5Crypto;
+
+// Free function for the Kerberos::Krb5::Crypto class.
+static void rkrb5_crypto_free(RUBY_KRB5_CRYPTO* ptr){
+  if(!ptr)
+    return;
+
+  if(ptr->key)
+    krb5_k_free_key(ptr->ctx, ptr->key);
+
+  if(ptr->ctx)
+    krb5_free_context(ptr->ctx);
+
+  free(ptr);
+}
+
+// Allocation function for the Kerberos::Krb5::Crypto class.
+static VALUE rkrb5_crypto_allocate(VALUE klass){
+  RUBY_KRB5_CRYPTO* ptr = malloc(sizeof(RUBY_KRB5_CRYPTO));
+  memset(ptr, 0, sizeof(RUBY_KRB5_CRYPTO));
+  return Data_Wrap_Struct(klass, 0, rkrb5_crypto_free, ptr);
+}
+
+// Raises unless +ptr+ has a key and is not in use by another thread.
+static void rkrb5_crypto_check(RUBY_KRB5_CRYPTO* ptr){
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  if(ptr->busy)
+    rb_raise(cKrb5Exception, "crypto object is in use by another thread");
+}
+
+/*
+ * Returns the caller's +v_buffer+ resized to +length+ bytes, or a new
+ * string of that length if it is nil. A buffer with enough capacity is
+ * reused without reallocating.
+ */
+static VALUE rkrb5_crypto_buffer(VALUE v_buffer, VALUE v_input, long length){
+  if(NIL_P(v_buffer))
+    return rb_str_new(NULL, length);
+
+  Check_Type(v_buffer, T_STRING);
+
+  if(v_buffer == v_input)
+    rb_raise(rb_eArgError, "the output buffer cannot be the input");
+
+  rb_str_modify(v_buffer);
+  rb_str_resize(v_buffer, length);
+
+  return v_buffer;
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5::Crypto.new(keytab_entry)
+ *   Kerberos::Krb5::Crypto.new(enctype, key)
+ *
+ * Creates and returns a new Kerberos::Krb5::Crypto object for the key of a
+ * Keytab::Entry, or for the raw +key+ bytes of the given +enctype+.
+ *
+ * The key schedule and the keys derived for each key usage are computed
+ * once and kept, so repeated calls on one object are cheap.
+ *
+ * Example:
+ *
+ *   crypto = Kerberos::Krb5::Crypto.new(keytab.get_entry('HTTP/www.example.com'))
+ *   token  = crypto.encrypt(1026, 'secret')
+ */
+static VALUE rkrb5_crypto_initialize(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5_CRYPTO* ptr;
+  krb5_error_code kerror;
+  krb5_keyblock keyblock;
+  krb5_checksum cksum;
+  krb5_data empty;
+  VALUE v_key, v_bytes;
+
+  Data_Get_Struct(self, RUBY_KRB5_CRYPTO, ptr);
+
+  rb_scan_args(argc, argv, "11", &v_key, &v_bytes);
+
+  if(ptr->ctx)
+    rb_raise(cKrb5Exception, "crypto object already initialized");
+
+  memset(&keyblock, 0, sizeof(keyblock));
+
+  if(rb_obj_is_kind_of(v_key, cKrb5KtEntry)){
+    RUBY_KRB5_KT_ENTRY* entry;
+    Data_Get_Struct(v_key, RUBY_KRB5_KT_ENTRY, entry);
+
+    if(!entry->key.contents)
+      rb_raise(cKrb5Exception, "keytab entry has no key");
+
+    keyblock = entry->key;
+  }
+  else{
+    Check_Type(v_bytes, T_STRING);
+    keyblock.enctype = NUM2INT(v_key);
+    keyblock.length = RSTRING_LEN(v_bytes);
+    keyblock.contents = (krb5_octet*)RSTRING_PTR(v_bytes);
+  }
+
+  kerror = krb5_init_context(&ptr->ctx);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_init_context: %s", error_message(kerror));
+
+  kerror = krb5_k_create_key(ptr->ctx, &keyblock, &ptr->key);
+
+  RB_GC_GUARD(v_key);
+  RB_GC_GUARD(v_bytes);
+
+  if(kerror){
+    ptr->key = NULL;
+    rb_raise(cKrb5Exception, "krb5_k_create_key: %s", error_message(kerror));
+  }
+
+  ptr->enctype = keyblock.enctype;
+
+  // A checksum type of 0 picks the enctype's mandatory one. Remember which
+  // that is, since verifying needs to name it.
+  empty.data = "";
+  empty.length = 0;
+
+  kerror = krb5_k_make_checksum(ptr->ctx, 0, ptr->key, 0, &empty, &cksum);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_k_make_checksum: %s", error_message(kerror));
+
+  ptr->cksumtype = cksum.checksum_type;
+  krb5_free_checksum_contents(ptr->ctx, &cksum);
+
+  return self;
+}
+
+/*
+ * call-seq:
+ *   crypto.enctype
+ *
+ * Returns the encryption type of the key.
+ */
+static VALUE rkrb5_crypto_enctype(VALUE self){
+  RUBY_KRB5_CRYPTO* ptr;
+  Data_Get_Struct(self, RUBY_KRB5_CRYPTO, ptr);
+  return INT2FIX(ptr->enctype);
+}
+
+// Encrypts +plain+ into +out+, which must have exactly the encrypted length.
+static krb5_error_code rkrb5_crypto_encrypt_data(RUBY_KRB5_CRYPTO* ptr, krb5_keyusage usage, char* plain, size_t plain_len, char* out, size_t out_len){
+  krb5_data input;
+  krb5_enc_data output;
+
+  input.data = plain;
+  input.length = plain_len;
+
+  memset(&output, 0, sizeof(output));
+  output.ciphertext.data = out;
+  output.ciphertext.length = out_len;
+
+  return krb5_k_encrypt(ptr->ctx, ptr->key, usage, NULL, &input, &output);
+}
+
+/*
+ * call-seq:
+ *   crypto.encrypt(usage, plaintext, buffer = nil)
+ *
+ * Encrypts +plaintext+ for the key +usage+ number and returns the
+ * ciphertext. If a +buffer+ string is given the ciphertext is written into
+ * it, reusing its memory where possible, and it is returned instead.
+ */
+static VALUE rkrb5_crypto_encrypt(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5_CRYPTO* ptr;
+  krb5_error_code kerror;
+  size_t length;
+  VALUE v_usage, v_plain, v_buffer;
+
+  Data_Get_Struct(self, RUBY_KRB5_CRYPTO, ptr);
+
+  rb_scan_args(argc, argv, "21", &v_usage, &v_plain, &v_buffer);
+
+  Check_Type(v_plain, T_STRING);
+  rkrb5_crypto_check(ptr);
+
+  kerror = krb5_c_encrypt_length(ptr->ctx, ptr->enctype, RSTRING_LEN(v_plain), &length);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_c_encrypt_length: %s", error_message(kerror));
+
+  v_buffer = rkrb5_crypto_buffer(v_buffer, v_plain, length);
+
+  kerror = rkrb5_crypto_encrypt_data(
+    ptr,
+    NUM2INT(v_usage),
+    RSTRING_PTR(v_plain),
+    RSTRING_LEN(v_plain),
+    RSTRING_PTR(v_buffer),
+    length
+  );
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_k_encrypt: %s", error_message(kerror));
+
+  return v_buffer;
+}
+
+/*
+ * call-seq:
+ *   crypto.decrypt(usage, ciphertext, buffer = nil)
+ *
+ * Decrypts +ciphertext+ that was encrypted for the key +usage+ number and
+ * returns the plaintext. If a +buffer+ string is given the plaintext is
+ * written into it, reusing its memory where possible, and it is returned
+ * instead. Raises an error if the ciphertext fails its integrity check.
+ */
+static VALUE rkrb5_crypto_decrypt(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5_CRYPTO* ptr;
+  krb5_error_code kerror;
+  krb5_enc_data input;
+  krb5_data output;
+  VALUE v_usage, v_cipher, v_buffer;
+
+  Data_Get_Struct(self, RUBY_KRB5_CRYPTO, ptr);
+
+  rb_scan_args(argc, argv, "21", &v_usage, &v_cipher, &v_buffer);
+
+  Check_Type(v_cipher, T_STRING);
+  rkrb5_crypto_check(ptr);
+
+  // The plaintext is never longer than the ciphertext.
+  v_buffer = rkrb5_crypto_buffer(v_buffer, v_cipher, RSTRING_LEN(v_cipher));
+
+  memset(&input, 0, sizeof(input));
+  input.enctype = ptr->enctype;
+  input.ciphertext.data = RSTRING_PTR(v_cipher);
+  input.ciphertext.length = RSTRING_LEN(v_cipher);
+
+  output.data = RSTRING_PTR(v_buffer);
+  output.length = RSTRING_LEN(v_buffer);
+
+  kerror = krb5_k_decrypt(ptr->ctx, ptr->key, NUM2INT(v_usage), NULL, &input, &output);
+
+  if(kerror){
+    rb_str_set_len(v_buffer, 0);
+    rb_raise(cKrb5Exception, "krb5_k_decrypt: %s", error_message(kerror));
+  }
+
+  rb_str_set_len(v_buffer, output.length);
+
+  return v_buffer;
+}
+
+/*
+ * call-seq:
+ *   crypto.checksum(usage, data, buffer = nil)
+ *
+ * Returns a keyed checksum of +data+ for the key +usage+ number, using the
+ * mandatory checksum type of the key's enctype. If a +buffer+ string is
+ * given the checksum is written into it and it is returned instead.
+ */
+static VALUE rkrb5_crypto_checksum(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5_CRYPTO* ptr;
+  krb5_error_code kerror;
+  krb5_checksum cksum;
+  krb5_data input;
+  VALUE v_usage, v_data, v_buffer;
+
+  Data_Get_Struct(self, RUBY_KRB5_CRYPTO, ptr);
+
+  rb_scan_args(argc, argv, "21", &v_usage, &v_data, &v_buffer);
+
+  Check_Type(v_data, T_STRING);
+  rkrb5_crypto_check(ptr);
+
+  input.data = RSTRING_PTR(v_data);
+  input.length = RSTRING_LEN(v_data);
+
+  kerror = krb5_k_make_checksum(ptr->ctx, ptr->cksumtype, ptr->key, NUM2INT(v_usage), &input, &cksum);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_k_make_checksum: %s", error_message(kerror));
+
+  v_buffer = rkrb5_crypto_buffer(v_buffer, v_data, cksum.length);
+  memcpy(RSTRING_PTR(v_buffer), cksum.contents, cksum.length);
+
+  krb5_free_checksum_contents(ptr->ctx, &cksum);
+
+  return v_buffer;
+}
+
+/*
+ * call-seq:
+ *   crypto.verify_checksum(usage, data, checksum)
+ *
+ * Returns whether +checksum+ is a valid keyed checksum of +data+ for the
+ * key +usage+ number, as made by Crypto#checksum.
+ */
+static VALUE rkrb5_crypto_verify_checksum(VALUE self, VALUE v_usage, VALUE v_data, VALUE v_checksum){
+  RUBY_KRB5_CRYPTO* ptr;
+  krb5_error_code kerror;
+  krb5_checksum cksum;
+  krb5_data input;
+  krb5_boolean valid = FALSE;
+
+  Data_Get_Struct(self, RUBY_KRB5_CRYPTO, ptr);
+
+  Check_Type(v_data, T_STRING);
+  Check_Type(v_checksum, T_STRING);
+  rkrb5_crypto_check(ptr);
+
+  input.data = RSTRING_PTR(v_data);
+  input.length = RSTRING_LEN(v_data);
+
+  memset(&cksum, 0, sizeof(cksum));
+  cksum.checksum_type = ptr->cksumtype;
+  cksum.length = RSTRING_LEN(v_checksum);
+  cksum.contents = (krb5_octet*)RSTRING_PTR(v_checksum);
+
+  kerror = krb5_k_verify_checksum(ptr->ctx, ptr->key, NUM2INT(v_usage), &input, &cksum, &valid);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_k_verify_checksum: %s", error_message(kerror));
+
+  return valid ? Qtrue : Qfalse;
+}
+
+// One string to encrypt in a Crypto#encrypt_many call.
+typedef struct {
+  char* plain;
+  size_t plain_len;
+  char* cipher;
+  size_t cipher_len;
+} RKRB5_ENCRYPT_ITEM;
+
+// Arguments for, and results of, one Crypto#encrypt_many call. The items
+// point into the +plain+ and +cipher+ buffers.
+typedef struct {
+  RUBY_KRB5_CRYPTO* ptr;
+  krb5_keyusage usage;
+  RKRB5_ENCRYPT_ITEM* items;
+  char* plain;
+  char* cipher;
+  long count;
+  long failed;
+  krb5_error_code kerror;
+} RKRB5_ENCRYPT_MANY;
+
+static void* rkrb5_crypto_encrypt_many_nogvl(void* arg){
+  RKRB5_ENCRYPT_MANY* m = arg;
+  long i;
+
+  for(i = 0; i < m->count; i++){
+    RKRB5_ENCRYPT_ITEM* item = &m->items[i];
+
+    m->kerror = rkrb5_crypto_encrypt_data(m->ptr, m->usage, item->plain, item->plain_len, item->cipher, item->cipher_len);
+
+    if(m->kerror){
+      m->failed = i;
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+// Returns the array of ciphertexts, or nil if an item failed.
+static VALUE rkrb5_crypto_encrypt_many_call(VALUE v_arg){
+  RKRB5_ENCRYPT_MANY* m = (RKRB5_ENCRYPT_MANY*)v_arg;
+  VALUE v_ciphers;
+  long i;
+
+  rb_thread_call_without_gvl(rkrb5_crypto_encrypt_many_nogvl, m, RUBY_UBF_IO, NULL);
+
+  if(m->kerror)
+    return Qnil;
+
+  v_ciphers = rb_ary_new2(m->count);
+
+  for(i = 0; i < m->count; i++)
+    rb_ary_push(v_ciphers, rb_str_new(m->items[i].cipher, m->items[i].cipher_len));
+
+  return v_ciphers;
+}
+
+static VALUE rkrb5_crypto_encrypt_many_ensure(VALUE v_arg){
+  RKRB5_ENCRYPT_MANY* m = (RKRB5_ENCRYPT_MANY*)v_arg;
+  m->ptr->busy = 0;
+  free(m->items);
+  free(m->plain);
+  free(m->cipher);
+  return Qnil;
+}
+
+/*
+ * call-seq:
+ *   crypto.encrypt_many(usage, plaintexts)
+ *
+ * Encrypts each string in the +plaintexts+ array for the key +usage+
+ * number and returns an array of the ciphertexts, in the same order.
+ *
+ * All of the encryption is done in one go without the GVL, so other Ruby
+ * threads keep running. The object can't be used by other threads until
+ * it's finished.
+ */
+static VALUE rkrb5_crypto_encrypt_many(VALUE self, VALUE v_usage, VALUE v_plain){
+  RUBY_KRB5_CRYPTO* ptr;
+  RKRB5_ENCRYPT_MANY m;
+  krb5_error_code kerror;
+  size_t length, plain_size = 0, cipher_size = 0;
+  long i;
+  VALUE v_ciphers;
+
+  Data_Get_Struct(self, RUBY_KRB5_CRYPTO, ptr);
+
+  Check_Type(v_plain, T_ARRAY);
+  rkrb5_crypto_check(ptr);
+
+  memset(&m, 0, sizeof(m));
+
+  m.ptr = ptr;
+  m.usage = NUM2INT(v_usage);
+  m.count = RARRAY_LEN(v_plain);
+
+  for(i = 0; i < m.count; i++){
+    VALUE v_str = RARRAY_AREF(v_plain, i);
+
+    Check_Type(v_str, T_STRING);
+
+    kerror = krb5_c_encrypt_length(ptr->ctx, ptr->enctype, RSTRING_LEN(v_str), &length);
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "krb5_c_encrypt_length: %s", error_message(kerror));
+
+    plain_size += RSTRING_LEN(v_str);
+    cipher_size += length;
+  }
+
+  if(m.count == 0)
+    return rb_ary_new();
+
+  // The workers only touch malloc'd copies, since Ruby strings may be
+  // changed or moved by the GC while the GVL is released. The ciphertexts
+  // are turned into strings once it's held again.
+  m.items = malloc(m.count * sizeof(RKRB5_ENCRYPT_ITEM));
+  m.plain = malloc(plain_size ? plain_size : 1);
+  m.cipher = malloc(cipher_size);
+
+  if(!m.items || !m.plain || !m.cipher){
+    free(m.items);
+    free(m.plain);
+    free(m.cipher);
+    rb_raise(rb_eNoMemError, "failed to allocate memory");
+  }
+
+  plain_size = 0;
+  cipher_size = 0;
+
+  for(i = 0; i < m.count; i++){
+    VALUE v_str = RARRAY_AREF(v_plain, i);
+
+    krb5_c_encrypt_length(ptr->ctx, ptr->enctype, RSTRING_LEN(v_str), &length);
+
+    m.items[i].plain = m.plain + plain_size;
+    m.items[i].plain_len = RSTRING_LEN(v_str);
+    m.items[i].cipher = m.cipher + cipher_size;
+    m.items[i].cipher_len = length;
+
+    memcpy(m.items[i].plain, RSTRING_PTR(v_str), RSTRING_LEN(v_str));
+
+    plain_size += RSTRING_LEN(v_str);
+    cipher_size += length;
+  }
+
+  ptr->busy = 1;
+
+  v_ciphers = rb_ensure(rkrb5_crypto_encrypt_many_call, (VALUE)&m, rkrb5_crypto_encrypt_many_ensure, (VALUE)&m);
+
+  if(m.kerror)
+    rb_raise(cKrb5Exception, "krb5_k_encrypt: item %ld: %s", m.failed, error_message(m.kerror));
+
+  return v_ciphers;
+}
+
+/*
+ * call-seq:
+ *   crypto.close
+ *
+ * Frees the key and its context.
+ */
+static VALUE rkrb5_crypto_close(VALUE self){
+  RUBY_KRB5_CRYPTO* ptr;
+
+  Data_Get_Struct(self, RUBY_KRB5_CRYPTO, ptr);
+
+  if(ptr->busy)
+    rb_raise(cKrb5Exception, "crypto object is in use by another thread");
+
+  if(ptr->key)
+    krb5_k_free_key(ptr->ctx, ptr->key);
+
+  if(ptr->ctx)
+    krb5_free_context(ptr->ctx);
+
+  ptr->key = NULL;
+  ptr->ctx = NULL;
+
+  return Qtrue;
+}
+
+void Init_crypto(){
+  /* The Kerberos::Krb5::Crypto class encrypts and checksums data under a key. */
+  cKrb5Crypto = rb_define_class_under(cKrb5, "Crypto", rb_cObject);
+
+  // Allocation Function
+  rb_define_alloc_func(cKrb5Crypto, rkrb5_crypto_allocate);
+
+  // Constructor
+  rb_define_method(cKrb5Crypto, "initialize", rkrb5_crypto_initialize, -1);
+
+  // Instance Methods
+  rb_define_method(cKrb5Crypto, "checksum", rkrb5_crypto_checksum, -1);
+  rb_define_method(cKrb5Crypto, "close", rkrb5_crypto_close, 0);
+  rb_define_method(cKrb5Crypto, "decrypt", rkrb5_crypto_decrypt, -1);
+  rb_define_method(cKrb5Crypto, "encrypt", rkrb5_crypto_encrypt, -1);
+  rb_define_method(cKrb5Crypto, "encrypt_many", rkrb5_crypto_encrypt_many, 2);
+  rb_define_method(cKrb5Crypto, "enctype", rkrb5_crypto_enctype, 0);
+  rb_define_method(cKrb5Crypto, "verify_checksum", rkrb5_crypto_verify_checksum, 3);
+}
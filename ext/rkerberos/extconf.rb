@@ -5,6 +5,10 @@ dir_config('rkerberos', '/usr/local')
 have_header('krb5.h')
 have_library('krb5')
 
+unless have_header('pthread.h') && have_library('pthread')
+  raise 'pthread library not found'
+end
+
 unless pkg_config('com_err')
   puts 'warning: com_err not found, usually a dependency for kadm5clnt'
 end
@@ -21,5 +25,16 @@ else
   raise 'kdb5 library not found'
 end
 
+unless have_header('gssapi/gssapi.h') && have_library('gssapi_krb5')
+  raise 'gssapi_krb5 library not found'
+end
+
+# Removed in MIT krb5 1.18, after which only the default replay cache is
+# available to Acceptor
+have_func('krb5_rc_resolve_full', 'krb5.h')
+
+# Lets GSS::Context#wrap_iov work on IO::Buffer objects in place
+have_func('rb_io_buffer_get_bytes_for_writing', 'ruby/io/buffer.h')
+
 $CFLAGS << ' -std=c99 -Wall -pedantic'
 create_makefile('rkerberos')
@@ -0,0 +1,855 @@
+#include <rkerberos.h>
+#include <stdio.h>
+
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_WRITING
+#include <ruby/io/buffer.h>
+#endif
+
+VALUE mGSS, cGSSAcceptor, cGSSContext, cGSSException;
+
+// Arguments for, and results of, one gss_accept_sec_context call.
+typedef struct {
+  gss_cred_id_t cred;
+  gss_ctx_id_t* context;
+  gss_buffer_desc input;
+  gss_buffer_desc output;
+  gss_buffer_desc name;
+  gss_cred_id_t delegated;
+  OM_uint32 flags;
+  OM_uint32 lifetime;
+  OM_uint32 major;
+  OM_uint32 minor;
+  const char* func;
+} RKRB5_GSS_ACCEPT;
+
+/*
+ * Raises a Kerberos::GSS::Exception for a failed +func+, with the messages
+ * for both the GSS-API +major+ status and the mechanism's +minor+ status.
+ */
+static void rkrb5_gss_raise(const char* func, OM_uint32 major, OM_uint32 minor){
+  OM_uint32 status, context = 0;
+  gss_buffer_desc text;
+  char buf[512];
+  size_t length;
+
+  length = snprintf(buf, sizeof(buf), "%s:", func);
+
+  do{
+    if(GSS_ERROR(gss_display_status(&status, major, GSS_C_GSS_CODE, GSS_C_NO_OID, &context, &text)))
+      break;
+
+    if(length < sizeof(buf))
+      length += snprintf(buf + length, sizeof(buf) - length, " %.*s", (int)text.length, (char*)text.value);
+
+    gss_release_buffer(&status, &text);
+  } while(context);
+
+  context = 0;
+
+  while(minor){
+    if(GSS_ERROR(gss_display_status(&status, minor, GSS_C_MECH_CODE, GSS_C_NO_OID, &context, &text)))
+      break;
+
+    if(length < sizeof(buf))
+      length += snprintf(buf + length, sizeof(buf) - length, ": %.*s", (int)text.length, (char*)text.value);
+
+    gss_release_buffer(&status, &text);
+
+    if(!context)
+      break;
+  }
+
+  rb_raise(cGSSException, "%s", buf);
+}
+
+// Free function for the Kerberos::GSS::Acceptor class.
+static void rkrb5_gss_acceptor_free(RUBY_GSS_ACCEPTOR* ptr){
+  OM_uint32 minor;
+
+  if(!ptr)
+    return;
+
+  if(ptr->cred != GSS_C_NO_CREDENTIAL)
+    gss_release_cred(&minor, &ptr->cred);
+
+  if(ptr->keytab){
+    rkrb5_kt_clear_memory(ptr->ctx, ptr->keytab);
+    krb5_kt_close(ptr->ctx, ptr->keytab);
+  }
+
+  if(ptr->ctx)
+    krb5_free_context(ptr->ctx);
+
+  pthread_mutex_destroy(&ptr->lock);
+
+  free(ptr);
+}
+
+// Allocation function for the Kerberos::GSS::Acceptor class.
+static VALUE rkrb5_gss_acceptor_allocate(VALUE klass){
+  RUBY_GSS_ACCEPTOR* ptr = malloc(sizeof(RUBY_GSS_ACCEPTOR));
+  memset(ptr, 0, sizeof(RUBY_GSS_ACCEPTOR));
+  pthread_mutex_init(&ptr->lock, NULL);
+  return Data_Wrap_Struct(klass, 0, rkrb5_gss_acceptor_free, ptr);
+}
+
+// Free function for the Kerberos::GSS::Context class.
+static void rkrb5_gss_context_free(RUBY_GSS_CONTEXT* ptr){
+  OM_uint32 minor;
+
+  if(!ptr)
+    return;
+
+  if(ptr->ctx != GSS_C_NO_CONTEXT)
+    gss_delete_sec_context(&minor, &ptr->ctx, GSS_C_NO_BUFFER);
+
+  if(ptr->delegated != GSS_C_NO_CREDENTIAL)
+    gss_release_cred(&minor, &ptr->delegated);
+
+  free(ptr);
+}
+
+/*
+ * call-seq:
+ *   Kerberos::GSS::Acceptor.new(:keytab => nil)
+ *
+ * Creates and returns a new Kerberos::GSS::Acceptor, which accepts the
+ * security context tokens, Kerberos or SPNEGO, that GSS-API clients send.
+ *
+ * The +keytab+, a Kerberos::Krb5::Keytab object or name, is read into
+ * memory and acceptor credentials are acquired from it once, here. Later
+ * changes to the keytab are not seen. If no keytab is given the default
+ * keytab is used. Tokens for any principal in the keytab are accepted.
+ */
+static VALUE rkrb5_gss_acceptor_initialize(int argc, VALUE* argv, VALUE self){
+  RUBY_GSS_ACCEPTOR* ptr;
+  krb5_error_code kerror;
+  krb5_keytab keytab;
+  const char* func;
+  gss_key_value_element_desc element;
+  gss_key_value_set_desc store;
+  OM_uint32 major, minor;
+  VALUE v_opts, v_keytab = Qnil;
+
+  Data_Get_Struct(self, RUBY_GSS_ACCEPTOR, ptr);
+
+  rb_scan_args(argc, argv, "01", &v_opts);
+
+  if(ptr->ctx)
+    rb_raise(cGSSException, "acceptor already initialized");
+
+  if(!NIL_P(v_opts)){
+    Check_Type(v_opts, T_HASH);
+
+    v_keytab = rb_hash_aref2(v_opts, "keytab");
+
+    if(rb_obj_is_kind_of(v_keytab, cKrb5Keytab))
+      v_keytab = rb_iv_get(v_keytab, "@name");
+
+    if(!NIL_P(v_keytab))
+      Check_Type(v_keytab, T_STRING);
+  }
+
+  kerror = krb5_init_context(&ptr->ctx);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_init_context: %s", error_message(kerror));
+
+  if(NIL_P(v_keytab))
+    kerror = krb5_kt_default(ptr->ctx, &keytab);
+  else
+    kerror = krb5_kt_resolve(ptr->ctx, StringValueCStr(v_keytab), &keytab);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_kt_resolve: %s", error_message(kerror));
+
+  rkrb5_kt_memory_name(ptr->keytab_name, sizeof(ptr->keytab_name), "rkerberos_gss");
+
+  // The copy is emptied when the acceptor is closed or freed, since MIT keeps
+  // memory keytabs around after their last handle is closed.
+  kerror = rkrb5_kt_load_memory(ptr->ctx, keytab, ptr->keytab_name, &ptr->keytab, &func);
+  krb5_kt_close(ptr->ctx, keytab);
+
+  if(kerror){
+    ptr->keytab = NULL;
+    rb_raise(cKrb5Exception, "%s: %s", func, error_message(kerror));
+  }
+
+  element.key = "keytab";
+  element.value = ptr->keytab_name;
+  store.count = 1;
+  store.elements = &element;
+
+  major = gss_acquire_cred_from(
+    &minor,
+    GSS_C_NO_NAME,
+    GSS_C_INDEFINITE,
+    GSS_C_NO_OID_SET,
+    GSS_C_ACCEPT,
+    &store,
+    &ptr->cred,
+    NULL,
+    NULL
+  );
+
+  if(GSS_ERROR(major)){
+    ptr->cred = GSS_C_NO_CREDENTIAL;
+    rkrb5_gss_raise("gss_acquire_cred_from", major, minor);
+  }
+
+  return self;
+}
+
+static void* rkrb5_gss_accept_nogvl(void* arg){
+  RKRB5_GSS_ACCEPT* a = arg;
+  gss_name_t client = GSS_C_NO_NAME;
+  OM_uint32 minor;
+
+  a->func = "gss_accept_sec_context";
+
+  a->major = gss_accept_sec_context(
+    &a->minor,
+    a->context,
+    a->cred,
+    &a->input,
+    GSS_C_NO_CHANNEL_BINDINGS,
+    &client,
+    NULL,
+    &a->output,
+    &a->flags,
+    &a->lifetime,
+    &a->delegated
+  );
+
+  if(a->major == GSS_S_COMPLETE){
+    a->func = "gss_display_name";
+    a->major = gss_display_name(&a->minor, client, &a->name, NULL);
+  }
+
+  if(client != GSS_C_NO_NAME)
+    gss_release_name(&minor, &client);
+
+  return NULL;
+}
+
+// Runs one step of the handshake for +v_context+ without the GVL.
+static VALUE rkrb5_gss_context_step_call(VALUE v_context, VALUE v_token){
+  RUBY_GSS_CONTEXT* ptr;
+  RKRB5_GSS_ACCEPT a;
+  OM_uint32 minor;
+  VALUE v_output = Qnil;
+
+  Data_Get_Struct(v_context, RUBY_GSS_CONTEXT, ptr);
+
+  memset(&a, 0, sizeof(a));
+
+  a.cred = ptr->acceptor->cred;
+  a.context = &ptr->ctx;
+  a.input.value = RSTRING_PTR(v_token);
+  a.input.length = RSTRING_LEN(v_token);
+  a.delegated = GSS_C_NO_CREDENTIAL;
+
+  rb_thread_call_without_gvl(rkrb5_gss_accept_nogvl, &a, RUBY_UBF_IO, NULL);
+
+  RB_GC_GUARD(v_token);
+
+  if(a.output.length > 0)
+    v_output = rb_str_new(a.output.value, a.output.length);
+
+  gss_release_buffer(&minor, &a.output);
+
+  if(a.delegated != GSS_C_NO_CREDENTIAL){
+    if(ptr->delegated != GSS_C_NO_CREDENTIAL)
+      gss_release_cred(&minor, &ptr->delegated);
+
+    ptr->delegated = a.delegated;
+  }
+
+  if(GSS_ERROR(a.major))
+    rkrb5_gss_raise(a.func, a.major, a.minor);
+
+  ptr->flags = a.flags;
+  ptr->lifetime = a.lifetime;
+
+  if(a.major == GSS_S_COMPLETE){
+    ptr->established = 1;
+    rb_iv_set(v_context, "@client_name", rb_str_new(a.name.value, a.name.length));
+    gss_release_buffer(&minor, &a.name);
+  }
+
+  rb_iv_set(v_context, "@output_token", v_output);
+
+  return v_output;
+}
+
+// Arguments for one Context#step call, so its bookkeeping can be undone.
+typedef struct {
+  VALUE v_context;
+  VALUE v_token;
+} RKRB5_GSS_STEP;
+
+static VALUE rkrb5_gss_context_step_body(VALUE v_arg){
+  RKRB5_GSS_STEP* s = (RKRB5_GSS_STEP*)v_arg;
+  return rkrb5_gss_context_step_call(s->v_context, s->v_token);
+}
+
+static VALUE rkrb5_gss_context_step_ensure(VALUE v_arg){
+  RKRB5_GSS_STEP* s = (RKRB5_GSS_STEP*)v_arg;
+  RUBY_GSS_CONTEXT* ptr;
+
+  Data_Get_Struct(s->v_context, RUBY_GSS_CONTEXT, ptr);
+
+  pthread_mutex_lock(&ptr->acceptor->lock);
+  ptr->acceptor->busy--;
+  pthread_mutex_unlock(&ptr->acceptor->lock);
+
+  ptr->busy = 0;
+
+  return Qnil;
+}
+
+// Checks that +v_context+ may take another step, then takes it.
+static VALUE rkrb5_gss_context_step_run(VALUE v_context, VALUE v_token){
+  RUBY_GSS_CONTEXT* ptr;
+  RKRB5_GSS_STEP s;
+
+  Data_Get_Struct(v_context, RUBY_GSS_CONTEXT, ptr);
+
+  Check_Type(v_token, T_STRING);
+
+  if(ptr->established)
+    rb_raise(cGSSException, "security context already established");
+
+  if(ptr->busy)
+    rb_raise(cGSSException, "security context is in use by another thread");
+
+  if(!ptr->acceptor->ctx)
+    rb_raise(cGSSException, "no context has been established");
+
+  ptr->busy = 1;
+
+  pthread_mutex_lock(&ptr->acceptor->lock);
+  ptr->acceptor->busy++;
+  pthread_mutex_unlock(&ptr->acceptor->lock);
+
+  // The token must not change while the library reads it.
+  s.v_context = v_context;
+  s.v_token = rb_str_new_frozen(v_token);
+
+  return rb_ensure(rkrb5_gss_context_step_body, (VALUE)&s, rkrb5_gss_context_step_ensure, (VALUE)&s);
+}
+
+/*
+ * call-seq:
+ *   acceptor.accept(token)
+ *
+ * Accepts the first security context +token+ from a client, releasing the
+ * GVL while doing so, and returns a Kerberos::GSS::Context. If the context
+ * is established? its client_name and any delegated_credentials are
+ * available. Otherwise, send its output_token to the client and pass the
+ * client's reply to Context#step.
+ *
+ * An acceptor may be used by several threads at once.
+ */
+static VALUE rkrb5_gss_acceptor_accept(VALUE self, VALUE v_token){
+  RUBY_GSS_ACCEPTOR* ptr;
+  RUBY_GSS_CONTEXT* cptr;
+  VALUE v_context;
+
+  Data_Get_Struct(self, RUBY_GSS_ACCEPTOR, ptr);
+
+  Check_Type(v_token, T_STRING);
+
+  if(!ptr->ctx)
+    rb_raise(cGSSException, "no context has been established");
+
+  cptr = malloc(sizeof(RUBY_GSS_CONTEXT));
+  memset(cptr, 0, sizeof(RUBY_GSS_CONTEXT));
+  cptr->ctx = GSS_C_NO_CONTEXT;
+  cptr->delegated = GSS_C_NO_CREDENTIAL;
+  cptr->acceptor = ptr;
+
+  v_context = Data_Wrap_Struct(cGSSContext, 0, rkrb5_gss_context_free, cptr);
+
+  // Keep the acceptor, and so its credentials, alive for later steps.
+  rb_iv_set(v_context, "@acceptor", self);
+  rb_iv_set(v_context, "@client_name", Qnil);
+  rb_iv_set(v_context, "@output_token", Qnil);
+  rb_iv_set(v_context, "@delegated_credentials", Qnil);
+
+  rkrb5_gss_context_step_run(v_context, v_token);
+
+  return v_context;
+}
+
+/*
+ * call-seq:
+ *   acceptor.close
+ *
+ * Closes the acceptor, releasing its credentials and in-memory keytab.
+ * Raises an error if a token is still being accepted.
+ */
+static VALUE rkrb5_gss_acceptor_close(VALUE self){
+  RUBY_GSS_ACCEPTOR* ptr;
+  OM_uint32 minor;
+  int busy;
+
+  Data_Get_Struct(self, RUBY_GSS_ACCEPTOR, ptr);
+
+  pthread_mutex_lock(&ptr->lock);
+  busy = ptr->busy;
+  pthread_mutex_unlock(&ptr->lock);
+
+  if(busy)
+    rb_raise(cGSSException, "acceptor is in use by another thread");
+
+  if(!ptr->ctx)
+    return Qtrue;
+
+  if(ptr->cred != GSS_C_NO_CREDENTIAL)
+    gss_release_cred(&minor, &ptr->cred);
+
+  if(ptr->keytab){
+    rkrb5_kt_clear_memory(ptr->ctx, ptr->keytab);
+    krb5_kt_close(ptr->ctx, ptr->keytab);
+  }
+
+  krb5_free_context(ptr->ctx);
+
+  ptr->cred = GSS_C_NO_CREDENTIAL;
+  ptr->keytab = NULL;
+  ptr->ctx = NULL;
+
+  return Qtrue;
+}
+
+/*
+ * call-seq:
+ *   context.step(token)
+ *
+ * Passes the client's next +token+ to a context that is not yet
+ * established, releasing the GVL while doing so. Returns the token to send
+ * back to the client, or nil if there is none.
+ */
+static VALUE rkrb5_gss_context_step(VALUE self, VALUE v_token){
+  return rkrb5_gss_context_step_run(self, v_token);
+}
+
+/*
+ * call-seq:
+ *   context.established?
+ *
+ * Returns whether the security context has been fully established.
+ */
+static VALUE rkrb5_gss_context_established_p(VALUE self){
+  RUBY_GSS_CONTEXT* ptr;
+  Data_Get_Struct(self, RUBY_GSS_CONTEXT, ptr);
+  return ptr->established ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *   context.flags
+ *
+ * Returns the GSS_C_*_FLAG bits describing the services the security
+ * context provides, e.g. Kerberos::GSS::DELEG_FLAG.
+ */
+static VALUE rkrb5_gss_context_flags(VALUE self){
+  RUBY_GSS_CONTEXT* ptr;
+  Data_Get_Struct(self, RUBY_GSS_CONTEXT, ptr);
+  return UINT2NUM(ptr->flags);
+}
+
+/*
+ * call-seq:
+ *   context.lifetime
+ *
+ * Returns the number of seconds the security context remains valid for,
+ * as of when it was established.
+ */
+static VALUE rkrb5_gss_context_lifetime(VALUE self){
+  RUBY_GSS_CONTEXT* ptr;
+  Data_Get_Struct(self, RUBY_GSS_CONTEXT, ptr);
+  return UINT2NUM(ptr->lifetime);
+}
+
+/*
+ * call-seq:
+ *   context.delegated_credentials
+ *
+ * Returns the credentials the client delegated, copied into a new MEMORY
+ * Kerberos::Krb5::CredentialsCache, or nil if it delegated none. The cache
+ * is created on the first call and the same one is returned afterwards.
+ */
+static VALUE rkrb5_gss_context_delegated_credentials(VALUE self){
+  RUBY_GSS_CONTEXT* ptr;
+  RUBY_KRB5_CCACHE* ccptr;
+  OM_uint32 major, minor;
+  VALUE v_ccache;
+
+  Data_Get_Struct(self, RUBY_GSS_CONTEXT, ptr);
+
+  v_ccache = rb_iv_get(self, "@delegated_credentials");
+
+  if(!NIL_P(v_ccache) || ptr->delegated == GSS_C_NO_CREDENTIAL)
+    return v_ccache;
+
+  v_ccache = rb_funcall(
+    cKrb5CCache,
+    rb_intern("new_unique"),
+    2,
+    rb_str_new2("MEMORY"),
+    rb_iv_get(self, "@client_name")
+  );
+
+  Data_Get_Struct(v_ccache, RUBY_KRB5_CCACHE, ccptr);
+
+  major = gss_krb5_copy_ccache(&minor, ptr->delegated, ccptr->ccache);
+
+  if(GSS_ERROR(major))
+    rkrb5_gss_raise("gss_krb5_copy_ccache", major, minor);
+
+  rb_iv_set(self, "@delegated_credentials", v_ccache);
+
+  return v_ccache;
+}
+
+// Buffers of at least this many bytes are protected without the GVL.
+#define RKRB5_GSS_IOV_NOGVL_MIN 65536
+
+// Arguments for, and results of, one gss_wrap_iov or gss_unwrap_iov call.
+typedef struct {
+  RUBY_GSS_CONTEXT* ptr;
+  VALUE v_data;
+  gss_iov_buffer_desc iov[4];
+  int count;
+  int unwrap;
+  int conf_req;
+  int conf_state;
+  OM_uint32 major;
+  OM_uint32 minor;
+} RKRB5_GSS_IOV;
+
+// Returns whether +v_data+ is an IO::Buffer rather than a String.
+static int rkrb5_gss_iov_is_buffer(VALUE v_data){
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_WRITING
+  return RTEST(rb_obj_is_kind_of(v_data, rb_cIOBuffer));
+#else
+  return 0;
+#endif
+}
+
+// Checks that +v_data+ may be changed in place, and unshares it if needed.
+static int rkrb5_gss_iov_prepare(VALUE v_data){
+  if(rkrb5_gss_iov_is_buffer(v_data))
+    return 1;
+
+  Check_Type(v_data, T_STRING);
+  rb_str_modify(v_data);
+
+  return 0;
+}
+
+// Points +buffer+ at the bytes of +v_data+.
+static void rkrb5_gss_iov_bytes(VALUE v_data, gss_buffer_desc* buffer){
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_WRITING
+  if(rkrb5_gss_iov_is_buffer(v_data)){
+    rb_io_buffer_get_bytes_for_writing(v_data, &buffer->value, &buffer->length);
+    return;
+  }
+#endif
+  buffer->value = RSTRING_PTR(v_data);
+  buffer->length = RSTRING_LEN(v_data);
+}
+
+static void* rkrb5_gss_iov_nogvl(void* arg){
+  RKRB5_GSS_IOV* v = arg;
+
+  if(v->unwrap)
+    v->major = gss_unwrap_iov(&v->minor, v->ptr->ctx, &v->conf_state, NULL, v->iov, v->count);
+  else
+    v->major = gss_wrap_iov(&v->minor, v->ptr->ctx, v->conf_req, GSS_C_QOP_DEFAULT, &v->conf_state, v->iov, v->count);
+
+  return NULL;
+}
+
+static VALUE rkrb5_gss_iov_body(VALUE v_arg){
+  RKRB5_GSS_IOV* v = (RKRB5_GSS_IOV*)v_arg;
+
+  // The data is always the second buffer.
+  if(v->iov[1].buffer.length >= RKRB5_GSS_IOV_NOGVL_MIN)
+    rb_thread_call_without_gvl(rkrb5_gss_iov_nogvl, v, RUBY_UBF_IO, NULL);
+  else
+    rkrb5_gss_iov_nogvl(v);
+
+  return Qnil;
+}
+
+static VALUE rkrb5_gss_iov_ensure(VALUE v_arg){
+  RKRB5_GSS_IOV* v = (RKRB5_GSS_IOV*)v_arg;
+
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_WRITING
+  if(rkrb5_gss_iov_is_buffer(v->v_data))
+    rb_io_buffer_unlock(v->v_data);
+  else
+#endif
+    rb_str_unlocktmp(v->v_data);
+
+  v->ptr->busy = 0;
+
+  return Qnil;
+}
+
+/*
+ * Runs +v+ with its data locked, so that other threads can neither change
+ * nor free it while the GVL is released, then raises on failure.
+ */
+static void rkrb5_gss_iov_run(RKRB5_GSS_IOV* v){
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_WRITING
+  if(rkrb5_gss_iov_is_buffer(v->v_data))
+    rb_io_buffer_lock(v->v_data);
+  else
+#endif
+    rb_str_locktmp(v->v_data);
+
+  v->ptr->busy = 1;
+
+  rb_ensure(rkrb5_gss_iov_body, (VALUE)v, rkrb5_gss_iov_ensure, (VALUE)v);
+
+  if(GSS_ERROR(v->major))
+    rkrb5_gss_raise(v->unwrap ? "gss_unwrap_iov" : "gss_wrap_iov", v->major, v->minor);
+}
+
+// Raises unless +ptr+ is an established context not in use elsewhere.
+static void rkrb5_gss_context_check(RUBY_GSS_CONTEXT* ptr){
+  if(!ptr->established || ptr->ctx == GSS_C_NO_CONTEXT)
+    rb_raise(cGSSException, "security context not established");
+
+  if(ptr->busy)
+    rb_raise(cGSSException, "security context is in use by another thread");
+}
+
+/*
+ * call-seq:
+ *   context.wrap_iov(data, encrypt = true)
+ *
+ * Protects +data+, a String or IO::Buffer, in place: it is encrypted if
+ * +encrypt+ is true and the context offers confidentiality, and signed
+ * either way. Returns the token [header, trailer] to send along with it.
+ *
+ * Nothing is copied, and the GVL is released for data of 64KB or more.
+ * The data is locked while it is being protected and its contents are
+ * undefined if an error is raised.
+ *
+ * Older enctypes need padding after the data, which is appended to a
+ * String. Such padding cannot be added to an IO::Buffer, so an error is
+ * raised instead. AES and newer enctypes never need padding.
+ */
+static VALUE rkrb5_gss_context_wrap_iov(int argc, VALUE* argv, VALUE self){
+  RUBY_GSS_CONTEXT* ptr;
+  RKRB5_GSS_IOV v;
+  VALUE v_data, v_encrypt, v_header, v_trailer;
+  size_t length;
+  int is_buffer;
+
+  Data_Get_Struct(self, RUBY_GSS_CONTEXT, ptr);
+
+  rb_scan_args(argc, argv, "11", &v_data, &v_encrypt);
+
+  rkrb5_gss_context_check(ptr);
+  is_buffer = rkrb5_gss_iov_prepare(v_data);
+
+  memset(&v, 0, sizeof(v));
+
+  v.ptr = ptr;
+  v.v_data = v_data;
+  v.count = 4;
+  v.conf_req = NIL_P(v_encrypt) ? 1 : RTEST(v_encrypt);
+  v.iov[0].type = GSS_IOV_BUFFER_TYPE_HEADER;
+  v.iov[1].type = GSS_IOV_BUFFER_TYPE_DATA;
+  v.iov[2].type = GSS_IOV_BUFFER_TYPE_PADDING;
+  v.iov[3].type = GSS_IOV_BUFFER_TYPE_TRAILER;
+
+  rkrb5_gss_iov_bytes(v_data, &v.iov[1].buffer);
+  length = v.iov[1].buffer.length;
+
+  v.major = gss_wrap_iov_length(&v.minor, ptr->ctx, v.conf_req, GSS_C_QOP_DEFAULT, NULL, v.iov, v.count);
+
+  if(GSS_ERROR(v.major))
+    rkrb5_gss_raise("gss_wrap_iov_length", v.major, v.minor);
+
+  if(v.iov[2].buffer.length > 0){
+    if(is_buffer)
+      rb_raise(cGSSException, "this enctype needs padding, which an IO::Buffer cannot take");
+
+    rb_str_resize(v_data, length + v.iov[2].buffer.length);
+  }
+
+  // The library writes the header and trailer straight into these.
+  v_header = rb_str_new(NULL, v.iov[0].buffer.length);
+  v_trailer = rb_str_new(NULL, v.iov[3].buffer.length);
+
+  rkrb5_gss_iov_bytes(v_data, &v.iov[1].buffer);
+
+  v.iov[0].buffer.value = RSTRING_PTR(v_header);
+  v.iov[1].buffer.length = length;
+  v.iov[2].buffer.value = (char*)v.iov[1].buffer.value + length;
+  v.iov[3].buffer.value = RSTRING_PTR(v_trailer);
+
+  rkrb5_gss_iov_run(&v);
+
+  if(v.conf_req && !v.conf_state)
+    rb_raise(cGSSException, "confidentiality is not available on this security context");
+
+  return rb_ary_new3(2, v_header, v_trailer);
+}
+
+/*
+ * call-seq:
+ *   context.unwrap_iov(header, data, trailer, encrypted = true)
+ *
+ * Verifies, and decrypts if needed, +data+ in place, given the +header+
+ * and +trailer+ that Context#wrap_iov produced for it. The +data+ is a
+ * String or IO::Buffer, and is returned.
+ *
+ * If +encrypted+ is true an error is raised when the sender only signed
+ * the data, so a peer can't downgrade to sending it in the clear. Pass
+ * false to accept data wrapped with <tt>encrypt = false</tt>.
+ *
+ * Nothing in the data is copied, and the GVL is released for data of 64KB
+ * or more. Padding left by older enctypes is removed from a String; for an
+ * IO::Buffer a slice without it is returned instead.
+ */
+static VALUE rkrb5_gss_context_unwrap_iov(int argc, VALUE* argv, VALUE self){
+  RUBY_GSS_CONTEXT* ptr;
+  RKRB5_GSS_IOV v;
+  VALUE v_header, v_data, v_trailer, v_encrypted;
+  size_t length;
+  int is_buffer;
+
+  Data_Get_Struct(self, RUBY_GSS_CONTEXT, ptr);
+
+  rb_scan_args(argc, argv, "31", &v_header, &v_data, &v_trailer, &v_encrypted);
+
+  Check_Type(v_header, T_STRING);
+  Check_Type(v_trailer, T_STRING);
+
+  rkrb5_gss_context_check(ptr);
+  is_buffer = rkrb5_gss_iov_prepare(v_data);
+
+  // The library decrypts parts of the header and trailer in place as well,
+  // so it gets copies of these small strings.
+  v_header = rb_str_new(RSTRING_PTR(v_header), RSTRING_LEN(v_header));
+  v_trailer = rb_str_new(RSTRING_PTR(v_trailer), RSTRING_LEN(v_trailer));
+
+  memset(&v, 0, sizeof(v));
+
+  v.ptr = ptr;
+  v.v_data = v_data;
+  v.count = 3;
+  v.unwrap = 1;
+  v.iov[0].type = GSS_IOV_BUFFER_TYPE_HEADER;
+  v.iov[1].type = GSS_IOV_BUFFER_TYPE_DATA;
+  v.iov[2].type = GSS_IOV_BUFFER_TYPE_TRAILER;
+
+  rkrb5_gss_iov_bytes(v_data, &v.iov[1].buffer);
+  length = v.iov[1].buffer.length;
+
+  v.iov[0].buffer.value = RSTRING_PTR(v_header);
+  v.iov[0].buffer.length = RSTRING_LEN(v_header);
+  v.iov[2].buffer.value = RSTRING_PTR(v_trailer);
+  v.iov[2].buffer.length = RSTRING_LEN(v_trailer);
+
+  rkrb5_gss_iov_run(&v);
+
+  RB_GC_GUARD(v_header);
+  RB_GC_GUARD(v_trailer);
+
+  if((NIL_P(v_encrypted) || RTEST(v_encrypted)) && !v.conf_state)
+    rb_raise(cGSSException, "the data was not encrypted");
+
+  // The library shortens the data by any padding it found at the end.
+  if(v.iov[1].buffer.length < length){
+    if(is_buffer)
+      return rb_funcall(v_data, rb_intern("slice"), 2, INT2FIX(0), SIZET2NUM(v.iov[1].buffer.length));
+
+    rb_str_set_len(v_data, v.iov[1].buffer.length);
+  }
+
+  return v_data;
+}
+
+/*
+ * call-seq:
+ *   context.close
+ *
+ * Deletes the security context and releases any delegated credentials not
+ * yet copied into a cache.
+ */
+static VALUE rkrb5_gss_context_close(VALUE self){
+  RUBY_GSS_CONTEXT* ptr;
+  OM_uint32 minor;
+
+  Data_Get_Struct(self, RUBY_GSS_CONTEXT, ptr);
+
+  if(ptr->busy)
+    rb_raise(cGSSException, "security context is in use by another thread");
+
+  if(ptr->ctx != GSS_C_NO_CONTEXT)
+    gss_delete_sec_context(&minor, &ptr->ctx, GSS_C_NO_BUFFER);
+
+  if(ptr->delegated != GSS_C_NO_CREDENTIAL)
+    gss_release_cred(&minor, &ptr->delegated);
+
+  ptr->ctx = GSS_C_NO_CONTEXT;
+  ptr->delegated = GSS_C_NO_CREDENTIAL;
+
+  return Qtrue;
+}
+
+void Init_gss(){
+  /* The Kerberos::GSS module wraps the acceptor side of the GSS-API. */
+  mGSS = rb_define_module_under(mKerberos, "GSS");
+
+  /* The Kerberos::GSS::Exception class is raised for GSS-API failures. */
+  cGSSException = rb_define_class_under(mGSS, "Exception", rb_eStandardError);
+
+  /* The Kerberos::GSS::Acceptor class accepts security contexts from GSS-API clients. */
+  cGSSAcceptor = rb_define_class_under(mGSS, "Acceptor", rb_cObject);
+
+  /* The Kerberos::GSS::Context class is one accepted security context. */
+  cGSSContext = rb_define_class_under(mGSS, "Context", rb_cObject);
+
+  // Allocation Function
+  rb_define_alloc_func(cGSSAcceptor, rkrb5_gss_acceptor_allocate);
+  rb_undef_alloc_func(cGSSContext);
+
+  // Constructor
+  rb_define_method(cGSSAcceptor, "initialize", rkrb5_gss_acceptor_initialize, -1);
+
+  // Instance Methods
+  rb_define_method(cGSSAcceptor, "accept", rkrb5_gss_acceptor_accept, 1);
+  rb_define_method(cGSSAcceptor, "close", rkrb5_gss_acceptor_close, 0);
+
+  rb_define_method(cGSSContext, "close", rkrb5_gss_context_close, 0);
+  rb_define_method(cGSSContext, "delegated_credentials", rkrb5_gss_context_delegated_credentials, 0);
+  rb_define_method(cGSSContext, "established?", rkrb5_gss_context_established_p, 0);
+  rb_define_method(cGSSContext, "flags", rkrb5_gss_context_flags, 0);
+  rb_define_method(cGSSContext, "lifetime", rkrb5_gss_context_lifetime, 0);
+  rb_define_method(cGSSContext, "step", rkrb5_gss_context_step, 1);
+  rb_define_method(cGSSContext, "unwrap_iov", rkrb5_gss_context_unwrap_iov, -1);
+  rb_define_method(cGSSContext, "wrap_iov", rkrb5_gss_context_wrap_iov, -1);
+
+  // Context Accessors
+  rb_define_attr(cGSSContext, "client_name", 1, 0);
+  rb_define_attr(cGSSContext, "output_token", 1, 0);
+
+  // Context Flags
+  rb_define_const(mGSS, "DELEG_FLAG", UINT2NUM(GSS_C_DELEG_FLAG));
+  rb_define_const(mGSS, "MUTUAL_FLAG", UINT2NUM(GSS_C_MUTUAL_FLAG));
+  rb_define_const(mGSS, "REPLAY_FLAG", UINT2NUM(GSS_C_REPLAY_FLAG));
+  rb_define_const(mGSS, "SEQUENCE_FLAG", UINT2NUM(GSS_C_SEQUENCE_FLAG));
+  rb_define_const(mGSS, "CONF_FLAG", UINT2NUM(GSS_C_CONF_FLAG));
+  rb_define_const(mGSS, "INTEG_FLAG", UINT2NUM(GSS_C_INTEG_FLAG));
+  rb_define_const(mGSS, "ANON_FLAG", UINT2NUM(GSS_C_ANON_FLAG));
+}
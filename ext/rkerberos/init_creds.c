@@ -0,0 +1,345 @@
+#include <rkerberos.h>
+
+VALUE cKrb5InitCreds;
+
+// Arguments for, and results of, a single InitCredsSession#acquire call.
+typedef struct {
+  RUBY_KRB5_INIT_CREDS* ptr;
+  krb5_context ctx;
+  char* ccache_name;
+  krb5_creds creds;
+  krb5_error_code kerror;
+  const char* func;
+} RKRB5_ACQUIRE;
+
+// Free function for the Kerberos::Krb5::InitCredsSession class.
+static void rkrb5_init_creds_free(RUBY_KRB5_INIT_CREDS* ptr){
+  int i;
+
+  if(!ptr)
+    return;
+
+  if(ptr->opt)
+    krb5_get_init_creds_opt_free(ptr->ctx, ptr->opt);
+
+  if(ptr->keytab)
+    krb5_kt_close(ptr->ctx, ptr->keytab);
+
+  if(ptr->principal)
+    krb5_free_principal(ptr->ctx, ptr->principal);
+
+  if(ptr->ctx)
+    krb5_free_context(ptr->ctx);
+
+  for(i = 0; i < ptr->idle_count; i++)
+    krb5_free_context(ptr->idle[i]);
+
+  free(ptr->idle);
+  free(ptr->service);
+
+  pthread_mutex_destroy(&ptr->lock);
+
+  free(ptr);
+}
+
+// Allocation function for the Kerberos::Krb5::InitCredsSession class.
+static VALUE rkrb5_init_creds_allocate(VALUE klass){
+  RUBY_KRB5_INIT_CREDS* ptr = malloc(sizeof(RUBY_KRB5_INIT_CREDS));
+  memset(ptr, 0, sizeof(RUBY_KRB5_INIT_CREDS));
+  pthread_mutex_init(&ptr->lock, NULL);
+  return Data_Wrap_Struct(klass, 0, rkrb5_init_creds_free, ptr);
+}
+
+/*
+ * Creates an InitCredsSession for +v_principal+ (or the host principal for
+ * +v_service+ if nil) using the keytab named +v_keytab+ (or the default
+ * keytab if nil) and the get_init_creds options in +v_opts+.
+ */
+VALUE rkrb5_init_creds_new(VALUE v_principal, VALUE v_keytab, VALUE v_service, VALUE v_opts){
+  RUBY_KRB5_INIT_CREDS* ptr;
+  krb5_error_code kerror;
+  VALUE v_session;
+
+  if(!NIL_P(v_principal))
+    Check_Type(v_principal, T_STRING);
+
+  if(!NIL_P(v_keytab))
+    Check_Type(v_keytab, T_STRING);
+
+  if(!NIL_P(v_service))
+    Check_Type(v_service, T_STRING);
+
+  v_session = rkrb5_init_creds_allocate(cKrb5InitCreds);
+  Data_Get_Struct(v_session, RUBY_KRB5_INIT_CREDS, ptr);
+
+  rkrb5_parse_init_opts(v_opts, &ptr->opts);
+
+  if(!NIL_P(v_service))
+    ptr->service = strdup(StringValueCStr(v_service));
+
+  kerror = krb5_init_context(&ptr->ctx);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_init_context: %s", error_message(kerror));
+
+  if(NIL_P(v_principal)){
+    kerror = krb5_sname_to_principal(ptr->ctx, NULL, ptr->service, KRB5_NT_SRV_HST, &ptr->principal);
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "krb5_sname_to_principal: %s", error_message(kerror));
+  }
+  else{
+    kerror = krb5_parse_name(ptr->ctx, StringValueCStr(v_principal), &ptr->principal);
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "krb5_parse_name: %s", error_message(kerror));
+  }
+
+  if(NIL_P(v_keytab))
+    kerror = krb5_kt_default(ptr->ctx, &ptr->keytab);
+  else
+    kerror = krb5_kt_resolve(ptr->ctx, StringValueCStr(v_keytab), &ptr->keytab);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_kt_resolve: %s", error_message(kerror));
+
+  kerror = krb5_get_init_creds_opt_alloc(ptr->ctx, &ptr->opt);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_get_init_creds_opt_alloc: %s", error_message(kerror));
+
+  // The options are never modified after this, so they may be shared by
+  // concurrent acquire calls. Caches are written to explicitly instead of
+  // through krb5_get_init_creds_opt_set_out_ccache for the same reason.
+  rkrb5_apply_init_opts(&ptr->opts, ptr->opt);
+
+  return v_session;
+}
+
+/*
+ * Gets a TGT, storing it in the named cache if there is one. A
+ * krb5_context may not be used by two threads at once, so each call brings
+ * its own. The principal, keytab and options are shared read-only.
+ */
+static void* rkrb5_init_creds_acquire_nogvl(void* arg){
+  RKRB5_ACQUIRE* a = arg;
+  RUBY_KRB5_INIT_CREDS* ptr = a->ptr;
+  krb5_ccache ccache;
+
+  if(!a->ctx){
+    a->func = "krb5_init_context";
+
+    if((a->kerror = krb5_init_context(&a->ctx)))
+      return NULL;
+  }
+
+  a->func = "krb5_get_init_creds_keytab";
+
+  a->kerror = krb5_get_init_creds_keytab(
+    a->ctx,
+    &a->creds,
+    ptr->principal,
+    ptr->keytab,
+    0,
+    ptr->service,
+    ptr->opt
+  );
+
+  if(a->kerror || !a->ccache_name)
+    return NULL;
+
+  a->func = "krb5_cc_resolve";
+
+  if((a->kerror = krb5_cc_resolve(a->ctx, a->ccache_name, &ccache)))
+    return NULL;
+
+  a->func = "krb5_cc_initialize";
+  a->kerror = krb5_cc_initialize(a->ctx, ccache, a->creds.client);
+
+  if(!a->kerror){
+    a->func = "krb5_cc_store_cred";
+    a->kerror = krb5_cc_store_cred(a->ctx, ccache, &a->creds);
+  }
+
+  krb5_cc_close(a->ctx, ccache);
+
+  return NULL;
+}
+
+// Returns the context used by an acquire call to the session's idle list.
+static VALUE rkrb5_init_creds_release(VALUE v_arg){
+  RKRB5_ACQUIRE* a = (RKRB5_ACQUIRE*)v_arg;
+  RUBY_KRB5_INIT_CREDS* ptr = a->ptr;
+  krb5_context* idle;
+
+  if(a->ctx)
+    krb5_free_cred_contents(a->ctx, &a->creds);
+
+  pthread_mutex_lock(&ptr->lock);
+
+  ptr->busy--;
+
+  if(a->ctx && ptr->idle_count == ptr->idle_capacity){
+    idle = realloc(ptr->idle, sizeof(krb5_context) * (ptr->idle_capacity + 4));
+
+    if(idle){
+      ptr->idle = idle;
+      ptr->idle_capacity += 4;
+    }
+  }
+
+  if(a->ctx && ptr->idle_count < ptr->idle_capacity){
+    ptr->idle[ptr->idle_count++] = a->ctx;
+    a->ctx = NULL;
+  }
+
+  pthread_mutex_unlock(&ptr->lock);
+
+  if(a->ctx)
+    krb5_free_context(a->ctx);
+
+  free(a->ccache_name);
+
+  return Qnil;
+}
+
+static VALUE rkrb5_init_creds_acquire_call(VALUE v_arg){
+  RKRB5_ACQUIRE* a = (RKRB5_ACQUIRE*)v_arg;
+
+  rb_thread_call_without_gvl(rkrb5_init_creds_acquire_nogvl, a, RUBY_UBF_IO, NULL);
+
+  if(a->kerror)
+    rb_raise(cKrb5Exception, "%s: %s", a->func, error_message(a->kerror));
+
+  return rkrb5_creds_new(a->ctx, &a->creds);
+}
+
+/*
+ * call-seq:
+ *   session.acquire(ccache = nil)
+ *
+ * Gets a new TGT for the session's principal from its keytab and returns it
+ * as a Kerberos::Krb5::Credentials object. If +ccache+, a CredentialsCache
+ * object or cache name, is given then the cache is initialized and the TGT
+ * stored in it.
+ *
+ * The principal, keytab and options are only set up once, when the session
+ * is created, and the GVL is released while talking to the KDC. This method
+ * may be called from several threads at once.
+ */
+static VALUE rkrb5_init_creds_acquire(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5_INIT_CREDS* ptr;
+  RKRB5_ACQUIRE a;
+  VALUE v_ccache;
+
+  Data_Get_Struct(self, RUBY_KRB5_INIT_CREDS, ptr);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  rb_scan_args(argc, argv, "01", &v_ccache);
+
+  if(rb_obj_is_kind_of(v_ccache, cKrb5CCache))
+    v_ccache = rb_funcall(v_ccache, rb_intern("name"), 0);
+
+  if(!NIL_P(v_ccache))
+    Check_Type(v_ccache, T_STRING);
+
+  memset(&a, 0, sizeof(a));
+  a.ptr = ptr;
+
+  if(!NIL_P(v_ccache))
+    a.ccache_name = strdup(StringValueCStr(v_ccache));
+
+  pthread_mutex_lock(&ptr->lock);
+
+  if(ptr->idle_count > 0)
+    a.ctx = ptr->idle[--ptr->idle_count];
+
+  ptr->busy++;
+
+  pthread_mutex_unlock(&ptr->lock);
+
+  return rb_ensure(rkrb5_init_creds_acquire_call, (VALUE)&a, rkrb5_init_creds_release, (VALUE)&a);
+}
+
+/*
+ * call-seq:
+ *   session.principal
+ *
+ * Returns the name of the principal that credentials are acquired for.
+ */
+static VALUE rkrb5_init_creds_principal(VALUE self){
+  RUBY_KRB5_INIT_CREDS* ptr;
+  krb5_error_code kerror;
+  char* name;
+  VALUE v_name;
+
+  Data_Get_Struct(self, RUBY_KRB5_INIT_CREDS, ptr);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  kerror = krb5_unparse_name(ptr->ctx, ptr->principal, &name);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_unparse_name: %s", error_message(kerror));
+
+  v_name = rb_str_new2(name);
+  krb5_free_unparsed_name(ptr->ctx, name);
+
+  return v_name;
+}
+
+/*
+ * call-seq:
+ *   session.close
+ *
+ * Closes the session, freeing its principal, keytab handle, options and
+ * contexts. Raises an error if an acquire call is still in progress.
+ */
+static VALUE rkrb5_init_creds_close(VALUE self){
+  RUBY_KRB5_INIT_CREDS* ptr;
+  int i, busy;
+
+  Data_Get_Struct(self, RUBY_KRB5_INIT_CREDS, ptr);
+
+  pthread_mutex_lock(&ptr->lock);
+  busy = ptr->busy;
+  pthread_mutex_unlock(&ptr->lock);
+
+  if(busy)
+    rb_raise(cKrb5Exception, "session is in use by another thread");
+
+  if(!ptr->ctx)
+    return Qtrue;
+
+  krb5_get_init_creds_opt_free(ptr->ctx, ptr->opt);
+  krb5_kt_close(ptr->ctx, ptr->keytab);
+  krb5_free_principal(ptr->ctx, ptr->principal);
+  krb5_free_context(ptr->ctx);
+
+  for(i = 0; i < ptr->idle_count; i++)
+    krb5_free_context(ptr->idle[i]);
+
+  ptr->opt = NULL;
+  ptr->keytab = NULL;
+  ptr->principal = NULL;
+  ptr->ctx = NULL;
+  ptr->idle_count = 0;
+
+  return Qtrue;
+}
+
+void Init_init_creds(){
+  /* The Kerberos::Krb5::InitCredsSession class holds everything needed to get a TGT from a keytab, ready for repeated use. */
+  cKrb5InitCreds = rb_define_class_under(cKrb5, "InitCredsSession", rb_cObject);
+
+  // Sessions are created by Krb5#prepare_init_creds
+  rb_undef_alloc_func(cKrb5InitCreds);
+
+  // Instance Methods
+  rb_define_method(cKrb5InitCreds, "acquire", rkrb5_init_creds_acquire, -1);
+  rb_define_method(cKrb5InitCreds, "close", rkrb5_init_creds_close, 0);
+  rb_define_method(cKrb5InitCreds, "principal", rkrb5_init_creds_principal, 0);
+}
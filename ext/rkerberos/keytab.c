@@ -2,6 +2,10 @@
 
 VALUE cKrb5Keytab, cKrb5KeytabException;
 
+// Source of unique names for the MEMORY keytabs made by rkrb5_kt_memory_name.
+static pthread_mutex_t kt_memory_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long kt_memory_serial = 0;
+
 // Free function for the Kerberos::Krb5::Keytab class.
 static void rkrb5_keytab_free(RUBY_KRB5_KEYTAB* ptr){
   if(!ptr)
@@ -54,12 +58,7 @@ static VALUE rkrb5_keytab_each(VALUE self){
   while((kerror = krb5_kt_next_entry(ptr->ctx, ptr->keytab, &entry, &cursor)) == 0){
     krb5_unparse_name(ptr->ctx, entry.principal, &principal);
 
-    v_kt_entry = rb_class_new_instance(0, NULL, cKrb5KtEntry);
-
-    rb_iv_set(v_kt_entry, "@principal", rb_str_new2(principal));
-    rb_iv_set(v_kt_entry, "@timestamp", rb_time_new(entry.timestamp, 0));
-    rb_iv_set(v_kt_entry, "@vno", INT2FIX(entry.vno));
-    rb_iv_set(v_kt_entry, "@key", INT2FIX(entry.key.enctype));
+    v_kt_entry = rkrb5_kt_entry_new(principal, &entry);
 
     rb_yield(v_kt_entry);
 
@@ -225,6 +224,24 @@ static VALUE rkrb5_keytab_add_entry(int argc, VALUE* argv, VALUE self){
 }
 */
 
+// Arguments for the rb_ensure in Keytab#get_entry.
+typedef struct {
+  krb5_context ctx;
+  const char* name;
+  krb5_keytab_entry entry;
+} RKRB5_KT_GET_ENTRY;
+
+static VALUE rkrb5_keytab_get_entry_new(VALUE v_arg){
+  RKRB5_KT_GET_ENTRY* g = (RKRB5_KT_GET_ENTRY*)v_arg;
+  return rkrb5_kt_entry_new(g->name, &g->entry);
+}
+
+static VALUE rkrb5_keytab_get_entry_free(VALUE v_arg){
+  RKRB5_KT_GET_ENTRY* g = (RKRB5_KT_GET_ENTRY*)v_arg;
+  krb5_kt_free_entry(g->ctx, &g->entry);
+  return Qnil;
+}
+
 /*
  * call-seq:
  *   keytab.get_entry(principal, vno = 0, encoding_type = nil)
@@ -243,9 +260,9 @@ static VALUE rkrb5_keytab_get_entry(int argc, VALUE* argv, VALUE self){
   krb5_principal principal;
   krb5_kvno vno;
   krb5_enctype enctype;
-  krb5_keytab_entry entry;
+  RKRB5_KT_GET_ENTRY g;
   char* name;
-  VALUE v_principal, v_vno, v_enctype, v_entry;
+  VALUE v_principal, v_vno, v_enctype;
 
   Data_Get_Struct(self, RUBY_KRB5_KEYTAB, ptr); 
 
@@ -268,22 +285,891 @@ static VALUE rkrb5_keytab_get_entry(int argc, VALUE* argv, VALUE self){
     principal,
     vno,
     enctype,
-    &entry
+    &g.entry
   );
 
+  krb5_free_principal(ptr->ctx, principal);
+
   if(kerror)
     rb_raise(cKrb5Exception, "krb5_kt_get_entry: %s", error_message(kerror));
 
-  v_entry = rb_class_new_instance(0, NULL, cKrb5KtEntry);
+  // The entry is freed even if building the Ruby object raises.
+  g.ctx = ptr->ctx;
+  g.name = name;
+
+  return rb_ensure(rkrb5_keytab_get_entry_new, (VALUE)&g, rkrb5_keytab_get_entry_free, (VALUE)&g);
+}
+
+// A keytab entry paired with its unparsed principal name, used by Keytab#diff.
+typedef struct {
+  char* principal;
+  krb5_keytab_entry entry;
+} RKRB5_KT_ITEM;
+
+// A sorted snapshot of every entry in a keytab, used by Keytab#diff.
+typedef struct {
+  krb5_context ctx;
+  RKRB5_KT_ITEM* items;
+  long count;
+  long capacity;
+} RKRB5_KT_SET;
+
+typedef struct {
+  RKRB5_KT_SET mine;
+  RKRB5_KT_SET theirs;
+} RKRB5_KT_DIFF;
+
+// Sort by principal and enctype, with the highest kvno first.
+static int rkrb5_kt_item_cmp(const void* a, const void* b){
+  const RKRB5_KT_ITEM* x = a;
+  const RKRB5_KT_ITEM* y = b;
+  int rv = strcmp(x->principal, y->principal);
+
+  if(rv)
+    return rv;
+
+  if(x->entry.key.enctype != y->entry.key.enctype)
+    return x->entry.key.enctype < y->entry.key.enctype ? -1 : 1;
+
+  if(x->entry.vno != y->entry.vno)
+    return x->entry.vno > y->entry.vno ? -1 : 1;
+
+  return 0;
+}
+
+static void rkrb5_kt_set_free(RKRB5_KT_SET* set){
+  long i;
+
+  for(i = 0; i < set->count; i++){
+    krb5_free_unparsed_name(set->ctx, set->items[i].principal);
+    krb5_kt_free_entry(set->ctx, &set->items[i].entry);
+  }
+
+  free(set->items);
+
+  set->items = NULL;
+  set->count = 0;
+}
+
+// Read every entry of +keytab+ into +set+ and sort it. On failure the name
+// of the failing function is stored in +func+.
+static krb5_error_code rkrb5_kt_set_load(krb5_context ctx, krb5_keytab keytab, RKRB5_KT_SET* set, const char** func){
+  krb5_error_code kerror;
+  krb5_kt_cursor cursor;
+  krb5_keytab_entry entry;
+
+  set->ctx = ctx;
+
+  *func = "krb5_kt_start_seq_get";
+  kerror = krb5_kt_start_seq_get(ctx, keytab, &cursor);
+
+  if(kerror)
+    return kerror;
+
+  while((kerror = krb5_kt_next_entry(ctx, keytab, &entry, &cursor)) == 0){
+    RKRB5_KT_ITEM* item;
+
+    if(set->count == set->capacity){
+      long capacity = set->capacity ? set->capacity * 2 : 16;
+      RKRB5_KT_ITEM* items = realloc(set->items, capacity * sizeof(RKRB5_KT_ITEM));
+
+      if(!items){
+        krb5_kt_free_entry(ctx, &entry);
+        kerror = ENOMEM;
+        *func = "realloc";
+        break;
+      }
+
+      set->items = items;
+      set->capacity = capacity;
+    }
+
+    item = &set->items[set->count];
+    item->entry = entry;
+
+    kerror = krb5_unparse_name(ctx, entry.principal, &item->principal);
+
+    if(kerror){
+      krb5_kt_free_entry(ctx, &entry);
+      *func = "krb5_unparse_name";
+      break;
+    }
+
+    set->count++;
+  }
+
+  krb5_kt_end_seq_get(ctx, keytab, &cursor);
+
+  if(kerror && kerror != KRB5_KT_END)
+    return kerror;
+
+  qsort(set->items, set->count, sizeof(RKRB5_KT_ITEM), rkrb5_kt_item_cmp);
+
+  return 0;
+}
+
+// Returns the index of the next item that is not an older kvno of +i+.
+static long rkrb5_kt_set_next(RKRB5_KT_SET* set, long i){
+  long j = i + 1;
+
+  while(j < set->count &&
+    set->items[j].entry.key.enctype == set->items[i].entry.key.enctype &&
+    strcmp(set->items[j].principal, set->items[i].principal) == 0
+  ){
+    j++;
+  }
+
+  return j;
+}
+
+static VALUE rkrb5_kt_diff_walk(VALUE v_arg){
+  RKRB5_KT_DIFF* diff = (RKRB5_KT_DIFF*)v_arg;
+  RKRB5_KT_SET* mine = &diff->mine;
+  RKRB5_KT_SET* theirs = &diff->theirs;
+  VALUE v_added = rb_ary_new();
+  VALUE v_removed = rb_ary_new();
+  VALUE v_changed = rb_ary_new();
+  VALUE v_result = rb_hash_new();
+  long i = 0, j = 0;
+
+  while(i < mine->count || j < theirs->count){
+    RKRB5_KT_ITEM* a = i < mine->count ? &mine->items[i] : NULL;
+    RKRB5_KT_ITEM* b = j < theirs->count ? &theirs->items[j] : NULL;
+    int rv;
+
+    if(!a)
+      rv = 1;
+    else if(!b)
+      rv = -1;
+    else if((rv = strcmp(a->principal, b->principal)) == 0)
+      rv = a->entry.key.enctype == b->entry.key.enctype ? 0 :
+        (a->entry.key.enctype < b->entry.key.enctype ? -1 : 1);
+
+    if(rv < 0){
+      rb_ary_push(v_removed, rkrb5_kt_entry_new(a->principal, &a->entry));
+      i = rkrb5_kt_set_next(mine, i);
+    }
+    else if(rv > 0){
+      rb_ary_push(v_added, rkrb5_kt_entry_new(b->principal, &b->entry));
+      j = rkrb5_kt_set_next(theirs, j);
+    }
+    else{
+      if(a->entry.vno != b->entry.vno ||
+        a->entry.key.length != b->entry.key.length ||
+        memcmp(a->entry.key.contents, b->entry.key.contents, a->entry.key.length)
+      ){
+        rb_ary_push(v_changed, rb_assoc_new(
+          rkrb5_kt_entry_new(a->principal, &a->entry),
+          rkrb5_kt_entry_new(b->principal, &b->entry)
+        ));
+      }
+
+      i = rkrb5_kt_set_next(mine, i);
+      j = rkrb5_kt_set_next(theirs, j);
+    }
+  }
+
+  rb_hash_aset(v_result, ID2SYM(rb_intern("added")), v_added);
+  rb_hash_aset(v_result, ID2SYM(rb_intern("removed")), v_removed);
+  rb_hash_aset(v_result, ID2SYM(rb_intern("changed")), v_changed);
+
+  return v_result;
+}
+
+static VALUE rkrb5_kt_diff_cleanup(VALUE v_arg){
+  RKRB5_KT_DIFF* diff = (RKRB5_KT_DIFF*)v_arg;
+  rkrb5_kt_set_free(&diff->mine);
+  rkrb5_kt_set_free(&diff->theirs);
+  return Qnil;
+}
+
+/*
+ * call-seq:
+ *   keytab.diff(other_keytab)
+ *
+ * Compares the current keys of this keytab against +other_keytab+ and
+ * returns a hash with three keys:
+ *
+ *   :added   => entries found only in +other_keytab+
+ *   :removed => entries found only in this keytab
+ *   :changed => [ours, theirs] pairs of entries whose kvno or key differ
+ *
+ * Entries are matched by principal and encryption type. Where a keytab holds
+ * several versions of the same key only the highest kvno is compared.
+ *
+ * Example:
+ *
+ *   expected = Kerberos::Krb5::Keytab.new('FILE:/srv/expected.keytab')
+ *   Kerberos::Krb5::Keytab.new.diff(expected)[:changed].each{ |ours, theirs|
+ *     puts "#{ours.principal}: kvno #{ours.vno} != #{theirs.vno}"
+ *   }
+ */
+static VALUE rkrb5_keytab_diff(VALUE self, VALUE v_other){
+  RUBY_KRB5_KEYTAB* ptr;
+  RUBY_KRB5_KEYTAB* optr;
+  RKRB5_KT_DIFF diff;
+  krb5_error_code kerror;
+  const char* func;
+
+  if(!rb_obj_is_kind_of(v_other, cKrb5Keytab))
+    rb_raise(rb_eTypeError, "argument must be a Kerberos::Krb5::Keytab");
+
+  Data_Get_Struct(self, RUBY_KRB5_KEYTAB, ptr);
+  Data_Get_Struct(v_other, RUBY_KRB5_KEYTAB, optr);
+
+  if(!ptr->ctx || !optr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  memset(&diff, 0, sizeof(diff));
+
+  kerror = rkrb5_kt_set_load(ptr->ctx, ptr->keytab, &diff.mine, &func);
+
+  if(!kerror)
+    kerror = rkrb5_kt_set_load(optr->ctx, optr->keytab, &diff.theirs, &func);
+
+  if(kerror){
+    rkrb5_kt_diff_cleanup((VALUE)&diff);
+    rb_raise(cKrb5Exception, "%s: %s", func, error_message(kerror));
+  }
+
+  return rb_ensure(rkrb5_kt_diff_walk, (VALUE)&diff, rkrb5_kt_diff_cleanup, (VALUE)&diff);
+}
+
+// State shared by the worker threads of Keytab#verify.
+typedef struct {
+  RKRB5_KT_SET set;
+  char keytab_name[MAX_KEYTAB_NAME_LEN];
+  char* service;
+  char** principals;
+  long count;
+  int concurrency;
+  krb5_error_code* errors;
+  char** messages;
+  double* latency;
+} RKRB5_KT_VERIFY;
+
+// Per thread state for Keytab#verify. Contexts may not be shared between
+// threads, so each worker resolves the keytab in a context of its own.
+typedef struct {
+  krb5_context ctx;
+  krb5_keytab keytab;
+  krb5_error_code kerror;
+} RKRB5_KT_VERIFY_WORKER;
+
+static void* rkrb5_kt_verify_setup(void* data){
+  RKRB5_KT_VERIFY* verify = data;
+  RKRB5_KT_VERIFY_WORKER* worker = calloc(1, sizeof(RKRB5_KT_VERIFY_WORKER));
+
+  if(!worker)
+    return NULL;
+
+  worker->kerror = krb5_init_context(&worker->ctx);
+
+  if(!worker->kerror)
+    worker->kerror = krb5_kt_resolve(worker->ctx, verify->keytab_name, &worker->keytab);
+
+  return worker;
+}
+
+static void rkrb5_kt_verify_run(void* data, void* state, long i){
+  RKRB5_KT_VERIFY* verify = data;
+  RKRB5_KT_VERIFY_WORKER* worker = state;
+  krb5_error_code kerror;
+  krb5_principal princ;
+  krb5_creds creds;
+  struct timespec start, finish;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if(!worker){
+    kerror = ENOMEM;
+  }
+  else if(worker->kerror){
+    kerror = worker->kerror;
+  }
+  else{
+    kerror = krb5_parse_name(worker->ctx, verify->principals[i], &princ);
+
+    if(!kerror){
+      kerror = krb5_get_init_creds_keytab(
+        worker->ctx,
+        &creds,
+        princ,
+        worker->keytab,
+        0,
+        verify->service,
+        NULL
+      );
+
+      if(!kerror)
+        krb5_free_cred_contents(worker->ctx, &creds);
+
+      krb5_free_principal(worker->ctx, princ);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  verify->latency[i] = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) / 1e9;
+  verify->errors[i] = kerror;
+
+  if(kerror && worker && worker->ctx){
+    const char* msg = krb5_get_error_message(worker->ctx, kerror);
+    verify->messages[i] = strdup(msg);
+    krb5_free_error_message(worker->ctx, msg);
+  }
+}
+
+static void rkrb5_kt_verify_teardown(void* data, void* state){
+  RKRB5_KT_VERIFY_WORKER* worker = state;
+
+  if(!worker)
+    return;
+
+  if(worker->keytab)
+    krb5_kt_close(worker->ctx, worker->keytab);
+
+  if(worker->ctx)
+    krb5_free_context(worker->ctx);
+
+  free(worker);
+}
+
+static VALUE rkrb5_kt_verify_cleanup(VALUE v_arg){
+  RKRB5_KT_VERIFY* verify = (RKRB5_KT_VERIFY*)v_arg;
+  long i;
+
+  if(verify->messages){
+    for(i = 0; i < verify->count; i++)
+      free(verify->messages[i]);
+  }
+
+  free(verify->messages);
+  free(verify->errors);
+  free(verify->latency);
+  free(verify->principals);
+
+  rkrb5_kt_set_free(&verify->set);
+
+  return Qnil;
+}
+
+static VALUE rkrb5_kt_verify_results(VALUE v_arg){
+  RKRB5_KT_VERIFY* verify = (RKRB5_KT_VERIFY*)v_arg;
+  RKRB5_POOL_JOB job;
+  VALUE v_result, v_info;
+  long i, started;
+
+  job.count = verify->count;
+  job.concurrency = verify->concurrency;
+  job.data = verify;
+  job.setup = rkrb5_kt_verify_setup;
+  job.run = rkrb5_kt_verify_run;
+  job.teardown = rkrb5_kt_verify_teardown;
+
+  started = rkrb5_pool_run(&job);
+
+  // Raise if we were interrupted before every principal was tried.
+  if(started < verify->count)
+    rb_thread_check_ints();
+
+  v_result = rb_hash_new();
+
+  for(i = 0; i < started; i++){
+    v_info = rb_hash_new();
+
+    rb_hash_aset(v_info, ID2SYM(rb_intern("success")), verify->errors[i] ? Qfalse : Qtrue);
+    rb_hash_aset(v_info, ID2SYM(rb_intern("latency")), rb_float_new(verify->latency[i]));
+
+    if(verify->errors[i]){
+      const char* msg = verify->messages[i] ? verify->messages[i] : error_message(verify->errors[i]);
+      rb_hash_aset(v_info, ID2SYM(rb_intern("error")), rb_str_new2(msg));
+    }
+    else{
+      rb_hash_aset(v_info, ID2SYM(rb_intern("error")), Qnil);
+    }
+
+    rb_hash_aset(v_result, rb_str_new2(verify->principals[i]), v_info);
+  }
+
+  return v_result;
+}
+
+/*
+ * call-seq:
+ *   keytab.verify(:concurrency => 4, :service => nil)
+ *
+ * Confirms that the keytab actually works by requesting initial credentials
+ * from the KDC for each distinct principal it contains. Up to +concurrency+
+ * exchanges are run at a time on native threads, without holding the GVL.
+ *
+ * Returns a hash keyed on principal name. Each value is a hash containing
+ * :success (true or false), :latency (in seconds) and :error (the Kerberos
+ * error message, or nil).
+ *
+ * The credentials obtained are discarded. If a +service+ is given it is
+ * requested instead of the ticket granting service.
+ *
+ * Example:
+ *
+ *   keytab = Kerberos::Krb5::Keytab.new('FILE:/etc/krb5.keytab')
+ *   keytab.verify(:concurrency => 8).each{ |principal, info|
+ *     puts "#{principal}: #{info[:error]}" unless info[:success]
+ *   }
+ */
+static VALUE rkrb5_keytab_verify(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5_KEYTAB* ptr;
+  RKRB5_KT_VERIFY verify;
+  krb5_error_code kerror;
+  const char* func;
+  VALUE v_opts, v_concurrency, v_service;
+  long i;
+
+  Data_Get_Struct(self, RUBY_KRB5_KEYTAB, ptr);
+
+  rb_scan_args(argc, argv, "01", &v_opts);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  memset(&verify, 0, sizeof(verify));
+  verify.concurrency = 4;
+
+  if(!NIL_P(v_opts)){
+    Check_Type(v_opts, T_HASH);
+
+    v_concurrency = rb_hash_aref2(v_opts, "concurrency");
+
+    if(!NIL_P(v_concurrency)){
+      verify.concurrency = NUM2INT(v_concurrency);
+
+      if(verify.concurrency < 1)
+        rb_raise(rb_eArgError, "concurrency must be a positive number");
+    }
+
+    v_service = rb_hash_aref2(v_opts, "service");
+
+    if(!NIL_P(v_service)){
+      Check_Type(v_service, T_STRING);
+      verify.service = StringValueCStr(v_service);
+    }
+  }
+
+  kerror = krb5_kt_get_name(ptr->ctx, ptr->keytab, verify.keytab_name, MAX_KEYTAB_NAME_LEN);
 
-  rb_iv_set(v_entry, "@principal", rb_str_new2(name));
-  rb_iv_set(v_entry, "@timestamp", rb_time_new(entry.timestamp, 0));
-  rb_iv_set(v_entry, "@vno", INT2FIX(entry.vno));
-  rb_iv_set(v_entry, "@key", INT2FIX(entry.key.enctype));
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_kt_get_name: %s", error_message(kerror));
+
+  kerror = rkrb5_kt_set_load(ptr->ctx, ptr->keytab, &verify.set, &func);
+
+  if(kerror){
+    rkrb5_kt_set_free(&verify.set);
+    rb_raise(cKrb5Exception, "%s: %s", func, error_message(kerror));
+  }
 
-  krb5_kt_free_entry(ptr->ctx, &entry);
+  // The set is sorted by principal, so duplicates are adjacent.
+  verify.principals = malloc(sizeof(char*) * (verify.set.count + 1));
+  verify.errors = calloc(verify.set.count + 1, sizeof(krb5_error_code));
+  verify.messages = calloc(verify.set.count + 1, sizeof(char*));
+  verify.latency = calloc(verify.set.count + 1, sizeof(double));
 
-  return v_entry;
+  if(!verify.principals || !verify.errors || !verify.messages || !verify.latency){
+    rkrb5_kt_verify_cleanup((VALUE)&verify);
+    rb_raise(rb_eNoMemError, "failed to allocate memory");
+  }
+
+  for(i = 0; i < verify.set.count; i++){
+    char* name = verify.set.items[i].principal;
+
+    if(verify.count == 0 || strcmp(verify.principals[verify.count - 1], name))
+      verify.principals[verify.count++] = name;
+  }
+
+  if(verify.count == 0){
+    rkrb5_kt_verify_cleanup((VALUE)&verify);
+    return rb_hash_new();
+  }
+
+  return rb_ensure(rkrb5_kt_verify_results, (VALUE)&verify, rkrb5_kt_verify_cleanup, (VALUE)&verify);
+}
+
+/*
+ * Writes a new MEMORY keytab name, made from +prefix+ and a process-wide
+ * serial number, into +name+. MIT keeps a MEMORY keytab for the life of
+ * the process, so a name must never be reused: a new copy would otherwise
+ * be appended to the keys of a dead one.
+ */
+void rkrb5_kt_memory_name(char* name, size_t size, const char* prefix){
+  unsigned long serial;
+
+  pthread_mutex_lock(&kt_memory_lock);
+  serial = kt_memory_serial++;
+  pthread_mutex_unlock(&kt_memory_lock);
+
+  snprintf(name, size, "MEMORY:%s_%lu", prefix, serial);
+}
+
+/*
+ * Removes every entry from the MEMORY keytab +copy+. Call this before the
+ * last handle to a copy is closed, since MIT never frees a MEMORY keytab
+ * and its keys would otherwise stay in the process. A cursor can't be
+ * held across a removal, so each pass removes the first entry.
+ */
+void rkrb5_kt_clear_memory(krb5_context ctx, krb5_keytab copy){
+  krb5_kt_cursor cursor;
+  krb5_keytab_entry entry;
+  krb5_error_code kerror;
+
+  for(;;){
+    if(krb5_kt_start_seq_get(ctx, copy, &cursor))
+      return;
+
+    kerror = krb5_kt_next_entry(ctx, copy, &entry, &cursor);
+    krb5_kt_end_seq_get(ctx, copy, &cursor);
+
+    if(kerror)
+      return;
+
+    kerror = krb5_kt_remove_entry(ctx, copy, &entry);
+    krb5_kt_free_entry(ctx, &entry);
+
+    if(kerror)
+      return;
+  }
+}
+
+/*
+ * Copies every entry in +keytab+ into a new MEMORY keytab called +name+,
+ * which should come from rkrb5_kt_memory_name, and returns it in +copy+.
+ * Servers use this to load a keytab once, so that accepting a ticket never
+ * has to read it from disk again. The MEMORY keytab may be resolved by name
+ * from any context. Empty it with rkrb5_kt_clear_memory before closing the
+ * last handle.
+ */
+krb5_error_code rkrb5_kt_load_memory(krb5_context ctx, krb5_keytab keytab, const char* name, krb5_keytab* copy, const char** func){
+  krb5_error_code kerror;
+  krb5_kt_cursor cursor;
+  krb5_keytab_entry entry;
+
+  *func = "krb5_kt_resolve";
+  kerror = krb5_kt_resolve(ctx, name, copy);
+
+  if(kerror)
+    return kerror;
+
+  *func = "krb5_kt_start_seq_get";
+  kerror = krb5_kt_start_seq_get(ctx, keytab, &cursor);
+
+  if(kerror){
+    krb5_kt_close(ctx, *copy);
+    return kerror;
+  }
+
+  *func = "krb5_kt_next_entry";
+
+  while((kerror = krb5_kt_next_entry(ctx, keytab, &entry, &cursor)) == 0){
+    kerror = krb5_kt_add_entry(ctx, *copy, &entry);
+    krb5_kt_free_entry(ctx, &entry);
+
+    if(kerror){
+      *func = "krb5_kt_add_entry";
+      break;
+    }
+  }
+
+  krb5_kt_end_seq_get(ctx, keytab, &cursor);
+
+  if(kerror == KRB5_KT_END)
+    return 0;
+
+  rkrb5_kt_clear_memory(ctx, *copy);
+  krb5_kt_close(ctx, *copy);
+
+  return kerror;
+}
+
+// Overwrite secrets in a way the compiler won't optimize away.
+static void rkrb5_kt_zap(void* buf, size_t len){
+  volatile unsigned char* p = buf;
+
+  while(len--)
+    *p++ = 0;
+}
+
+// State shared by the worker threads of Keytab#add_password_entry.
+typedef struct {
+  krb5_context ctx;
+  krb5_keytab keytab;
+  krb5_principal principal;
+  krb5_kvno kvno;
+  int concurrency;
+  krb5_data password;
+  krb5_data salt;
+  krb5_data params;
+  unsigned char iterations[4];
+  krb5_enctype* enctypes;
+  krb5_keyblock* keys;
+  krb5_error_code* errors;
+  long count;
+} RKRB5_KT_S2K;
+
+// Each worker derives keys in a context of its own.
+static void* rkrb5_kt_s2k_setup(void* data){
+  krb5_context ctx;
+
+  if(krb5_init_context(&ctx))
+    return NULL;
+
+  return ctx;
+}
+
+static void rkrb5_kt_s2k_run(void* data, void* state, long i){
+  RKRB5_KT_S2K* s2k = data;
+  krb5_context ctx = state;
+
+  if(!ctx){
+    s2k->errors[i] = ENOMEM;
+    return;
+  }
+
+  s2k->errors[i] = krb5_c_string_to_key_with_params(
+    ctx,
+    s2k->enctypes[i],
+    &s2k->password,
+    &s2k->salt,
+    s2k->params.length ? &s2k->params : NULL,
+    &s2k->keys[i]
+  );
+}
+
+static void rkrb5_kt_s2k_teardown(void* data, void* state){
+  if(state)
+    krb5_free_context((krb5_context)state);
+}
+
+static VALUE rkrb5_kt_s2k_cleanup(VALUE v_arg){
+  RKRB5_KT_S2K* s2k = (RKRB5_KT_S2K*)v_arg;
+  long i;
+
+  // Keys made in a worker's context are only memory, so any context can
+  // free them.
+  for(i = 0; s2k->keys && i < s2k->count; i++){
+    if(s2k->keys[i].contents){
+      rkrb5_kt_zap(s2k->keys[i].contents, s2k->keys[i].length);
+      krb5_free_keyblock_contents(s2k->ctx, &s2k->keys[i]);
+    }
+  }
+
+  if(s2k->password.data){
+    rkrb5_kt_zap(s2k->password.data, s2k->password.length);
+    free(s2k->password.data);
+  }
+
+  if(s2k->salt.data)
+    krb5_free_data_contents(s2k->ctx, &s2k->salt);
+
+  if(s2k->principal)
+    krb5_free_principal(s2k->ctx, s2k->principal);
+
+  free(s2k->keys);
+  free(s2k->errors);
+  free(s2k->enctypes);
+
+  return Qnil;
+}
+
+static VALUE rkrb5_kt_s2k_add(VALUE v_arg){
+  RKRB5_KT_S2K* s2k = (RKRB5_KT_S2K*)v_arg;
+  RKRB5_POOL_JOB job;
+  krb5_error_code kerror;
+  krb5_keytab_entry entry;
+  long i, started;
+
+  job.count = s2k->count;
+  job.concurrency = s2k->concurrency;
+  job.data = s2k;
+  job.setup = rkrb5_kt_s2k_setup;
+  job.run = rkrb5_kt_s2k_run;
+  job.teardown = rkrb5_kt_s2k_teardown;
+
+  started = rkrb5_pool_run(&job);
+
+  // Raise if we were interrupted before every key was derived. The pending
+  // interrupt may already have been handled elsewhere, so never fall through
+  // to writing the keys that were never made.
+  if(started < s2k->count){
+    rb_thread_check_ints();
+    rb_raise(cKrb5KeytabException, "add_password_entry: interrupted before every key was derived");
+  }
+
+  for(i = 0; i < s2k->count; i++){
+    if(s2k->errors[i])
+      rb_raise(cKrb5KeytabException, "krb5_c_string_to_key: %s", error_message(s2k->errors[i]));
+  }
+
+  // Nothing is written unless every key could be derived.
+  for(i = 0; i < s2k->count; i++){
+    memset(&entry, 0, sizeof(entry));
+    entry.principal = s2k->principal;
+    entry.timestamp = time(NULL);
+    entry.vno = s2k->kvno;
+    entry.key = s2k->keys[i];
+
+    kerror = krb5_kt_add_entry(s2k->ctx, s2k->keytab, &entry);
+
+    if(kerror)
+      rb_raise(cKrb5KeytabException, "krb5_kt_add_entry: %s", error_message(kerror));
+  }
+
+  return Qnil;
+}
+
+/*
+ * call-seq:
+ *   keytab.add_password_entry(principal, password, :enctypes => nil, :kvno => 1, :concurrency => nil, :iterations => nil)
+ *
+ * Derives a key from +password+ for each of the +enctypes+ and adds an
+ * entry for +principal+ and +kvno+ to the keytab for each of them, as
+ * ktutil's addent -password does.
+ *
+ * Enctypes may be given as numbers, such as
+ * Kerberos::Krb5::ENCTYPE_AES256_CTS_HMAC_SHA1_96, or names such as
+ * 'aes256-cts'. The default is AES256 and AES128.
+ *
+ * The +iterations+ option sets the PBKDF2 iteration count for the AES
+ * enctypes, which must match what the KDC has for the principal. The
+ * library's default is used if it's omitted.
+ *
+ * String-to-key for AES is deliberately slow, so the keys are derived in
+ * parallel on up to +concurrency+ native threads (one per enctype by
+ * default) without holding the GVL. The salt is worked out from the
+ * principal once and shared by every enctype.
+ *
+ * Example:
+ *
+ *   keytab = Kerberos::Krb5::Keytab.new('FILE:/etc/httpd.keytab')
+ *   keytab.add_password_entry('HTTP/www.example.com', 'secret', :kvno => 3)
+ */
+static VALUE rkrb5_keytab_add_password_entry(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5_KEYTAB* ptr;
+  RKRB5_KT_S2K s2k;
+  krb5_error_code kerror;
+  VALUE v_principal, v_password, v_opts;
+  VALUE v_enctypes = Qnil, v_kvno = Qnil, v_concurrency = Qnil, v_iterations = Qnil;
+  char* name;
+  long i;
+
+  Data_Get_Struct(self, RUBY_KRB5_KEYTAB, ptr);
+
+  rb_scan_args(argc, argv, "21", &v_principal, &v_password, &v_opts);
+
+  Check_Type(v_principal, T_STRING);
+  Check_Type(v_password, T_STRING);
+
+  name = StringValueCStr(v_principal);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  if(!NIL_P(v_opts)){
+    Check_Type(v_opts, T_HASH);
+    v_enctypes = rb_hash_aref2(v_opts, "enctypes");
+    v_kvno = rb_hash_aref2(v_opts, "kvno");
+    v_concurrency = rb_hash_aref2(v_opts, "concurrency");
+    v_iterations = rb_hash_aref2(v_opts, "iterations");
+  }
+
+  if(NIL_P(v_enctypes)){
+    v_enctypes = rb_ary_new3(
+      2,
+      INT2FIX(ENCTYPE_AES256_CTS_HMAC_SHA1_96),
+      INT2FIX(ENCTYPE_AES128_CTS_HMAC_SHA1_96)
+    );
+  }
+
+  Check_Type(v_enctypes, T_ARRAY);
+
+  if(RARRAY_LEN(v_enctypes) == 0)
+    rb_raise(rb_eArgError, "at least one enctype is required");
+
+  memset(&s2k, 0, sizeof(s2k));
+
+  s2k.ctx = ptr->ctx;
+  s2k.keytab = ptr->keytab;
+  s2k.kvno = NIL_P(v_kvno) ? 1 : NUM2UINT(v_kvno);
+  s2k.count = RARRAY_LEN(v_enctypes);
+  s2k.concurrency = NIL_P(v_concurrency) ? (int)s2k.count : NUM2INT(v_concurrency);
+
+  if(s2k.concurrency < 1)
+    rb_raise(rb_eArgError, "concurrency must be a positive number");
+
+  // RFC 3962 s2kparams are the iteration count as a big-endian 32-bit number.
+  if(!NIL_P(v_iterations)){
+    unsigned long iterations = NUM2ULONG(v_iterations);
+
+    if(iterations < 1 || iterations > 0xFFFFFFFFUL)
+      rb_raise(rb_eArgError, "iterations must be a positive 32-bit number");
+
+    s2k.iterations[0] = (iterations >> 24) & 0xFF;
+    s2k.iterations[1] = (iterations >> 16) & 0xFF;
+    s2k.iterations[2] = (iterations >> 8) & 0xFF;
+    s2k.iterations[3] = iterations & 0xFF;
+    s2k.params.data = (char*)s2k.iterations;
+    s2k.params.length = sizeof(s2k.iterations);
+  }
+
+  s2k.enctypes = malloc(s2k.count * sizeof(krb5_enctype));
+
+  if(!s2k.enctypes)
+    rb_raise(rb_eNoMemError, "failed to allocate memory");
+
+  for(i = 0; i < s2k.count; i++){
+    VALUE v_enctype = RARRAY_AREF(v_enctypes, i);
+
+    if(RB_TYPE_P(v_enctype, T_STRING)){
+      kerror = krb5_string_to_enctype(StringValueCStr(v_enctype), &s2k.enctypes[i]);
+
+      if(kerror){
+        free(s2k.enctypes);
+        rb_raise(rb_eArgError, "unknown enctype: %s", StringValueCStr(v_enctype));
+      }
+    }
+    else if(FIXNUM_P(v_enctype)){
+      s2k.enctypes[i] = FIX2INT(v_enctype);
+    }
+    else{
+      free(s2k.enctypes);
+      rb_raise(rb_eTypeError, "enctypes must be integers or strings");
+    }
+  }
+
+  s2k.keys = calloc(s2k.count, sizeof(krb5_keyblock));
+  s2k.errors = calloc(s2k.count, sizeof(krb5_error_code));
+  s2k.password.length = RSTRING_LEN(v_password);
+  s2k.password.data = malloc(s2k.password.length + 1);
+
+  if(!s2k.keys || !s2k.errors || !s2k.password.data){
+    rkrb5_kt_s2k_cleanup((VALUE)&s2k);
+    rb_raise(rb_eNoMemError, "failed to allocate memory");
+  }
+
+  // Our own copy can be zeroed when we're done and can't move meanwhile.
+  memcpy(s2k.password.data, RSTRING_PTR(v_password), s2k.password.length);
+  s2k.password.data[s2k.password.length] = '\0';
+
+  kerror = krb5_parse_name(ptr->ctx, name, &s2k.principal);
+
+  if(!kerror)
+    kerror = krb5_principal2salt(ptr->ctx, s2k.principal, &s2k.salt);
+
+  if(kerror){
+    rkrb5_kt_s2k_cleanup((VALUE)&s2k);
+    rb_raise(cKrb5Exception, "%s: %s", s2k.principal ? "krb5_principal2salt" : "krb5_parse_name", error_message(kerror));
+  }
+
+  rb_ensure(rkrb5_kt_s2k_add, (VALUE)&s2k, rkrb5_kt_s2k_cleanup, (VALUE)&s2k);
+
+  return self;
 }
 
 /*
@@ -426,12 +1312,7 @@ static VALUE rkrb5_s_keytab_foreach(int argc, VALUE* argv, VALUE klass){
   while((kerror = krb5_kt_next_entry(context, keytab, &entry, &cursor)) == 0){
     krb5_unparse_name(context, entry.principal, &principal);
 
-    v_kt_entry = rb_class_new_instance(0, NULL, cKrb5KtEntry);
-
-    rb_iv_set(v_kt_entry, "@principal", rb_str_new2(principal));
-    rb_iv_set(v_kt_entry, "@timestamp", rb_time_new(entry.timestamp, 0));
-    rb_iv_set(v_kt_entry, "@vno", INT2FIX(entry.vno));
-    rb_iv_set(v_kt_entry, "@key", INT2FIX(entry.key.enctype));
+    v_kt_entry = rkrb5_kt_entry_new(principal, &entry);
 
     rb_yield(v_kt_entry);
 
@@ -486,10 +1367,13 @@ void Init_keytab(){
 
   // Instance Methods
 
+  rb_define_method(cKrb5Keytab, "add_password_entry", rkrb5_keytab_add_password_entry, -1);
   rb_define_method(cKrb5Keytab, "default_name", rkrb5_keytab_default_name, 0);
   rb_define_method(cKrb5Keytab, "close", rkrb5_keytab_close, 0);
+  rb_define_method(cKrb5Keytab, "diff", rkrb5_keytab_diff, 1);
   rb_define_method(cKrb5Keytab, "each", rkrb5_keytab_each, 0);
   rb_define_method(cKrb5Keytab, "get_entry", rkrb5_keytab_get_entry, -1);
+  rb_define_method(cKrb5Keytab, "verify", rkrb5_keytab_verify, -1);
 
   // TODO: Move these into Kadm5 and/or figure out how to set the vno properly.
   // rb_define_method(cKrb5Keytab, "add_entry", rkrb5_keytab_add_entry, -1);
@@ -2,11 +2,24 @@
 
 VALUE cKrb5KtEntry;
 
+// Overwrite key material in a way the compiler won't optimize away.
+static void rkrb5_kt_entry_zap(void* buf, size_t len){
+  volatile unsigned char* p = buf;
+
+  while(len--)
+    *p++ = 0;
+}
+
 // Free function for the Kerberos::Krb5::Keytab::Entry class.
 static void rkrb5_kt_entry_free(RUBY_KRB5_KT_ENTRY* ptr){
   if(!ptr)
     return;
 
+  if(ptr->key.contents){
+    rkrb5_kt_entry_zap(ptr->key.contents, ptr->key.length);
+    free(ptr->key.contents);
+  }
+
   free(ptr);
 }
 
@@ -30,6 +43,58 @@ static VALUE rkrb5_kt_entry_initialize(VALUE self){
   return self;
 }
 
+/*
+ * Creates a Keytab::Entry object from a keytab entry, taking a private copy
+ * of its keyblock. The +principal+ is the unparsed name of entry->principal.
+ */
+VALUE rkrb5_kt_entry_new(const char* principal, krb5_keytab_entry* entry){
+  RUBY_KRB5_KT_ENTRY* ptr;
+  VALUE v_kt_entry = rb_class_new_instance(0, NULL, cKrb5KtEntry);
+
+  Data_Get_Struct(v_kt_entry, RUBY_KRB5_KT_ENTRY, ptr);
+
+  ptr->timestamp = entry->timestamp;
+  ptr->vno = entry->vno;
+  ptr->key.enctype = entry->key.enctype;
+
+  if(entry->key.length){
+    ptr->key.contents = malloc(entry->key.length);
+
+    if(!ptr->key.contents)
+      rb_raise(rb_eNoMemError, "failed to allocate memory");
+
+    memcpy(ptr->key.contents, entry->key.contents, entry->key.length);
+    ptr->key.length = entry->key.length;
+  }
+
+  rb_iv_set(v_kt_entry, "@principal", rb_str_new2(principal));
+  rb_iv_set(v_kt_entry, "@timestamp", rb_time_new(entry->timestamp, 0));
+  rb_iv_set(v_kt_entry, "@vno", INT2FIX(entry->vno));
+  rb_iv_set(v_kt_entry, "@key", INT2FIX(entry->key.enctype));
+
+  return v_kt_entry;
+}
+
+/*
+ * call-seq:
+ *   entry.key_bytes
+ *
+ * Returns the raw key for the entry as a frozen, binary string, or nil if
+ * the entry was not read from a keytab. The string is only built when this
+ * method is called; the entry's own copy of the key is zeroed when it is
+ * garbage collected.
+ */
+static VALUE rkrb5_kt_entry_key_bytes(VALUE self){
+  RUBY_KRB5_KT_ENTRY* ptr;
+
+  Data_Get_Struct(self, RUBY_KRB5_KT_ENTRY, ptr);
+
+  if(!ptr->key.contents)
+    return Qnil;
+
+  return rb_obj_freeze(rb_str_new((char*)ptr->key.contents, ptr->key.length));
+}
+
 /*
  * A custom inspect method for nicer output.
  */
@@ -71,6 +136,7 @@ void Init_keytab_entry(){
 
   // Instance Methods
   rb_define_method(cKrb5KtEntry, "inspect", rkrb5_kt_entry_inspect, 0); 
+  rb_define_method(cKrb5KtEntry, "key_bytes", rkrb5_kt_entry_key_bytes, 0);
 
   // Accessors
   rb_define_attr(cKrb5KtEntry, "principal", 1, 1);
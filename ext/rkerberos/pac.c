@@ -0,0 +1,485 @@
+#include <rkerberos.h>
+#include <stdio.h>
+#include <ruby/encoding.h>
+
+VALUE cKrb5Pac;
+
+// FILETIME values this large mean "never".
+#define RKRB5_PAC_NEVER 0x7fffffffffffffffULL
+
+// Seconds from the FILETIME epoch, 1601, to the Unix epoch.
+#define RKRB5_PAC_EPOCH_DELTA 11644473600LL
+
+// RPC_SIDs have at most this many sub-authorities.
+#define RKRB5_PAC_MAX_SUBAUTH 15
+
+/*
+ * A cursor over an NDR encoded buffer. Reads past the end set +error+ and
+ * return zero, so a decoder need only check once when it's done.
+ */
+typedef struct {
+  const unsigned char* data;
+  size_t length;
+  size_t pos;
+  int error;
+} RKRB5_NDR;
+
+// An RPC_UNICODE_STRING, whose characters are deferred.
+typedef struct {
+  uint16_t length;
+  uint32_t ptr;
+} RKRB5_NDR_STRING;
+
+// Aligns the cursor and checks that +size+ more bytes can be read.
+static int rkrb5_ndr_need(RKRB5_NDR* ndr, size_t align, size_t size){
+  size_t pos = (ndr->pos + align - 1) & ~(align - 1);
+
+  if(ndr->error || pos > ndr->length || size > ndr->length - pos){
+    ndr->error = 1;
+    return 0;
+  }
+
+  ndr->pos = pos;
+
+  return 1;
+}
+
+static uint8_t rkrb5_ndr_u8(RKRB5_NDR* ndr){
+  if(!rkrb5_ndr_need(ndr, 1, 1))
+    return 0;
+
+  return ndr->data[ndr->pos++];
+}
+
+static uint16_t rkrb5_ndr_u16(RKRB5_NDR* ndr){
+  const unsigned char* p;
+
+  if(!rkrb5_ndr_need(ndr, 2, 2))
+    return 0;
+
+  p = ndr->data + ndr->pos;
+  ndr->pos += 2;
+
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t rkrb5_ndr_u32(RKRB5_NDR* ndr){
+  const unsigned char* p;
+
+  if(!rkrb5_ndr_need(ndr, 4, 4))
+    return 0;
+
+  p = ndr->data + ndr->pos;
+  ndr->pos += 4;
+
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void rkrb5_ndr_skip(RKRB5_NDR* ndr, size_t align, size_t size){
+  if(rkrb5_ndr_need(ndr, align, size))
+    ndr->pos += size;
+}
+
+// Reads a FILETIME and returns it as a Time, or nil if it's unset or never.
+static VALUE rkrb5_ndr_time(RKRB5_NDR* ndr){
+  uint64_t low = rkrb5_ndr_u32(ndr);
+  uint64_t ft = (uint64_t)rkrb5_ndr_u32(ndr) << 32 | low;
+
+  if(ft == 0 || ft >= RKRB5_PAC_NEVER)
+    return Qnil;
+
+  return rb_time_new((time_t)((long long)(ft / 10000000) - RKRB5_PAC_EPOCH_DELTA), (long)(ft % 10000000) / 10);
+}
+
+static void rkrb5_ndr_string_header(RKRB5_NDR* ndr, RKRB5_NDR_STRING* str){
+  str->length = rkrb5_ndr_u16(ndr);
+  rkrb5_ndr_u16(ndr);
+  str->ptr = rkrb5_ndr_u32(ndr);
+}
+
+/*
+ * Reads the deferred characters of +str+ as a frozen UTF-8 string. Invalid
+ * UTF-16, such as an unpaired surrogate, is replaced with U+FFFD.
+ */
+static VALUE rkrb5_ndr_string(RKRB5_NDR* ndr, RKRB5_NDR_STRING* str){
+  uint32_t count;
+  VALUE v_str;
+
+  if(!str->ptr)
+    return Qnil;
+
+  rkrb5_ndr_u32(ndr);
+  rkrb5_ndr_u32(ndr);
+  count = rkrb5_ndr_u32(ndr);
+
+  if(!rkrb5_ndr_need(ndr, 1, (size_t)count * 2))
+    return Qnil;
+
+  v_str = rb_enc_str_new((const char*)ndr->data + ndr->pos, (long)count * 2, rb_enc_find("UTF-16LE"));
+  ndr->pos += (size_t)count * 2;
+
+  v_str = rb_str_encode(
+    v_str,
+    rb_enc_from_encoding(rb_utf8_encoding()),
+    ECONV_INVALID_REPLACE | ECONV_UNDEF_REPLACE,
+    Qnil
+  );
+
+  return rb_obj_freeze(v_str);
+}
+
+// Reads a deferred RPC_SID and returns it in its S-1-5-... string form.
+static VALUE rkrb5_ndr_sid(RKRB5_NDR* ndr){
+  char buf[32 + RKRB5_PAC_MAX_SUBAUTH * 11];
+  uint64_t authority = 0;
+  uint32_t count;
+  uint8_t revision, subcount;
+  size_t length;
+  int i;
+
+  count = rkrb5_ndr_u32(ndr);
+  revision = rkrb5_ndr_u8(ndr);
+  subcount = rkrb5_ndr_u8(ndr);
+
+  if(ndr->error || subcount != count || subcount > RKRB5_PAC_MAX_SUBAUTH){
+    ndr->error = 1;
+    return Qnil;
+  }
+
+  // The identifier authority is big-endian.
+  for(i = 0; i < 6; i++)
+    authority = (authority << 8) | rkrb5_ndr_u8(ndr);
+
+  length = snprintf(buf, sizeof(buf), "S-%u-%llu", revision, (unsigned long long)authority);
+
+  for(i = 0; i < subcount; i++)
+    length += snprintf(buf + length, sizeof(buf) - length, "-%u", rkrb5_ndr_u32(ndr));
+
+  if(ndr->error)
+    return Qnil;
+
+  return rb_obj_freeze(rb_str_new(buf, length));
+}
+
+// Returns the frozen SID of relative id +rid+ in the domain +v_domain+.
+static VALUE rkrb5_pac_rid_sid(VALUE v_domain, uint32_t rid){
+  VALUE v_sid;
+
+  if(NIL_P(v_domain))
+    return Qnil;
+
+  v_sid = rb_str_dup(v_domain);
+  rb_str_catf(v_sid, "-%u", rid);
+
+  return rb_obj_freeze(v_sid);
+}
+
+// Reads a deferred GROUP_MEMBERSHIP array of +count+ entries into a new
+// array of relative ids stored in +v_rids+, skipping each entry's
+// attributes. The ids become SIDs later, in rkrb5_pac_sids.
+static VALUE rkrb5_ndr_groups(RKRB5_NDR* ndr, uint32_t ptr, uint32_t count, VALUE* v_rids){
+  uint32_t i;
+
+  *v_rids = rb_ary_new();
+
+  if(!ptr)
+    return *v_rids;
+
+  if(rkrb5_ndr_u32(ndr) != count)
+    ndr->error = 1;
+
+  for(i = 0; i < count && !ndr->error; i++){
+    rb_ary_push(*v_rids, UINT2NUM(rkrb5_ndr_u32(ndr)));
+    rkrb5_ndr_u32(ndr);
+  }
+
+  return *v_rids;
+}
+
+// Turns an array of relative ids into a frozen array of SIDs in +v_domain+.
+static VALUE rkrb5_pac_sids(VALUE v_domain, VALUE v_rids){
+  VALUE v_sids = rb_ary_new();
+  long i;
+
+  for(i = 0; i < RARRAY_LEN(v_rids) && !NIL_P(v_domain); i++)
+    rb_ary_push(v_sids, rkrb5_pac_rid_sid(v_domain, NUM2UINT(RARRAY_AREF(v_rids, i))));
+
+  return rb_obj_freeze(v_sids);
+}
+
+#define RKRB5_PAC_SET(key, value) rb_hash_aset(v_info, ID2SYM(rb_intern(key)), (value))
+
+/*
+ * Decodes a KERB_VALIDATION_INFO, the PAC's logon info buffer, as laid
+ * out in MS-PAC 2.5. Returns a frozen hash, or raises if it's malformed.
+ */
+static VALUE rkrb5_pac_decode_logon_info(VALUE v_buffer){
+  static const char* time_keys[] = {
+    "logon_time", "logoff_time", "kickoff_time",
+    "password_last_set", "password_can_change", "password_must_change"
+  };
+  static const char* string_keys[] = {
+    "effective_name", "full_name", "logon_script",
+    "profile_path", "home_directory", "home_directory_drive"
+  };
+  RKRB5_NDR ndr;
+  RKRB5_NDR_STRING strings[6], logon_server, logon_domain;
+  uint32_t user_id, primary_group_id, group_count, group_ptr, domain_ptr;
+  uint32_t sid_count, sids_ptr, resource_domain_ptr, resource_count, resource_ptr;
+  VALUE v_info, v_domain = Qnil, v_resource_domain = Qnil;
+  VALUE v_rids, v_resource_rids, v_extra_sids, v_extra_ptrs, v_all;
+  int i;
+
+  memset(&ndr, 0, sizeof(ndr));
+  ndr.data = (const unsigned char*)RSTRING_PTR(v_buffer);
+  ndr.length = RSTRING_LEN(v_buffer);
+
+  v_info = rb_hash_new();
+
+  // Common and private type serialization headers, then the referent id of
+  // the top level pointer. Only little-endian encodings are produced.
+  if(rkrb5_ndr_u8(&ndr) != 1 || rkrb5_ndr_u8(&ndr) != 0x10)
+    ndr.error = 1;
+
+  rkrb5_ndr_skip(&ndr, 1, 14);
+  rkrb5_ndr_u32(&ndr);
+
+  for(i = 0; i < 6; i++)
+    RKRB5_PAC_SET(time_keys[i], rkrb5_ndr_time(&ndr));
+
+  for(i = 0; i < 6; i++)
+    rkrb5_ndr_string_header(&ndr, &strings[i]);
+
+  RKRB5_PAC_SET("logon_count", UINT2NUM(rkrb5_ndr_u16(&ndr)));
+  RKRB5_PAC_SET("bad_password_count", UINT2NUM(rkrb5_ndr_u16(&ndr)));
+
+  user_id = rkrb5_ndr_u32(&ndr);
+  primary_group_id = rkrb5_ndr_u32(&ndr);
+  group_count = rkrb5_ndr_u32(&ndr);
+  group_ptr = rkrb5_ndr_u32(&ndr);
+
+  RKRB5_PAC_SET("user_id", UINT2NUM(user_id));
+  RKRB5_PAC_SET("primary_group_id", UINT2NUM(primary_group_id));
+  RKRB5_PAC_SET("user_flags", UINT2NUM(rkrb5_ndr_u32(&ndr)));
+
+  // The user session key is unused in Kerberos logons.
+  rkrb5_ndr_skip(&ndr, 1, 16);
+
+  rkrb5_ndr_string_header(&ndr, &logon_server);
+  rkrb5_ndr_string_header(&ndr, &logon_domain);
+  domain_ptr = rkrb5_ndr_u32(&ndr);
+
+  rkrb5_ndr_skip(&ndr, 4, 8);
+
+  RKRB5_PAC_SET("user_account_control", UINT2NUM(rkrb5_ndr_u32(&ndr)));
+  rkrb5_ndr_u32(&ndr);
+  RKRB5_PAC_SET("last_successful_logon", rkrb5_ndr_time(&ndr));
+  RKRB5_PAC_SET("last_failed_logon", rkrb5_ndr_time(&ndr));
+  RKRB5_PAC_SET("failed_logon_count", UINT2NUM(rkrb5_ndr_u32(&ndr)));
+  rkrb5_ndr_u32(&ndr);
+
+  sid_count = rkrb5_ndr_u32(&ndr);
+  sids_ptr = rkrb5_ndr_u32(&ndr);
+  resource_domain_ptr = rkrb5_ndr_u32(&ndr);
+  resource_count = rkrb5_ndr_u32(&ndr);
+  resource_ptr = rkrb5_ndr_u32(&ndr);
+
+  // Deferred pointer data follows in the order the pointers appeared.
+  for(i = 0; i < 6; i++)
+    RKRB5_PAC_SET(string_keys[i], rkrb5_ndr_string(&ndr, &strings[i]));
+
+  rkrb5_ndr_groups(&ndr, group_ptr, group_count, &v_rids);
+
+  RKRB5_PAC_SET("logon_server", rkrb5_ndr_string(&ndr, &logon_server));
+  RKRB5_PAC_SET("logon_domain_name", rkrb5_ndr_string(&ndr, &logon_domain));
+
+  if(domain_ptr)
+    v_domain = rkrb5_ndr_sid(&ndr);
+
+  v_extra_sids = rb_ary_new();
+  v_extra_ptrs = rb_ary_new();
+
+  if(sids_ptr){
+    if(rkrb5_ndr_u32(&ndr) != sid_count)
+      ndr.error = 1;
+
+    for(i = 0; (uint32_t)i < sid_count && !ndr.error; i++){
+      rb_ary_push(v_extra_ptrs, UINT2NUM(rkrb5_ndr_u32(&ndr)));
+      rkrb5_ndr_u32(&ndr);
+    }
+
+    for(i = 0; i < RARRAY_LEN(v_extra_ptrs) && !ndr.error; i++){
+      if(NUM2UINT(RARRAY_AREF(v_extra_ptrs, i)))
+        rb_ary_push(v_extra_sids, rkrb5_ndr_sid(&ndr));
+    }
+  }
+
+  if(resource_domain_ptr)
+    v_resource_domain = rkrb5_ndr_sid(&ndr);
+
+  rkrb5_ndr_groups(&ndr, resource_ptr, resource_count, &v_resource_rids);
+
+  if(ndr.error)
+    rb_raise(cKrb5Exception, "malformed PAC logon info buffer");
+
+  RKRB5_PAC_SET("logon_domain_sid", v_domain);
+  RKRB5_PAC_SET("user_sid", rkrb5_pac_rid_sid(v_domain, user_id));
+  RKRB5_PAC_SET("primary_group_sid", rkrb5_pac_rid_sid(v_domain, primary_group_id));
+  RKRB5_PAC_SET("resource_group_domain_sid", v_resource_domain);
+  RKRB5_PAC_SET("extra_sids", rb_obj_freeze(v_extra_sids));
+  RKRB5_PAC_SET("resource_group_sids", rkrb5_pac_sids(v_resource_domain, v_resource_rids));
+
+  // Every group the user is in, as Windows would build the access token.
+  v_all = rb_ary_dup(rkrb5_pac_sids(v_domain, v_rids));
+  rb_ary_concat(v_all, v_extra_sids);
+  rb_ary_concat(v_all, rb_hash_aref(v_info, ID2SYM(rb_intern("resource_group_sids"))));
+
+  RKRB5_PAC_SET("group_sids", rb_obj_freeze(v_all));
+
+  return rb_obj_freeze(v_info);
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5::Pac.decode_logon_info(buffer)
+ *
+ * Decodes a raw logon info (KERB_VALIDATION_INFO) buffer, such as one
+ * returned by Pac#buffer, into the same frozen hash as Pac#logon_info.
+ * Raises a Kerberos::Krb5::Exception if the buffer is truncated or
+ * malformed.
+ *
+ * The buffer is not checked for a signature, so only pass it bytes that
+ * came from a verified PAC.
+ */
+static VALUE rkrb5_pac_s_decode_logon_info(VALUE klass, VALUE v_buffer){
+  Check_Type(v_buffer, T_STRING);
+  return rkrb5_pac_decode_logon_info(rb_str_new_frozen(v_buffer));
+}
+
+/*
+ * Returns a new Kerberos::Krb5::Pac holding copies of the buffers in +pac+,
+ * which should already have been verified. Requires the GVL.
+ */
+VALUE rkrb5_pac_new(krb5_context ctx, krb5_pac pac){
+  krb5_error_code kerror;
+  krb5_ui_4* types;
+  krb5_data data;
+  size_t count, i;
+  VALUE v_pac, v_buffers;
+
+  kerror = krb5_pac_get_types(ctx, pac, &count, &types);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_pac_get_types: %s", error_message(kerror));
+
+  v_buffers = rb_hash_new();
+
+  for(i = 0; i < count; i++){
+    if(krb5_pac_get_buffer(ctx, pac, types[i], &data))
+      continue;
+
+    rb_hash_aset(v_buffers, UINT2NUM(types[i]), rb_obj_freeze(rb_str_new(data.data, data.length)));
+    krb5_free_data_contents(ctx, &data);
+  }
+
+  free(types);
+
+  v_pac = rb_class_new_instance(0, NULL, cKrb5Pac);
+  rb_iv_set(v_pac, "@buffers", rb_obj_freeze(v_buffers));
+
+  return v_pac;
+}
+
+/*
+ * call-seq:
+ *   pac.logon_info
+ *
+ * Returns the decoded logon info (KERB_VALIDATION_INFO) buffer as a frozen
+ * hash, or nil if the PAC has none. Its keys include :effective_name,
+ * :full_name, :logon_domain_name, :user_sid, :primary_group_sid,
+ * :group_sids, :extra_sids, :user_account_control and :logon_time.
+ *
+ * The buffer is decoded on the first call and the same hash is returned
+ * afterwards.
+ */
+static VALUE rkrb5_pac_logon_info(VALUE self){
+  VALUE v_buffer;
+
+  if(rb_ivar_defined(self, rb_intern("@logon_info")))
+    return rb_iv_get(self, "@logon_info");
+
+  v_buffer = rb_hash_aref(rb_iv_get(self, "@buffers"), UINT2NUM(KRB5_PAC_LOGON_INFO));
+
+  rb_iv_set(self, "@logon_info", NIL_P(v_buffer) ? Qnil : rkrb5_pac_decode_logon_info(v_buffer));
+
+  return rb_iv_get(self, "@logon_info");
+}
+
+/*
+ * call-seq:
+ *   pac.group_sids
+ *
+ * Returns a frozen array of the SIDs of every group the client is in: its
+ * domain groups, extra SIDs and resource groups. Returns an empty array
+ * if the PAC has no logon info.
+ *
+ * Example:
+ *
+ *   result = acceptor.verify(token)
+ *   admin  = result.pac && result.pac.group_sids.include?(ADMINS_SID)
+ */
+static VALUE rkrb5_pac_group_sids(VALUE self){
+  VALUE v_info = rkrb5_pac_logon_info(self);
+
+  if(NIL_P(v_info))
+    return rb_obj_freeze(rb_ary_new());
+
+  return rb_hash_aref(v_info, ID2SYM(rb_intern("group_sids")));
+}
+
+/*
+ * call-seq:
+ *   pac.buffer(type)
+ *
+ * Returns the raw bytes of the PAC buffer of the given +type+, such as
+ * Pac::UPN_DNS_INFO, as a frozen string, or nil if there is none.
+ */
+static VALUE rkrb5_pac_buffer(VALUE self, VALUE v_type){
+  return rb_hash_aref(rb_iv_get(self, "@buffers"), v_type);
+}
+
+/*
+ * call-seq:
+ *   pac.types
+ *
+ * Returns an array of the types of the buffers in the PAC.
+ */
+static VALUE rkrb5_pac_types(VALUE self){
+  return rb_funcall(rb_iv_get(self, "@buffers"), rb_intern("keys"), 0);
+}
+
+void Init_pac(){
+  /* The Kerberos::Krb5::Pac class holds the verified Privilege Attribute Certificate from a ticket. */
+  cKrb5Pac = rb_define_class_under(cKrb5, "Pac", rb_cObject);
+
+  // PACs only come from verified tickets.
+  rb_undef_method(CLASS_OF(cKrb5Pac), "new");
+
+  // Singleton Methods
+  rb_define_singleton_method(cKrb5Pac, "decode_logon_info", rkrb5_pac_s_decode_logon_info, 1);
+
+  // Instance Methods
+  rb_define_method(cKrb5Pac, "buffer", rkrb5_pac_buffer, 1);
+  rb_define_method(cKrb5Pac, "group_sids", rkrb5_pac_group_sids, 0);
+  rb_define_method(cKrb5Pac, "logon_info", rkrb5_pac_logon_info, 0);
+  rb_define_method(cKrb5Pac, "types", rkrb5_pac_types, 0);
+
+  // Buffer Types
+  rb_define_const(cKrb5Pac, "LOGON_INFO", UINT2NUM(KRB5_PAC_LOGON_INFO));
+  rb_define_const(cKrb5Pac, "CREDENTIALS_INFO", UINT2NUM(KRB5_PAC_CREDENTIALS_INFO));
+  rb_define_const(cKrb5Pac, "SERVER_CHECKSUM", UINT2NUM(KRB5_PAC_SERVER_CHECKSUM));
+  rb_define_const(cKrb5Pac, "PRIVSVR_CHECKSUM", UINT2NUM(KRB5_PAC_PRIVSVR_CHECKSUM));
+  rb_define_const(cKrb5Pac, "CLIENT_INFO", UINT2NUM(KRB5_PAC_CLIENT_INFO));
+  rb_define_const(cKrb5Pac, "DELEGATION_INFO", UINT2NUM(KRB5_PAC_DELEGATION_INFO));
+  rb_define_const(cKrb5Pac, "UPN_DNS_INFO", UINT2NUM(KRB5_PAC_UPN_DNS_INFO));
+}
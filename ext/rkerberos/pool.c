@@ -0,0 +1,104 @@
+#include <rkerberos.h>
+
+// A minimal pool of native threads used by methods that spread independent
+// Kerberos operations (each with its own context) across several cores.
+
+typedef struct {
+  RKRB5_POOL_JOB* job;
+  long next;
+  int cancelled;
+  pthread_mutex_t lock;
+} RKRB5_POOL;
+
+static void* rkrb5_pool_worker(void* arg){
+  RKRB5_POOL* pool = arg;
+  RKRB5_POOL_JOB* job = pool->job;
+  void* state = NULL;
+  long i;
+
+  if(job->setup)
+    state = job->setup(job->data);
+
+  for(;;){
+    pthread_mutex_lock(&pool->lock);
+
+    if(pool->cancelled || pool->next >= job->count){
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+
+    i = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+
+    job->run(job->data, state, i);
+  }
+
+  if(job->teardown)
+    job->teardown(job->data, state);
+
+  return NULL;
+}
+
+static void* rkrb5_pool_run_nogvl(void* arg){
+  RKRB5_POOL* pool = arg;
+  pthread_t* threads;
+  int i, started = 0;
+  int nthreads = pool->job->concurrency;
+
+  if(nthreads > pool->job->count)
+    nthreads = (int)pool->job->count;
+
+  if(nthreads < 1)
+    nthreads = 1;
+
+  // The calling thread is one of the workers.
+  threads = malloc(sizeof(pthread_t) * nthreads);
+
+  for(i = 1; threads && i < nthreads; i++){
+    if(pthread_create(&threads[started], NULL, rkrb5_pool_worker, pool))
+      break;
+    started++;
+  }
+
+  rkrb5_pool_worker(pool);
+
+  for(i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+
+  free(threads);
+
+  return NULL;
+}
+
+// Stop handing out work if the Ruby thread is interrupted. Jobs that are
+// already running are allowed to finish.
+static void rkrb5_pool_cancel(void* arg){
+  RKRB5_POOL* pool = arg;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->cancelled = 1;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Runs job->run for every index in 0...job->count on up to job->concurrency
+ * native threads without holding the GVL. The optional setup and teardown
+ * callbacks are invoked once per worker thread, and whatever setup returns is
+ * passed to each run call made by that thread.
+ *
+ * Returns the number of jobs that were started, which is less than
+ * job->count only if the calling Ruby thread was interrupted.
+ */
+long rkrb5_pool_run(RKRB5_POOL_JOB* job){
+  RKRB5_POOL pool;
+
+  memset(&pool, 0, sizeof(pool));
+  pool.job = job;
+  pthread_mutex_init(&pool.lock, NULL);
+
+  rb_thread_call_without_gvl(rkrb5_pool_run_nogvl, &pool, rkrb5_pool_cancel, &pool);
+
+  pthread_mutex_destroy(&pool.lock);
+
+  return pool.next;
+}
@@ -0,0 +1,572 @@
+#include <rkerberos.h>
+#include <time.h>
+
+VALUE cKrb5Renewer;
+
+// Drops a reference to the renewer, freeing it once neither the Ruby object
+// nor the renewal thread is using it.
+static void rkrb5_renewer_release(RUBY_KRB5_RENEWER* ptr){
+  long i;
+  int refs;
+
+  pthread_mutex_lock(&ptr->lock);
+  refs = --ptr->refs;
+  pthread_mutex_unlock(&ptr->lock);
+
+  if(refs > 0)
+    return;
+
+  for(i = 0; i < ptr->count; i++){
+    free(ptr->targets[i]->ccache_name);
+    free(ptr->targets[i]->keytab_name);
+    free(ptr->targets[i]->principal);
+    free(ptr->targets[i]);
+  }
+
+  free(ptr->targets);
+
+  pthread_cond_destroy(&ptr->cond);
+  pthread_mutex_destroy(&ptr->lock);
+
+  free(ptr);
+}
+
+// Private function that stops the renewal thread and waits for it to exit.
+static void* rkrb5_renewer_join(void* arg){
+  RUBY_KRB5_RENEWER* ptr = arg;
+
+  pthread_mutex_lock(&ptr->lock);
+  ptr->stop = 1;
+  pthread_cond_signal(&ptr->cond);
+  pthread_mutex_unlock(&ptr->lock);
+
+  pthread_join(ptr->thread, NULL);
+
+  ptr->running = 0;
+
+  return NULL;
+}
+
+// Free function for the Kerberos::Krb5::Renewer class. A running thread
+// may be in the middle of a KDC exchange, so rather than wait for it here
+// it's told to stop and left to drop the last reference when it exits.
+static void rkrb5_renewer_free(RUBY_KRB5_RENEWER* ptr){
+  if(!ptr)
+    return;
+
+  if(ptr->running){
+    pthread_mutex_lock(&ptr->lock);
+    ptr->stop = 1;
+    pthread_cond_signal(&ptr->cond);
+    pthread_mutex_unlock(&ptr->lock);
+
+    pthread_detach(ptr->thread);
+  }
+
+  rkrb5_renewer_release(ptr);
+}
+
+// Allocation function for the Kerberos::Krb5::Renewer class.
+static VALUE rkrb5_renewer_allocate(VALUE klass){
+  RUBY_KRB5_RENEWER* ptr = malloc(sizeof(RUBY_KRB5_RENEWER));
+  memset(ptr, 0, sizeof(RUBY_KRB5_RENEWER));
+  ptr->refs = 1;
+  pthread_mutex_init(&ptr->lock, NULL);
+  pthread_cond_init(&ptr->cond, NULL);
+  return Data_Wrap_Struct(klass, 0, rkrb5_renewer_free, ptr);
+}
+
+// Returns the point at which +fraction+ of the lifetime of +creds+ is used.
+static krb5_timestamp rkrb5_renew_point(krb5_creds* creds, double fraction){
+  krb5_timestamp start = creds->times.starttime ? creds->times.starttime : creds->times.authtime;
+  return start + (krb5_timestamp)((creds->times.endtime - start) * fraction);
+}
+
+// Get a new TGT for the target from its keytab and store it in +ccache+.
+static krb5_error_code rkrb5_renew_from_keytab(krb5_context ctx, RKRB5_RENEW_TARGET* t, krb5_ccache ccache, krb5_principal client, krb5_creds* creds){
+  krb5_error_code kerror;
+  krb5_keytab keytab;
+  krb5_get_init_creds_opt* opt;
+
+  kerror = krb5_kt_resolve(ctx, t->keytab_name, &keytab);
+
+  if(kerror)
+    return kerror;
+
+  kerror = krb5_get_init_creds_opt_alloc(ctx, &opt);
+
+  if(!kerror){
+    kerror = krb5_get_init_creds_opt_set_out_ccache(ctx, opt, ccache);
+
+    if(!kerror)
+      kerror = krb5_get_init_creds_keytab(ctx, creds, client, keytab, 0, NULL, opt);
+
+    krb5_get_init_creds_opt_free(ctx, opt);
+  }
+
+  krb5_kt_close(ctx, keytab);
+
+  return kerror;
+}
+
+/*
+ * Renews the TGT in a single target if it has passed its renewal point.
+ * Renewal is tried first if the ticket allows it, falling back to the
+ * keytab if one was given. Sets +renewed+ if a new ticket was stored, and
+ * +next+ to the time the target should next be looked at.
+ */
+static krb5_error_code rkrb5_renew_target(krb5_context ctx, RKRB5_RENEW_TARGET* t, double fraction, int* renewed, krb5_timestamp* next){
+  krb5_error_code kerror;
+  krb5_ccache ccache;
+  krb5_principal client = NULL;
+  krb5_creds mcreds, creds;
+  krb5_timestamp now;
+  int have_tgt = 0;
+
+  *renewed = 0;
+  *next = 0;
+
+  memset(&mcreds, 0, sizeof(mcreds));
+  memset(&creds, 0, sizeof(creds));
+
+  if((kerror = krb5_timeofday(ctx, &now)))
+    return kerror;
+
+  if((kerror = krb5_cc_resolve(ctx, t->ccache_name, &ccache)))
+    return kerror;
+
+  if(t->principal)
+    kerror = krb5_parse_name(ctx, t->principal, &client);
+  else
+    kerror = krb5_cc_get_principal(ctx, ccache, &client);
+
+  if(kerror)
+    goto cleanup;
+
+  kerror = krb5_build_principal(
+    ctx,
+    &mcreds.server,
+    client->realm.length,
+    client->realm.data,
+    "krbtgt",
+    client->realm.data,
+    NULL
+  );
+
+  if(kerror)
+    goto cleanup;
+
+  mcreds.client = client;
+
+  if(krb5_cc_retrieve_cred(ctx, ccache, 0, &mcreds, &creds) == 0)
+    have_tgt = 1;
+
+  if(have_tgt && now < rkrb5_renew_point(&creds, fraction)){
+    *next = rkrb5_renew_point(&creds, fraction);
+    goto cleanup;
+  }
+
+  kerror = KRB5_CC_NOTFOUND;
+
+  if(have_tgt && (creds.ticket_flags & TKT_FLG_RENEWABLE) && creds.times.renew_till > now){
+    krb5_free_cred_contents(ctx, &creds);
+    memset(&creds, 0, sizeof(creds));
+    have_tgt = 0;
+
+    kerror = krb5_get_renewed_creds(ctx, &creds, client, ccache, NULL);
+
+    if(!kerror){
+      have_tgt = 1;
+      kerror = krb5_cc_initialize(ctx, ccache, client);
+
+      if(!kerror)
+        kerror = krb5_cc_store_cred(ctx, ccache, &creds);
+    }
+  }
+
+  if(kerror && t->keytab_name){
+    if(have_tgt)
+      krb5_free_cred_contents(ctx, &creds);
+
+    memset(&creds, 0, sizeof(creds));
+    have_tgt = 0;
+
+    kerror = rkrb5_renew_from_keytab(ctx, t, ccache, client, &creds);
+
+    if(!kerror)
+      have_tgt = 1;
+  }
+
+  if(!kerror){
+    *renewed = 1;
+    *next = rkrb5_renew_point(&creds, fraction);
+  }
+
+  cleanup:
+
+  if(have_tgt)
+    krb5_free_cred_contents(ctx, &creds);
+
+  if(mcreds.server)
+    krb5_free_principal(ctx, mcreds.server);
+
+  if(client)
+    krb5_free_principal(ctx, client);
+
+  krb5_cc_close(ctx, ccache);
+
+  return kerror;
+}
+
+// The body of the renewal thread. It never touches the Ruby VM.
+static void* rkrb5_renewer_thread(void* arg){
+  RUBY_KRB5_RENEWER* ptr = arg;
+  krb5_context ctx = NULL;
+  krb5_timestamp next, wake;
+  struct timespec deadline;
+  long i, count;
+  int renewed;
+
+  krb5_init_context(&ctx);
+
+  pthread_mutex_lock(&ptr->lock);
+
+  while(!ptr->stop){
+    count = ptr->count;
+    wake = (krb5_timestamp)time(NULL) + ptr->interval;
+
+    for(i = 0; i < count && !ptr->stop; i++){
+      RKRB5_RENEW_TARGET* t = ptr->targets[i];
+      krb5_error_code kerror = KRB5_CC_NOTFOUND;
+
+      renewed = 0;
+      next = 0;
+
+      // Don't hold the lock during a KDC exchange.
+      pthread_mutex_unlock(&ptr->lock);
+
+      if(ctx)
+        kerror = rkrb5_renew_target(ctx, t, ptr->fraction, &renewed, &next);
+
+      pthread_mutex_lock(&ptr->lock);
+
+      t->last_error = kerror;
+      t->next_renewal = next;
+
+      if(renewed){
+        t->renewals++;
+        t->last_renewal = (krb5_timestamp)time(NULL);
+      }
+
+      if(!kerror && next && next < wake)
+        wake = next;
+    }
+
+    // Check back at least once a second, and at most every interval.
+    if(wake <= (krb5_timestamp)time(NULL))
+      wake = (krb5_timestamp)time(NULL) + 1;
+
+    deadline.tv_sec = wake;
+    deadline.tv_nsec = 0;
+
+    // Woken early by watch or stop. A spurious wakeup only costs a pass.
+    if(!ptr->stop)
+      pthread_cond_timedwait(&ptr->cond, &ptr->lock, &deadline);
+  }
+
+  pthread_mutex_unlock(&ptr->lock);
+
+  if(ctx)
+    krb5_free_context(ctx);
+
+  rkrb5_renewer_release(ptr);
+
+  return NULL;
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5::Renewer.new(:fraction => 0.5, :interval => 60)
+ *
+ * Creates and returns a new Kerberos::Krb5::Renewer object. A renewer
+ * keeps the ticket granting tickets in one or more credentials caches
+ * fresh from a native background thread, so that application threads never
+ * have to wait for a synchronous kinit.
+ *
+ * A ticket is renewed once +fraction+ of its lifetime has passed. Caches
+ * are looked at no less often than every +interval+ seconds, which is also
+ * how long a failed renewal waits before it is retried.
+ *
+ * Example:
+ *
+ *   renewer = Kerberos::Krb5::Renewer.new(:fraction => 0.75)
+ *   renewer.watch(ccache, :keytab => 'FILE:/etc/krb5.keytab')
+ *   renewer.start
+ */
+static VALUE rkrb5_renewer_initialize(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5_RENEWER* ptr;
+  VALUE v_opts, v_fraction, v_interval;
+
+  Data_Get_Struct(self, RUBY_KRB5_RENEWER, ptr);
+
+  rb_scan_args(argc, argv, "01", &v_opts);
+
+  ptr->fraction = 0.5;
+  ptr->interval = 60;
+
+  if(!NIL_P(v_opts)){
+    Check_Type(v_opts, T_HASH);
+
+    v_fraction = rb_hash_aref2(v_opts, "fraction");
+    v_interval = rb_hash_aref2(v_opts, "interval");
+
+    if(!NIL_P(v_fraction)){
+      ptr->fraction = NUM2DBL(v_fraction);
+
+      if(ptr->fraction <= 0 || ptr->fraction >= 1)
+        rb_raise(rb_eArgError, "fraction must be between 0 and 1");
+    }
+
+    if(!NIL_P(v_interval)){
+      ptr->interval = NUM2INT(v_interval);
+
+      if(ptr->interval < 1)
+        rb_raise(rb_eArgError, "interval must be a positive number");
+    }
+  }
+
+  return self;
+}
+
+/*
+ * call-seq:
+ *   renewer.watch(ccache, :keytab => nil, :principal => nil)
+ *
+ * Adds +ccache+, a CredentialsCache object or cache name, to the caches
+ * kept fresh by the renewer. This may be called while the renewer is
+ * running.
+ *
+ * Renewable tickets are renewed with krb5_get_renewed_creds. If a +keytab+
+ * (a Keytab object or name) is given it is used to get a new ticket when
+ * renewal isn't possible, including when the cache is empty. The ticket is
+ * acquired for +principal+, or the primary principal of the cache.
+ */
+static VALUE rkrb5_renewer_watch(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5_RENEWER* ptr;
+  RKRB5_RENEW_TARGET* t;
+  VALUE v_ccache, v_opts, v_name, v_keytab = Qnil, v_principal = Qnil;
+
+  Data_Get_Struct(self, RUBY_KRB5_RENEWER, ptr);
+
+  rb_scan_args(argc, argv, "11", &v_ccache, &v_opts);
+
+  if(rb_obj_is_kind_of(v_ccache, cKrb5CCache))
+    v_name = rb_funcall(v_ccache, rb_intern("name"), 0);
+  else
+    v_name = v_ccache;
+
+  Check_Type(v_name, T_STRING);
+
+  if(!NIL_P(v_opts)){
+    Check_Type(v_opts, T_HASH);
+
+    v_keytab = rb_hash_aref2(v_opts, "keytab");
+    v_principal = rb_hash_aref2(v_opts, "principal");
+
+    if(rb_obj_is_kind_of(v_keytab, cKrb5Keytab))
+      v_keytab = rb_iv_get(v_keytab, "@name");
+
+    if(!NIL_P(v_keytab))
+      Check_Type(v_keytab, T_STRING);
+
+    if(!NIL_P(v_principal))
+      Check_Type(v_principal, T_STRING);
+  }
+
+  t = calloc(1, sizeof(RKRB5_RENEW_TARGET));
+
+  if(!t)
+    rb_raise(rb_eNoMemError, "failed to allocate memory");
+
+  t->ccache_name = strdup(StringValueCStr(v_name));
+
+  if(!NIL_P(v_keytab))
+    t->keytab_name = strdup(StringValueCStr(v_keytab));
+
+  if(!NIL_P(v_principal))
+    t->principal = strdup(StringValueCStr(v_principal));
+
+  pthread_mutex_lock(&ptr->lock);
+
+  if(ptr->count == ptr->capacity){
+    long capacity = ptr->capacity ? ptr->capacity * 2 : 4;
+    RKRB5_RENEW_TARGET** targets = realloc(ptr->targets, capacity * sizeof(RKRB5_RENEW_TARGET*));
+
+    if(!targets){
+      pthread_mutex_unlock(&ptr->lock);
+      free(t->ccache_name);
+      free(t->keytab_name);
+      free(t->principal);
+      free(t);
+      rb_raise(rb_eNoMemError, "failed to allocate memory");
+    }
+
+    ptr->targets = targets;
+    ptr->capacity = capacity;
+  }
+
+  ptr->targets[ptr->count++] = t;
+
+  // Wake the thread so the new cache is looked at straight away.
+  pthread_cond_signal(&ptr->cond);
+  pthread_mutex_unlock(&ptr->lock);
+
+  return self;
+}
+
+/*
+ * call-seq:
+ *   renewer.start
+ *
+ * Starts the background renewal thread. Every watched cache is checked
+ * immediately, then again as each ticket reaches its renewal point.
+ *
+ * Note that the thread does not survive a fork, so call start again in the
+ * child process if needed.
+ */
+static VALUE rkrb5_renewer_start(VALUE self){
+  RUBY_KRB5_RENEWER* ptr;
+  int rv;
+
+  Data_Get_Struct(self, RUBY_KRB5_RENEWER, ptr);
+
+  if(ptr->running)
+    return self;
+
+  ptr->stop = 0;
+
+  // The thread holds a reference of its own until it exits.
+  pthread_mutex_lock(&ptr->lock);
+  ptr->refs++;
+  pthread_mutex_unlock(&ptr->lock);
+
+  rv = pthread_create(&ptr->thread, NULL, rkrb5_renewer_thread, ptr);
+
+  if(rv){
+    pthread_mutex_lock(&ptr->lock);
+    ptr->refs--;
+    pthread_mutex_unlock(&ptr->lock);
+    rb_raise(cKrb5Exception, "pthread_create: %s", strerror(rv));
+  }
+
+  ptr->running = 1;
+
+  return self;
+}
+
+/*
+ * call-seq:
+ *   renewer.stop
+ *
+ * Stops the background renewal thread, waiting for any renewal in progress
+ * to finish. The renewer may be started again later.
+ */
+static VALUE rkrb5_renewer_stop(VALUE self){
+  RUBY_KRB5_RENEWER* ptr;
+
+  Data_Get_Struct(self, RUBY_KRB5_RENEWER, ptr);
+
+  if(ptr->running)
+    rb_thread_call_without_gvl(rkrb5_renewer_join, ptr, NULL, NULL);
+
+  return self;
+}
+
+/*
+ * call-seq:
+ *   renewer.running?
+ *
+ * Returns whether or not the background renewal thread is running.
+ */
+static VALUE rkrb5_renewer_running(VALUE self){
+  RUBY_KRB5_RENEWER* ptr;
+  Data_Get_Struct(self, RUBY_KRB5_RENEWER, ptr);
+  return ptr->running ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *   renewer.status
+ *
+ * Returns an array with a hash for each watched cache, in the order they
+ * were added, containing the following keys:
+ *
+ *   :ccache       => the name of the cache
+ *   :renewals     => the number of times a new ticket was stored
+ *   :last_renewal => when that last happened, or nil
+ *   :next_renewal => when the ticket is next due for renewal, or nil
+ *   :error        => the error from the last attempt, or nil
+ */
+static VALUE rkrb5_renewer_status(VALUE self){
+  RUBY_KRB5_RENEWER* ptr;
+  RKRB5_RENEW_TARGET* targets;
+  VALUE v_status, v_info;
+  long i, count;
+
+  Data_Get_Struct(self, RUBY_KRB5_RENEWER, ptr);
+
+  // Copy the status under the lock, then build the Ruby objects without it.
+  pthread_mutex_lock(&ptr->lock);
+
+  count = ptr->count;
+  targets = malloc(sizeof(RKRB5_RENEW_TARGET) * (count + 1));
+
+  for(i = 0; targets && i < count; i++)
+    targets[i] = *ptr->targets[i];
+
+  pthread_mutex_unlock(&ptr->lock);
+
+  if(!targets)
+    rb_raise(rb_eNoMemError, "failed to allocate memory");
+
+  v_status = rb_ary_new();
+
+  for(i = 0; i < count; i++){
+    RKRB5_RENEW_TARGET* t = &targets[i];
+
+    v_info = rb_hash_new();
+
+    rb_hash_aset(v_info, ID2SYM(rb_intern("ccache")), rb_str_new2(t->ccache_name));
+    rb_hash_aset(v_info, ID2SYM(rb_intern("renewals")), LONG2NUM(t->renewals));
+    rb_hash_aset(v_info, ID2SYM(rb_intern("last_renewal")),
+      t->last_renewal ? rb_time_new(t->last_renewal, 0) : Qnil);
+    rb_hash_aset(v_info, ID2SYM(rb_intern("next_renewal")),
+      t->next_renewal ? rb_time_new(t->next_renewal, 0) : Qnil);
+    rb_hash_aset(v_info, ID2SYM(rb_intern("error")),
+      t->last_error ? rb_str_new2(error_message(t->last_error)) : Qnil);
+
+    rb_ary_push(v_status, v_info);
+  }
+
+  free(targets);
+
+  return v_status;
+}
+
+void Init_renewer(){
+  /* The Kerberos::Krb5::Renewer class keeps tickets in credentials caches renewed from a background thread. */
+  cKrb5Renewer = rb_define_class_under(cKrb5, "Renewer", rb_cObject);
+
+  // Allocation Function
+  rb_define_alloc_func(cKrb5Renewer, rkrb5_renewer_allocate);
+
+  // Constructor
+  rb_define_method(cKrb5Renewer, "initialize", rkrb5_renewer_initialize, -1);
+
+  // Instance Methods
+  rb_define_method(cKrb5Renewer, "running?", rkrb5_renewer_running, 0);
+  rb_define_method(cKrb5Renewer, "start", rkrb5_renewer_start, 0);
+  rb_define_method(cKrb5Renewer, "status", rkrb5_renewer_status, 0);
+  rb_define_method(cKrb5Renewer, "stop", rkrb5_renewer_stop, 0);
+  rb_define_method(cKrb5Renewer, "watch", rkrb5_renewer_watch, -1);
+}
@@ -0,0 +1,334 @@
+#include <rkerberos.h>
+
+VALUE cKrb5ReplayCache;
+
+// Free function for the Kerberos::Krb5::ReplayCache class.
+static void rkrb5_rcache_free(RUBY_KRB5_RCACHE* ptr){
+  int i, j;
+
+  if(!ptr)
+    return;
+
+  for(i = 0; ptr->shards && i < ptr->nshards; i++){
+    RKRB5_RC_SHARD* shard = &ptr->shards[i];
+
+    for(j = 0; shard->buckets && j < ptr->nbuckets; j++)
+      free(shard->buckets[j].keys);
+
+    free(shard->buckets);
+    pthread_mutex_destroy(&shard->lock);
+  }
+
+  free(ptr->shards);
+  free(ptr->name);
+  free(ptr);
+}
+
+// Allocation function for the Kerberos::Krb5::ReplayCache class.
+static VALUE rkrb5_rcache_allocate(VALUE klass){
+  RUBY_KRB5_RCACHE* ptr = malloc(sizeof(RUBY_KRB5_RCACHE));
+  memset(ptr, 0, sizeof(RUBY_KRB5_RCACHE));
+  return Data_Wrap_Struct(klass, 0, rkrb5_rcache_free, ptr);
+}
+
+// FNV-1a, continued from +hash+ over +length+ bytes of +data+.
+static uint64_t rkrb5_rcache_hash(uint64_t hash, const void* data, size_t length){
+  const unsigned char* p = data;
+
+  while(length--){
+    hash ^= *p++;
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+// Adds +key+ to +bucket+, returning 1 if it was already there.
+static int rkrb5_rcache_bucket_add(RKRB5_RC_BUCKET* bucket, uint64_t key){
+  long i, mask;
+
+  // Keep the table at most half full.
+  if((bucket->count + 1) * 2 > bucket->capacity){
+    long capacity = bucket->capacity ? bucket->capacity * 2 : 64;
+    uint64_t* keys = calloc(capacity, sizeof(uint64_t));
+    uint64_t* old = bucket->keys;
+    long j;
+
+    // If the table can't grow, fail safe by treating the key as a replay.
+    if(!keys)
+      return 1;
+
+    for(j = 0; j < bucket->capacity; j++){
+      if(old[j]){
+        for(i = old[j] & (capacity - 1); keys[i]; i = (i + 1) & (capacity - 1));
+        keys[i] = old[j];
+      }
+    }
+
+    free(old);
+    bucket->keys = keys;
+    bucket->capacity = capacity;
+  }
+
+  mask = bucket->capacity - 1;
+
+  for(i = key & mask; bucket->keys[i]; i = (i + 1) & mask){
+    if(bucket->keys[i] == key)
+      return 1;
+  }
+
+  bucket->keys[i] = key;
+  bucket->count++;
+
+  return 0;
+}
+
+/*
+ * Records an authenticator in a memory replay cache, returning 1 if it has
+ * been seen before and 0 if not. Safe to call without the GVL.
+ *
+ * An authenticator is identified by its client, server and timestamp. Its
+ * timestamp picks the bucket it lives in; a bucket still holding an older
+ * time slot is emptied before reuse. There are enough buckets to cover the
+ * window either side of the current time, and krb5_rd_req rejects anything
+ * outside the clock skew, so nothing is expired while it could be replayed.
+ * A timestamp too old for the ring is reported as a replay.
+ */
+int rkrb5_rcache_replay(RUBY_KRB5_RCACHE* ptr, const char* client, const char* server, krb5_timestamp ctime, krb5_int32 cusec){
+  RKRB5_RC_SHARD* shard;
+  RKRB5_RC_BUCKET* bucket;
+  uint64_t key = 14695981039346656037ULL;
+  long epoch = (long)ctime / RKRB5_RC_BUCKET_SECS;
+  int replay;
+
+  if(ptr->type != RKRB5_RC_MEMORY)
+    return 0;
+
+  key = rkrb5_rcache_hash(key, client, strlen(client) + 1);
+  key = rkrb5_rcache_hash(key, server, strlen(server) + 1);
+  key = rkrb5_rcache_hash(key, &ctime, sizeof(ctime));
+  key = rkrb5_rcache_hash(key, &cusec, sizeof(cusec));
+
+  // Zero marks an empty slot.
+  if(!key)
+    key = 1;
+
+  shard = &ptr->shards[(key >> 32) % ptr->nshards];
+
+  pthread_mutex_lock(&shard->lock);
+
+  bucket = &shard->buckets[((epoch % ptr->nbuckets) + ptr->nbuckets) % ptr->nbuckets];
+
+  if(bucket->epoch > epoch){
+    replay = 1;
+  }
+  else{
+    if(bucket->epoch < epoch){
+      if(bucket->keys)
+        memset(bucket->keys, 0, bucket->capacity * sizeof(uint64_t));
+
+      bucket->count = 0;
+      bucket->epoch = epoch;
+    }
+
+    replay = rkrb5_rcache_bucket_add(bucket, key);
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+
+  return replay;
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5::ReplayCache.new(type = :memory, options = {})
+ *
+ * Creates a replay cache, for use with Kerberos::Krb5::Acceptor, of the
+ * given +type+:
+ *
+ *   :memory - a sharded in-process hash, the fastest choice (default)
+ *   :file   - the library's own replay cache, kept on disk
+ *   :none   - no replay detection at all
+ *
+ * The following options are supported:
+ *
+ *   :name   => the library replay cache name for :file (default 'dfl:'),
+ *              which must be 'dfl:' with MIT krb5 1.18 and later
+ *   :shards => the number of independently locked shards for :memory (16)
+ *   :window => the seconds either side of now that :memory must cover,
+ *              also used as the clock skew an Acceptor allows (default 300)
+ *
+ * A memory replay cache only protects the process it lives in. Servers
+ * with several processes need a file replay cache or sticky sessions.
+ *
+ * Example:
+ *
+ *   rcache   = Kerberos::Krb5::ReplayCache.new(:memory, :shards => 64)
+ *   acceptor = Kerberos::Krb5::Acceptor.new(:rcache => rcache)
+ */
+static VALUE rkrb5_rcache_initialize(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5_RCACHE* ptr;
+  VALUE v_type, v_opts, v_name = Qnil, v_shards = Qnil, v_window = Qnil;
+  ID type;
+  int i;
+
+  Data_Get_Struct(self, RUBY_KRB5_RCACHE, ptr);
+
+  rb_scan_args(argc, argv, "02", &v_type, &v_opts);
+
+  if(ptr->type)
+    rb_raise(cKrb5Exception, "replay cache already initialized");
+
+  if(NIL_P(v_type))
+    v_type = ID2SYM(rb_intern("memory"));
+
+  Check_Type(v_type, T_SYMBOL);
+
+  if(!NIL_P(v_opts)){
+    Check_Type(v_opts, T_HASH);
+    v_name = rb_hash_aref2(v_opts, "name");
+    v_shards = rb_hash_aref2(v_opts, "shards");
+    v_window = rb_hash_aref2(v_opts, "window");
+  }
+
+  type = SYM2ID(v_type);
+
+  if(type == rb_intern("none")){
+    ptr->type = RKRB5_RC_NONE;
+    ptr->name = strdup("none:");
+  }
+  else if(type == rb_intern("file")){
+    if(!NIL_P(v_name))
+      Check_Type(v_name, T_STRING);
+
+#ifndef HAVE_KRB5_RC_RESOLVE_FULL
+    if(!NIL_P(v_name) && strcmp(StringValueCStr(v_name), "dfl:"))
+      rb_raise(cKrb5Exception, "only the 'dfl:' replay cache is supported by this krb5 library");
+#endif
+
+    ptr->type = RKRB5_RC_FILE;
+    ptr->name = strdup(NIL_P(v_name) ? "dfl:" : StringValueCStr(v_name));
+  }
+  else if(type == rb_intern("memory")){
+    int window = NIL_P(v_window) ? 300 : NUM2INT(v_window);
+    int nshards = NIL_P(v_shards) ? 16 : NUM2INT(v_shards);
+
+    if(nshards < 1 || nshards > 4096)
+      rb_raise(rb_eArgError, "shards must be between 1 and 4096");
+
+    if(window < 1)
+      rb_raise(rb_eArgError, "window must be a positive number");
+
+    // No library replay cache is used, and the window doubles as the
+    // clock skew an Acceptor allows.
+    ptr->name = strdup("none:");
+    ptr->window = window;
+    ptr->nbuckets = (2 * window) / RKRB5_RC_BUCKET_SECS + 2;
+    ptr->shards = calloc(nshards, sizeof(RKRB5_RC_SHARD));
+
+    if(!ptr->shards)
+      rb_raise(rb_eNoMemError, "failed to allocate memory");
+
+    // Only count shards once their lock exists, for the free function.
+    for(i = 0; i < nshards; i++){
+      RKRB5_RC_SHARD* shard = &ptr->shards[i];
+      pthread_mutex_init(&shard->lock, NULL);
+      ptr->nshards = i + 1;
+      shard->buckets = calloc(ptr->nbuckets, sizeof(RKRB5_RC_BUCKET));
+
+      if(!shard->buckets)
+        rb_raise(rb_eNoMemError, "failed to allocate memory");
+    }
+
+    ptr->type = RKRB5_RC_MEMORY;
+  }
+  else{
+    rb_raise(rb_eArgError, "unknown replay cache type: %s", rb_id2name(type));
+  }
+
+  return self;
+}
+
+/*
+ * call-seq:
+ *   rcache.type
+ *
+ * Returns the type of the replay cache, :none, :file or :memory.
+ */
+static VALUE rkrb5_rcache_type(VALUE self){
+  RUBY_KRB5_RCACHE* ptr;
+  Data_Get_Struct(self, RUBY_KRB5_RCACHE, ptr);
+
+  switch(ptr->type){
+    case RKRB5_RC_NONE:
+      return ID2SYM(rb_intern("none"));
+    case RKRB5_RC_FILE:
+      return ID2SYM(rb_intern("file"));
+    case RKRB5_RC_MEMORY:
+      return ID2SYM(rb_intern("memory"));
+  }
+
+  return Qnil;
+}
+
+/*
+ * call-seq:
+ *   rcache.name
+ *
+ * Returns the name of the library replay cache used when verifying. For
+ * the :memory type this is 'none:', since no library replay cache is used
+ * and checks are done in-process.
+ */
+static VALUE rkrb5_rcache_name(VALUE self){
+  RUBY_KRB5_RCACHE* ptr;
+  Data_Get_Struct(self, RUBY_KRB5_RCACHE, ptr);
+  return ptr->name ? rb_str_new2(ptr->name) : Qnil;
+}
+
+/*
+ * call-seq:
+ *   rcache.replay?(client, server, time, usec = 0)
+ *
+ * Records an authenticator for +client+ and +server+ made at +time+ and
+ * returns whether it had already been seen. Acceptor#verify does this for
+ * every ticket, so it's only needed to check authenticators by hand. Always
+ * returns false unless this is a :memory replay cache.
+ */
+static VALUE rkrb5_rcache_replay_p(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5_RCACHE* ptr;
+  VALUE v_client, v_server, v_time, v_usec;
+
+  Data_Get_Struct(self, RUBY_KRB5_RCACHE, ptr);
+
+  rb_scan_args(argc, argv, "31", &v_client, &v_server, &v_time, &v_usec);
+
+  Check_Type(v_client, T_STRING);
+  Check_Type(v_server, T_STRING);
+
+  if(rb_obj_is_kind_of(v_time, rb_cTime))
+    v_time = rb_funcall(v_time, rb_intern("to_i"), 0);
+
+  return rkrb5_rcache_replay(
+    ptr,
+    StringValueCStr(v_client),
+    StringValueCStr(v_server),
+    (krb5_timestamp)NUM2LONG(v_time),
+    NIL_P(v_usec) ? 0 : NUM2INT(v_usec)
+  ) ? Qtrue : Qfalse;
+}
+
+void Init_replay_cache(){
+  /* The Kerberos::Krb5::ReplayCache class selects how an Acceptor detects replayed authenticators. */
+  cKrb5ReplayCache = rb_define_class_under(cKrb5, "ReplayCache", rb_cObject);
+
+  // Allocation Function
+  rb_define_alloc_func(cKrb5ReplayCache, rkrb5_rcache_allocate);
+
+  // Constructor
+  rb_define_method(cKrb5ReplayCache, "initialize", rkrb5_rcache_initialize, -1);
+
+  // Instance Methods
+  rb_define_method(cKrb5ReplayCache, "name", rkrb5_rcache_name, 0);
+  rb_define_method(cKrb5ReplayCache, "replay?", rkrb5_rcache_replay_p, -1);
+  rb_define_method(cKrb5ReplayCache, "type", rkrb5_rcache_type, 0);
+}
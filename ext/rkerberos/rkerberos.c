@@ -19,6 +19,95 @@ VALUE rb_hash_aref2(VALUE v_hash, const char* key){
   return v_val;
 }
 
+// Private helper that fills +list+ from an Integer or Array of Integers.
+static int rkrb5_parse_int_list(VALUE v_list, krb5_int32* list, const char* name){
+  long i;
+
+  if(!RB_TYPE_P(v_list, T_ARRAY))
+    v_list = rb_ary_new3(1, v_list);
+
+  if(RARRAY_LEN(v_list) > RKRB5_MAX_INIT_LIST)
+    rb_raise(rb_eArgError, "too many %s (maximum %d)", name, RKRB5_MAX_INIT_LIST);
+
+  for(i = 0; i < RARRAY_LEN(v_list); i++)
+    list[i] = NUM2INT(rb_ary_entry(v_list, i));
+
+  return (int)i;
+}
+
+/*
+ * Converts the options hash accepted by the get_init_creds methods into an
+ * RKRB5_INIT_OPTS struct. Unset options are left at -1. This may raise, so
+ * call it before acquiring any resources.
+ */
+void rkrb5_parse_init_opts(VALUE v_opts, RKRB5_INIT_OPTS* opts){
+  VALUE v_val;
+
+  // Zeroed first so that options can be compared with memcmp.
+  memset(opts, 0, sizeof(RKRB5_INIT_OPTS));
+
+  opts->lifetime = -1;
+  opts->renew_lifetime = -1;
+  opts->forwardable = -1;
+  opts->proxiable = -1;
+  opts->canonicalize = -1;
+  opts->etype_count = -1;
+  opts->preauth_count = -1;
+
+  if(NIL_P(v_opts))
+    return;
+
+  Check_Type(v_opts, T_HASH);
+
+  if(!NIL_P(v_val = rb_hash_aref2(v_opts, "lifetime")))
+    opts->lifetime = NUM2INT(v_val);
+
+  if(!NIL_P(v_val = rb_hash_aref2(v_opts, "renew_lifetime")))
+    opts->renew_lifetime = NUM2INT(v_val);
+
+  if(!NIL_P(v_val = rb_hash_aref2(v_opts, "forwardable")))
+    opts->forwardable = RTEST(v_val);
+
+  if(!NIL_P(v_val = rb_hash_aref2(v_opts, "proxiable")))
+    opts->proxiable = RTEST(v_val);
+
+  if(!NIL_P(v_val = rb_hash_aref2(v_opts, "canonicalize")))
+    opts->canonicalize = RTEST(v_val);
+
+  if(!NIL_P(v_val = rb_hash_aref2(v_opts, "etypes")))
+    opts->etype_count = rkrb5_parse_int_list(v_val, opts->etypes, "etypes");
+
+  if(!NIL_P(v_val = rb_hash_aref2(v_opts, "preauth")))
+    opts->preauth_count = rkrb5_parse_int_list(v_val, opts->preauth, "preauth types");
+}
+
+/*
+ * Applies the options in +opts+ to +opt+. The etype and preauth lists are
+ * referenced rather than copied, so +opts+ must outlive +opt+.
+ */
+void rkrb5_apply_init_opts(RKRB5_INIT_OPTS* opts, krb5_get_init_creds_opt* opt){
+  if(opts->lifetime >= 0)
+    krb5_get_init_creds_opt_set_tkt_life(opt, opts->lifetime);
+
+  if(opts->renew_lifetime >= 0)
+    krb5_get_init_creds_opt_set_renew_life(opt, opts->renew_lifetime);
+
+  if(opts->forwardable >= 0)
+    krb5_get_init_creds_opt_set_forwardable(opt, opts->forwardable);
+
+  if(opts->proxiable >= 0)
+    krb5_get_init_creds_opt_set_proxiable(opt, opts->proxiable);
+
+  if(opts->canonicalize >= 0)
+    krb5_get_init_creds_opt_set_canonicalize(opt, opts->canonicalize);
+
+  if(opts->etype_count > 0)
+    krb5_get_init_creds_opt_set_etype_list(opt, opts->etypes, opts->etype_count);
+
+  if(opts->preauth_count >= 0)
+    krb5_get_init_creds_opt_set_preauth_list(opt, opts->preauth, opts->preauth_count);
+}
+
 // Free function for the Kerberos::Krb5 class.
 static void rkrb5_free(RUBY_KRB5* ptr){
   if(!ptr)
@@ -127,7 +216,7 @@ static VALUE rkrb5_set_default_realm(int argc, VALUE* argv, VALUE self){
 }
 
 /* call-seq:
- *   krb5.get_init_creds_keytab(principal = nil, keytab = nil, service = nil, ccache = nil)
+ *   krb5.get_init_creds_keytab(principal = nil, keytab = nil, service = nil, ccache = nil, **options)
  *
  * Acquire credentials for +principal+ from +keytab+ using +service+. If
  * no principal is specified, then a principal is derived from the service
@@ -138,10 +227,37 @@ static VALUE rkrb5_set_default_realm(int argc, VALUE* argv, VALUE self){
  *
  * If +ccache+ is supplied and is a Kerberos::Krb5::CredentialsCache, the
  * resulting credentials will be stored in the credential cache.
+ *
+ * The following options are supported:
+ *
+ *   :lifetime       => the requested ticket lifetime in seconds
+ *   :renew_lifetime => the requested renewable lifetime in seconds
+ *   :forwardable    => whether to request a forwardable ticket
+ *   :proxiable      => whether to request a proxiable ticket
+ *   :canonicalize   => whether the KDC may canonicalize the principal
+ *   :etypes         => an enctype, or array of enctypes, in order of preference
+ *   :preauth        => a preauth type, or array of preauth types, to use
+ *
+ * Options that are not given use the defaults from your krb5.conf file.
+ *
+ * When no service is given, TGTs are shared through a process-wide cache
+ * keyed by principal, keytab and options, so another Krb5 object asking for
+ * the same principal from the same keytab gets the cached ticket instead of
+ * contacting the KDC, as long as it has at least a minute left. Pass
+ * <tt>:cache => false</tt> to always get a fresh ticket. See
+ * Krb5.tgt_cache_stats.
+ *
+ * Example:
+ *
+ *   krb5.get_init_creds_keytab(
+ *     'host/myhost@MY.REALM', nil, nil, ccache,
+ *     :renew_lifetime => 7 * 86400,
+ *     :etypes         => Kerberos::Krb5::ENCTYPE_AES256_CTS_HMAC_SHA1_96
+ *   )
  */
 static VALUE rkrb5_get_init_creds_keytab(int argc, VALUE* argv, VALUE self){
   RUBY_KRB5* ptr;
-  VALUE v_user, v_keytab_name, v_service, v_ccache;
+  VALUE v_user, v_keytab_name, v_service, v_ccache, v_opts;
   char* user;
   char* service;
   char keytab_name[MAX_KEYTAB_NAME_LEN];
@@ -149,17 +265,26 @@ static VALUE rkrb5_get_init_creds_keytab(int argc, VALUE* argv, VALUE self){
   krb5_error_code kerror;
   krb5_get_init_creds_opt* opt;
   krb5_creds cred;
+  RKRB5_INIT_OPTS opts;
+  int use_cache;
 
   Data_Get_Struct(self, RUBY_KRB5, ptr); 
 
   if(!ptr->ctx)
     rb_raise(cKrb5Exception, "no context has been established");
 
+  rb_scan_args(argc, argv, "04:", &v_user, &v_keytab_name, &v_service, &v_ccache, &v_opts);
+
+  rkrb5_parse_init_opts(v_opts, &opts);
+
+  if(!NIL_P(v_keytab_name))
+    Check_Type(v_keytab_name, T_STRING);
+
   kerror = krb5_get_init_creds_opt_alloc(ptr->ctx, &opt);
   if(kerror)
     rb_raise(cKrb5Exception, "krb5_get_init_creds_opt_alloc: %s", error_message(kerror));
 
-  rb_scan_args(argc, argv, "04", &v_user, &v_keytab_name, &v_service, &v_ccache);
+  rkrb5_apply_init_opts(&opts, opt);
 
   // We need the service information for later.
   if(NIL_P(v_service)){
@@ -170,6 +295,17 @@ static VALUE rkrb5_get_init_creds_keytab(int argc, VALUE* argv, VALUE self){
     service = StringValueCStr(v_service);
   }
 
+  // Release anything left over from a previous call.
+  if(ptr->princ){
+    krb5_free_principal(ptr->ctx, ptr->princ);
+    ptr->princ = NULL;
+  }
+
+  if(ptr->keytab){
+    krb5_kt_close(ptr->ctx, ptr->keytab);
+    ptr->keytab = NULL;
+  }
+
   // Convert the name (or service name) to a kerberos principal.
   if(NIL_P(v_user)){
     kerror = krb5_sname_to_principal(
@@ -207,7 +343,6 @@ static VALUE rkrb5_get_init_creds_keytab(int argc, VALUE* argv, VALUE self){
     }
   }
   else{
-    Check_Type(v_keytab_name, T_STRING);
     strncpy(keytab_name, StringValueCStr(v_keytab_name), MAX_KEYTAB_NAME_LEN);
   }
 
@@ -222,6 +357,45 @@ static VALUE rkrb5_get_init_creds_keytab(int argc, VALUE* argv, VALUE self){
     rb_raise(cKrb5Exception, "krb5_kt_resolve: %s", error_message(kerror));
   }
 
+  // A TGT already obtained by any Krb5 object in this process will do.
+  use_cache = !service && (NIL_P(v_opts) || rb_hash_aref2(v_opts, "cache") != Qfalse);
+
+  if(use_cache){
+    kerror = krb5_kt_get_name(ptr->ctx, ptr->keytab, keytab_name, MAX_KEYTAB_NAME_LEN);
+
+    if(kerror){
+      krb5_get_init_creds_opt_free(ptr->ctx, opt);
+      rb_raise(cKrb5Exception, "krb5_kt_get_name: %s", error_message(kerror));
+    }
+  }
+
+  if(use_cache && rkrb5_tgt_cache_get(ptr->princ, keytab_name, &opts, &cred)){
+    krb5_get_init_creds_opt_free(ptr->ctx, opt);
+
+    if(!NIL_P(v_ccache)){
+      RUBY_KRB5_CCACHE* ccptr;
+      const char* func;
+      Data_Get_Struct(v_ccache, RUBY_KRB5_CCACHE, ccptr);
+
+      func = "krb5_cc_initialize";
+      kerror = krb5_cc_initialize(ccptr->ctx, ccptr->ccache, cred.client);
+
+      if(!kerror){
+        func = "krb5_cc_store_cred";
+        kerror = krb5_cc_store_cred(ccptr->ctx, ccptr->ccache, &cred);
+      }
+
+      if(kerror){
+        krb5_free_cred_contents(ptr->ctx, &cred);
+        rb_raise(cKrb5Exception, "%s: %s", func, error_message(kerror));
+      }
+    }
+
+    krb5_free_cred_contents(ptr->ctx, &cred);
+
+    return self;
+  }
+
   // Set the credential cache from the supplied Kerberos::Krb5::CredentialsCache
   if(!NIL_P(v_ccache)){
     RUBY_KRB5_CCACHE* ccptr;
@@ -249,11 +423,207 @@ static VALUE rkrb5_get_init_creds_keytab(int argc, VALUE* argv, VALUE self){
     rb_raise(cKrb5Exception, "krb5_get_init_creds_keytab: %s", error_message(kerror));
   }
 
+  if(use_cache)
+    rkrb5_tgt_cache_put(ptr->princ, keytab_name, &opts, &cred);
+
+  krb5_free_cred_contents(ptr->ctx, &cred);
   krb5_get_init_creds_opt_free(ptr->ctx, opt);
 
   return self; 
 }
 
+/*
+ * call-seq:
+ *   krb5.prepare_init_creds(principal: nil, keytab: nil, service: nil, **options)
+ *
+ * Returns a Kerberos::Krb5::InitCredsSession that gets TGTs for +principal+
+ * from +keytab+. The principal is parsed, the keytab resolved and the
+ * options set up once, here, rather than on every call as with
+ * Krb5#get_init_creds_keytab. The options are the same as for that method.
+ *
+ * The session is independent of this object and may be shared by several
+ * threads.
+ *
+ * Example:
+ *
+ *   session = krb5.prepare_init_creds(
+ *     :principal      => 'svc/myhost@MY.REALM',
+ *     :keytab         => 'FILE:/etc/svc.keytab',
+ *     :renew_lifetime => 86400
+ *   )
+ *
+ *   session.acquire(ccache) # Repeatedly, from any thread
+ */
+static VALUE rkrb5_prepare_init_creds(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5* ptr;
+  VALUE v_opts, v_principal = Qnil, v_keytab = Qnil, v_service = Qnil;
+
+  Data_Get_Struct(self, RUBY_KRB5, ptr);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  rb_scan_args(argc, argv, "0:", &v_opts);
+
+  if(!NIL_P(v_opts)){
+    v_principal = rb_hash_aref2(v_opts, "principal");
+    v_keytab = rb_hash_aref2(v_opts, "keytab");
+    v_service = rb_hash_aref2(v_opts, "service");
+  }
+
+  return rkrb5_init_creds_new(v_principal, v_keytab, v_service, v_opts);
+}
+
+// Arguments for, and results of, a single Krb5#mk_req call.
+typedef struct {
+  krb5_context ctx;
+  krb5_ccache ccache;
+  krb5_creds in_creds;
+  krb5_flags ap_options;
+  krb5_data* in_data;
+  krb5_data out_data;
+  krb5_error_code kerror;
+  const char* func;
+} RKRB5_MK_REQ;
+
+static void* rkrb5_mk_req_nogvl(void* arg){
+  RKRB5_MK_REQ* req = arg;
+  krb5_auth_context auth_context = NULL;
+  krb5_creds* creds;
+
+  // Found in the cache after the first call for each server.
+  req->func = "krb5_get_credentials";
+  req->kerror = krb5_get_credentials(req->ctx, 0, req->ccache, &req->in_creds, &creds);
+
+  if(req->kerror)
+    return NULL;
+
+  req->func = "krb5_mk_req_extended";
+
+  req->kerror = krb5_mk_req_extended(
+    req->ctx,
+    &auth_context,
+    req->ap_options,
+    req->in_data,
+    creds,
+    &req->out_data
+  );
+
+  if(auth_context)
+    krb5_auth_con_free(req->ctx, auth_context);
+
+  krb5_free_creds(req->ctx, creds);
+
+  return NULL;
+}
+
+/*
+ * call-seq:
+ *   krb5.mk_req(server, ccache: nil, mutual: false, data: nil, enctype: nil)
+ *
+ * Returns an AP-REQ for the +server+ principal as a binary string, ready to
+ * be sent to the service and checked there with Acceptor#verify.
+ *
+ * The service ticket is taken from +ccache+, a CredentialsCache, or the
+ * default cache if none is given. Only the first request for each server
+ * needs a trip to the KDC, after which the ticket is stored in and reused
+ * from the cache. The GVL is released while the request is made. As with
+ * CredentialsCache#get_credentials, don't use one CredentialsCache object
+ * from several threads at once.
+ *
+ * The following options are also supported:
+ *
+ *   :mutual  => true - ask the service to prove its identity in an AP-REP
+ *   :data    => str  - application data to checksum in the authenticator
+ *   :enctype => n    - request a session key of this encryption type
+ */
+static VALUE rkrb5_mk_req(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5* ptr;
+  RKRB5_MK_REQ req;
+  krb5_error_code kerror;
+  krb5_data in_data;
+  VALUE v_server, v_opts, v_ccache = Qnil, v_data = Qnil, v_enctype = Qnil, v_req;
+
+  Data_Get_Struct(self, RUBY_KRB5, ptr);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  rb_scan_args(argc, argv, "1:", &v_server, &v_opts);
+
+  Check_Type(v_server, T_STRING);
+
+  memset(&req, 0, sizeof(req));
+
+  if(!NIL_P(v_opts)){
+    v_ccache = rb_hash_aref2(v_opts, "ccache");
+    v_data = rb_hash_aref2(v_opts, "data");
+    v_enctype = rb_hash_aref2(v_opts, "enctype");
+
+    if(RTEST(rb_hash_aref2(v_opts, "mutual")))
+      req.ap_options |= AP_OPTS_MUTUAL_REQUIRED;
+
+    if(!NIL_P(v_ccache) && !rb_obj_is_kind_of(v_ccache, cKrb5CCache))
+      rb_raise(rb_eTypeError, "ccache must be a Kerberos::Krb5::CredentialsCache");
+
+    if(!NIL_P(v_data)){
+      Check_Type(v_data, T_STRING);
+      in_data.magic = 0;
+      in_data.length = (unsigned int)RSTRING_LEN(v_data);
+      in_data.data = RSTRING_PTR(v_data);
+      req.in_data = &in_data;
+    }
+
+    if(!NIL_P(v_enctype))
+      req.in_creds.keyblock.enctype = NUM2INT(v_enctype);
+  }
+
+  // A cache handle must be used with the context it was resolved in.
+  if(NIL_P(v_ccache)){
+    req.ctx = ptr->ctx;
+    kerror = krb5_cc_default(req.ctx, &req.ccache);
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "krb5_cc_default: %s", error_message(kerror));
+  }
+  else{
+    RUBY_KRB5_CCACHE* ccptr;
+    Data_Get_Struct(v_ccache, RUBY_KRB5_CCACHE, ccptr);
+
+    if(!ccptr->ctx)
+      rb_raise(cKrb5Exception, "no context has been established");
+
+    req.ctx = ccptr->ctx;
+    req.ccache = ccptr->ccache;
+  }
+
+  kerror = krb5_parse_name(req.ctx, StringValueCStr(v_server), &req.in_creds.server);
+
+  if(!kerror)
+    kerror = krb5_cc_get_principal(req.ctx, req.ccache, &req.in_creds.client);
+
+  if(!kerror){
+    rb_thread_call_without_gvl(rkrb5_mk_req_nogvl, &req, RUBY_UBF_IO, NULL);
+    kerror = req.kerror;
+  }
+  else{
+    req.func = req.in_creds.server ? "krb5_cc_get_principal" : "krb5_parse_name";
+  }
+
+  krb5_free_cred_contents(req.ctx, &req.in_creds);
+
+  if(NIL_P(v_ccache))
+    krb5_cc_close(req.ctx, req.ccache);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "%s: %s", req.func, error_message(kerror));
+
+  v_req = rb_str_new(req.out_data.data, req.out_data.length);
+  krb5_free_data_contents(req.ctx, &req.out_data);
+
+  return v_req;
+}
+
 /* call-seq:
  *   krb5.change_password(old, new)
  *
@@ -326,26 +696,32 @@ static VALUE rkrb5_change_password(VALUE self, VALUE v_old, VALUE v_new){
 
 /*
  * call-seq:
- *   krb5.get_init_creds_password(user, password, service = nil)
+ *   krb5.get_init_creds_password(user, password, service = nil, **options)
  *
  * Authenticates the credentials of +user+ using +password+ against +service+,
  * and has the effect of setting the principal and context internally. This method
  * must typically be called before using other methods.
+ *
+ * The options are the same as those for Krb5#get_init_creds_keytab. Since a
+ * cached ticket would not prove the password is correct, the TGT cache is
+ * never consulted.
  */
 static VALUE rkrb5_get_init_creds_passwd(int argc, VALUE* argv, VALUE self){
   RUBY_KRB5* ptr;
-  VALUE v_user, v_pass, v_service;
+  VALUE v_user, v_pass, v_service, v_opts;
   char* user;
   char* pass;
   char* service;
   krb5_error_code kerror;
+  krb5_get_init_creds_opt* opt;
+  RKRB5_INIT_OPTS opts;
 
   Data_Get_Struct(self, RUBY_KRB5, ptr); 
 
   if(!ptr->ctx)
     rb_raise(cKrb5Exception, "no context has been established");
 
-  rb_scan_args(argc, argv, "21", &v_user, &v_pass, &v_service);
+  rb_scan_args(argc, argv, "21:", &v_user, &v_pass, &v_service, &v_opts);
 
   Check_Type(v_user, T_STRING);
   Check_Type(v_pass, T_STRING);
@@ -360,11 +736,29 @@ static VALUE rkrb5_get_init_creds_passwd(int argc, VALUE* argv, VALUE self){
     service = StringValueCStr(v_service);
   }
 
+  rkrb5_parse_init_opts(v_opts, &opts);
+
+  // Release anything left over from a previous call.
+  if(ptr->princ){
+    krb5_free_principal(ptr->ctx, ptr->princ);
+    ptr->princ = NULL;
+  }
+
+  krb5_free_cred_contents(ptr->ctx, &ptr->creds);
+  memset(&ptr->creds, 0, sizeof(krb5_creds));
+
   kerror = krb5_parse_name(ptr->ctx, user, &ptr->princ); 
 
   if(kerror)
     rb_raise(cKrb5Exception, "krb5_parse_name: %s", error_message(kerror));
 
+  kerror = krb5_get_init_creds_opt_alloc(ptr->ctx, &opt);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "krb5_get_init_creds_opt_alloc: %s", error_message(kerror));
+
+  rkrb5_apply_init_opts(&opts, opt);
+
   kerror = krb5_get_init_creds_password(
     ptr->ctx,
     &ptr->creds,
@@ -374,9 +768,11 @@ static VALUE rkrb5_get_init_creds_passwd(int argc, VALUE* argv, VALUE self){
     NULL,
     0,
     service,
-    NULL
+    opt
   );
 
+  krb5_get_init_creds_opt_free(ptr->ctx, opt);
+
   if(kerror)
     rb_raise(cKrb5Exception, "krb5_get_init_creds_password: %s", error_message(kerror));
 
@@ -401,11 +797,15 @@ static VALUE rkrb5_close(VALUE self){
   if(ptr->princ)
     krb5_free_principal(ptr->ctx, ptr->princ);
 
+  if(ptr->keytab)
+    krb5_kt_close(ptr->ctx, ptr->keytab);
+
   if(ptr->ctx)
     krb5_free_context(ptr->ctx);
 
   ptr->ctx = NULL;
   ptr->princ = NULL;
+  ptr->keytab = NULL;
 
   return Qtrue;
 }
@@ -526,6 +926,8 @@ void Init_rkerberos(){
   rb_define_method(cKrb5, "get_init_creds_keytab", rkrb5_get_init_creds_keytab, -1);
   rb_define_method(cKrb5, "get_default_principal", rkrb5_get_default_principal, 0);
   rb_define_method(cKrb5, "get_permitted_enctypes", rkrb5_get_permitted_enctypes, 0);
+  rb_define_method(cKrb5, "mk_req", rkrb5_mk_req, -1);
+  rb_define_method(cKrb5, "prepare_init_creds", rkrb5_prepare_init_creds, -1);
   rb_define_method(cKrb5, "set_default_realm", rkrb5_set_default_realm, -1);
 
   // Aliases
@@ -604,10 +1006,21 @@ void Init_rkerberos(){
 
   Init_context();
   Init_ccache();
+  Init_credentials();
   Init_kadm5();
   Init_config();
   Init_policy();
   Init_principal();
   Init_keytab();
   Init_keytab_entry();
+  Init_renewer();
+  Init_init_creds();
+  Init_tgt_cache();
+  Init_acceptor();
+  Init_replay_cache();
+  Init_gss();
+  Init_crypto();
+  Init_pac();
+  Init_s4u();
+  Init_verify();
 }
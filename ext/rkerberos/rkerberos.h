@@ -2,13 +2,22 @@
 #define KRB5_AUTH_H_INCLUDED
 
 #include <ruby.h>
+#include <ruby/thread.h>
 #include <krb5.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #ifdef HAVE_KADM5_ADMIN_H
 #include <kadm5/admin.h>
 #endif
 
+#ifdef HAVE_GSSAPI_GSSAPI_H
+#include <gssapi/gssapi.h>
+#include <gssapi/gssapi_ext.h>
+#include <gssapi/gssapi_krb5.h>
+#endif
+
 // Function Prototypes
 void Init_context();
 void Init_kadm5();
@@ -18,23 +27,95 @@ void Init_principal();
 void Init_keytab();
 void Init_keytab_entry();
 void Init_ccache();
+void Init_credentials();
+void Init_renewer();
+void Init_init_creds();
+void Init_tgt_cache();
+void Init_acceptor();
+void Init_replay_cache();
+void Init_gss();
+void Init_crypto();
+void Init_pac();
+void Init_s4u();
+void Init_verify();
 
 // Defined in rkerberos.c
+#define RKRB5_MAX_INIT_LIST 16
+
+typedef struct {
+  krb5_deltat lifetime;
+  krb5_deltat renew_lifetime;
+  int forwardable;
+  int proxiable;
+  int canonicalize;
+  krb5_enctype etypes[RKRB5_MAX_INIT_LIST];
+  int etype_count;
+  krb5_preauthtype preauth[RKRB5_MAX_INIT_LIST];
+  int preauth_count;
+} RKRB5_INIT_OPTS;
+
 VALUE rb_hash_aref2(VALUE, const char*);
+void rkrb5_parse_init_opts(VALUE, RKRB5_INIT_OPTS*);
+void rkrb5_apply_init_opts(RKRB5_INIT_OPTS*, krb5_get_init_creds_opt*);
+
+// Defined in pool.c
+typedef struct {
+  long count;
+  int concurrency;
+  void* data;
+  void* (*setup)(void* data);
+  void (*run)(void* data, void* state, long index);
+  void (*teardown)(void* data, void* state);
+} RKRB5_POOL_JOB;
+
+long rkrb5_pool_run(RKRB5_POOL_JOB*);
+
+// Defined in keytab.c
+void rkrb5_kt_memory_name(char*, size_t, const char*);
+void rkrb5_kt_clear_memory(krb5_context, krb5_keytab);
+krb5_error_code rkrb5_kt_load_memory(krb5_context, krb5_keytab, const char*, krb5_keytab*, const char**);
+
+// Defined in keytab_entry.c
+VALUE rkrb5_kt_entry_new(const char*, krb5_keytab_entry*);
+
+// Defined in credentials.c
+VALUE rkrb5_creds_new(krb5_context, krb5_creds*);
+
+// Defined in init_creds.c
+VALUE rkrb5_init_creds_new(VALUE, VALUE, VALUE, VALUE);
+
+// Defined in tgt_cache.c
+int rkrb5_tgt_cache_get(krb5_principal, const char*, RKRB5_INIT_OPTS*, krb5_creds*);
+void rkrb5_tgt_cache_put(krb5_principal, const char*, RKRB5_INIT_OPTS*, krb5_creds*);
+
+// Defined in pac.c
+VALUE rkrb5_pac_new(krb5_context, krb5_pac);
 
 // Variable declarations
 extern VALUE mKerberos;
 extern VALUE cKrb5;
+extern VALUE mGSS;
+extern VALUE cKrb5Acceptor;
+extern VALUE cKrb5AcceptorResult;
 extern VALUE cKrb5CCache;
 extern VALUE cKrb5Context;
+extern VALUE cKrb5Creds;
+extern VALUE cKrb5Crypto;
 extern VALUE cKrb5Keytab;
 extern VALUE cKrb5KtEntry;
+extern VALUE cKrb5Pac;
 extern VALUE cKrb5Exception;
+extern VALUE cKrb5InitCreds;
 extern VALUE cKrb5Principal;
+extern VALUE cKrb5Renewer;
+extern VALUE cKrb5ReplayCache;
 extern VALUE cKadm5;
 extern VALUE cKadm5Config;
 extern VALUE cKadm5Exception;
 extern VALUE cKadm5Policy;
+extern VALUE cGSSAcceptor;
+extern VALUE cGSSContext;
+extern VALUE cGSSException;
 
 // Kerberos::Krb5
 typedef struct {
@@ -84,6 +165,145 @@ typedef struct {
   krb5_principal principal;
 } RUBY_KRB5_CCACHE;
 
+// Kerberos::Krb5::Credentials
+typedef struct {
+  krb5_creds creds;
+} RUBY_KRB5_CREDS;
+
+// Kerberos::Krb5::Crypto
+typedef struct {
+  krb5_context ctx;
+  krb5_key key;
+  krb5_enctype enctype;
+  krb5_cksumtype cksumtype;
+  int busy;
+} RUBY_KRB5_CRYPTO;
+
+// Kerberos::Krb5::InitCredsSession
+typedef struct {
+  krb5_context ctx;
+  krb5_principal principal;
+  krb5_keytab keytab;
+  krb5_get_init_creds_opt* opt;
+  RKRB5_INIT_OPTS opts;
+  char* service;
+  pthread_mutex_t lock;
+  krb5_context* idle;
+  int idle_count;
+  int idle_capacity;
+  int busy;
+} RUBY_KRB5_INIT_CREDS;
+
+// A credentials cache watched by a Kerberos::Krb5::Renewer. The names are
+// fixed when the target is added; the status fields are guarded by the
+// renewer's lock.
+typedef struct {
+  char* ccache_name;
+  char* keytab_name;
+  char* principal;
+  long renewals;
+  krb5_timestamp last_renewal;
+  krb5_timestamp next_renewal;
+  krb5_error_code last_error;
+} RKRB5_RENEW_TARGET;
+
+// Kerberos::Krb5::Renewer
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int running;
+  int stop;
+  int refs;
+  double fraction;
+  int interval;
+  RKRB5_RENEW_TARGET** targets;
+  long count;
+  long capacity;
+} RUBY_KRB5_RENEWER;
+
+// Authenticators in a memory replay cache are grouped into buckets of this
+// many seconds by their timestamp, so that expiring old ones means emptying
+// a whole bucket.
+#define RKRB5_RC_BUCKET_SECS 10
+
+#define RKRB5_RC_NONE   1
+#define RKRB5_RC_FILE   2
+#define RKRB5_RC_MEMORY 3
+
+// One time bucket: an open addressing set of authenticator fingerprints.
+typedef struct {
+  long epoch;
+  uint64_t* keys;
+  long count;
+  long capacity;
+} RKRB5_RC_BUCKET;
+
+// Each shard has its own lock, so verifications on different threads rarely
+// wait for each other.
+typedef struct {
+  pthread_mutex_t lock;
+  RKRB5_RC_BUCKET* buckets;
+} RKRB5_RC_SHARD;
+
+// Kerberos::Krb5::ReplayCache
+typedef struct {
+  int type;
+  char* name;
+  int nshards;
+  int nbuckets;
+  int window;
+  RKRB5_RC_SHARD* shards;
+} RUBY_KRB5_RCACHE;
+
+// Defined in replay_cache.c
+int rkrb5_rcache_replay(RUBY_KRB5_RCACHE*, const char*, const char*, krb5_timestamp, krb5_int32);
+
+// A context, with a keytab resolved in it, used by one
+// Kerberos::Krb5::Acceptor verification at a time.
+typedef struct {
+  krb5_context ctx;
+  krb5_keytab keytab;
+} RKRB5_ACCEPTOR_SLOT;
+
+// Kerberos::Krb5::Acceptor
+typedef struct {
+  krb5_context ctx;
+  krb5_keytab keytab;
+  krb5_principal server;
+  char keytab_name[64];
+  char* rcache_name;
+  krb5_rcache library_rcache;
+  krb5_deltat skew;
+  RUBY_KRB5_RCACHE* rcache;
+  pthread_mutex_t lock;
+  RKRB5_ACCEPTOR_SLOT* idle;
+  int idle_count;
+  int idle_capacity;
+  int busy;
+} RUBY_KRB5_ACCEPTOR;
+
+// Kerberos::GSS::Acceptor
+typedef struct {
+  krb5_context ctx;
+  krb5_keytab keytab;
+  char keytab_name[64];
+  gss_cred_id_t cred;
+  pthread_mutex_t lock;
+  int busy;
+} RUBY_GSS_ACCEPTOR;
+
+// Kerberos::GSS::Context
+typedef struct {
+  gss_ctx_id_t ctx;
+  gss_cred_id_t delegated;
+  RUBY_GSS_ACCEPTOR* acceptor;
+  OM_uint32 flags;
+  OM_uint32 lifetime;
+  int established;
+  int busy;
+} RUBY_GSS_CONTEXT;
+
 typedef struct {
   krb5_context ctx;
   kadm5_config_params config;
@@ -0,0 +1,506 @@
+#include <rkerberos.h>
+#include <errno.h>
+
+// A process-wide LRU cache of the tickets Krb5#impersonate gets from the
+// KDC: S4U2Self evidence tickets, keyed by impersonator and user, and
+// S4U2Proxy tickets, keyed by impersonator, user and target. Entries are
+// only read and written while holding the lock, using the cache's own
+// context.
+
+// Cached tickets closer than this to their end time are not handed out.
+#define RKRB5_S4U_CACHE_MIN_LIFE 60
+
+// The least recently used ticket is evicted once the cache is this big.
+#define RKRB5_S4U_CACHE_MAX 4096
+
+// Must be a power of two.
+#define RKRB5_S4U_CACHE_BUCKETS 1024
+
+typedef struct RKRB5_S4U_ENTRY {
+  char* key;
+  size_t key_length;
+  uint64_t hash;
+  krb5_creds* creds;
+  struct RKRB5_S4U_ENTRY* chain;
+  struct RKRB5_S4U_ENTRY* newer;
+  struct RKRB5_S4U_ENTRY* older;
+} RKRB5_S4U_ENTRY;
+
+static pthread_mutex_t s4u_lock = PTHREAD_MUTEX_INITIALIZER;
+static krb5_context s4u_ctx = NULL;
+static RKRB5_S4U_ENTRY* s4u_buckets[RKRB5_S4U_CACHE_BUCKETS];
+static RKRB5_S4U_ENTRY* s4u_newest = NULL;
+static RKRB5_S4U_ENTRY* s4u_oldest = NULL;
+static long s4u_count = 0;
+static unsigned long s4u_hits = 0;
+static unsigned long s4u_misses = 0;
+static unsigned long s4u_evictions = 0;
+
+// FNV-1a, since keys may contain NUL separators.
+static uint64_t rkrb5_s4u_hash(const char* key, size_t length){
+  uint64_t hash = 14695981039346656037ULL;
+  size_t i;
+
+  for(i = 0; i < length; i++){
+    hash ^= (unsigned char)key[i];
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+// Takes +entry+ out of the recency list.
+static void rkrb5_s4u_cache_unlink(RKRB5_S4U_ENTRY* entry){
+  if(entry->newer)
+    entry->newer->older = entry->older;
+  else
+    s4u_newest = entry->older;
+
+  if(entry->older)
+    entry->older->newer = entry->newer;
+  else
+    s4u_oldest = entry->newer;
+
+  entry->newer = entry->older = NULL;
+}
+
+// Makes +entry+ the most recently used.
+static void rkrb5_s4u_cache_touch(RKRB5_S4U_ENTRY* entry){
+  entry->older = s4u_newest;
+  entry->newer = NULL;
+
+  if(s4u_newest)
+    s4u_newest->newer = entry;
+  else
+    s4u_oldest = entry;
+
+  s4u_newest = entry;
+}
+
+// Removes and frees +entry+, which must be called with the lock held.
+static void rkrb5_s4u_cache_remove(RKRB5_S4U_ENTRY* entry){
+  RKRB5_S4U_ENTRY** link = &s4u_buckets[entry->hash & (RKRB5_S4U_CACHE_BUCKETS - 1)];
+
+  while(*link != entry)
+    link = &(*link)->chain;
+
+  *link = entry->chain;
+
+  rkrb5_s4u_cache_unlink(entry);
+
+  krb5_free_creds(s4u_ctx, entry->creds);
+  free(entry->key);
+  free(entry);
+
+  s4u_count--;
+}
+
+// Finds the entry for +key+, which must be called with the lock held.
+static RKRB5_S4U_ENTRY* rkrb5_s4u_cache_find(const char* key, size_t length, uint64_t hash){
+  RKRB5_S4U_ENTRY* entry = s4u_buckets[hash & (RKRB5_S4U_CACHE_BUCKETS - 1)];
+
+  for(; entry; entry = entry->chain){
+    if(entry->hash == hash && entry->key_length == length && !memcmp(entry->key, key, length))
+      return entry;
+  }
+
+  return NULL;
+}
+
+/*
+ * Looks up the ticket for +key+. On a hit, a copy of the cached ticket is
+ * stored in +creds+, which the caller must free with krb5_free_creds, and
+ * 1 is returned. Returns 0 on a miss, including when the cached ticket is
+ * about to expire.
+ */
+static int rkrb5_s4u_cache_get(const char* key, size_t length, krb5_creds** creds){
+  RKRB5_S4U_ENTRY* entry;
+  krb5_timestamp now;
+
+  *creds = NULL;
+
+  pthread_mutex_lock(&s4u_lock);
+
+  if(s4u_ctx && krb5_timeofday(s4u_ctx, &now) == 0){
+    entry = rkrb5_s4u_cache_find(key, length, rkrb5_s4u_hash(key, length));
+
+    if(entry){
+      if(entry->creds->times.endtime - now > RKRB5_S4U_CACHE_MIN_LIFE){
+        if(krb5_copy_creds(s4u_ctx, entry->creds, creds) == 0){
+          rkrb5_s4u_cache_unlink(entry);
+          rkrb5_s4u_cache_touch(entry);
+        }
+      }
+      else{
+        rkrb5_s4u_cache_remove(entry);
+      }
+    }
+  }
+
+  if(*creds)
+    s4u_hits++;
+  else
+    s4u_misses++;
+
+  pthread_mutex_unlock(&s4u_lock);
+
+  return *creds ? 1 : 0;
+}
+
+/*
+ * Stores a copy of +creds+ under +key+, replacing any older entry and
+ * evicting the least recently used ticket if the cache is full. Failures
+ * are ignored since the cache is only an optimization.
+ */
+static void rkrb5_s4u_cache_put(const char* key, size_t length, krb5_creds* creds){
+  RKRB5_S4U_ENTRY* entry;
+  uint64_t hash = rkrb5_s4u_hash(key, length);
+
+  pthread_mutex_lock(&s4u_lock);
+
+  if(!s4u_ctx && krb5_init_context(&s4u_ctx))
+    s4u_ctx = NULL;
+
+  if(!s4u_ctx)
+    goto done;
+
+  if((entry = rkrb5_s4u_cache_find(key, length, hash)))
+    rkrb5_s4u_cache_remove(entry);
+
+  while(s4u_count >= RKRB5_S4U_CACHE_MAX){
+    rkrb5_s4u_cache_remove(s4u_oldest);
+    s4u_evictions++;
+  }
+
+  if(!(entry = calloc(1, sizeof(RKRB5_S4U_ENTRY))))
+    goto done;
+
+  if(!(entry->key = malloc(length)) || krb5_copy_creds(s4u_ctx, creds, &entry->creds)){
+    free(entry->key);
+    free(entry);
+    goto done;
+  }
+
+  memcpy(entry->key, key, length);
+  entry->key_length = length;
+  entry->hash = hash;
+  entry->chain = s4u_buckets[hash & (RKRB5_S4U_CACHE_BUCKETS - 1)];
+  s4u_buckets[hash & (RKRB5_S4U_CACHE_BUCKETS - 1)] = entry;
+
+  rkrb5_s4u_cache_touch(entry);
+  s4u_count++;
+
+  done:
+
+  pthread_mutex_unlock(&s4u_lock);
+}
+
+// Arguments for, and results of, a single Krb5#impersonate call.
+typedef struct {
+  krb5_context ctx;
+  krb5_ccache ccache;
+  krb5_principal impersonator;
+  krb5_principal user;
+  krb5_principal target;
+  char* key;
+  size_t evidence_length;
+  size_t key_length;
+  krb5_creds* creds;
+  krb5_error_code kerror;
+  const char* func;
+} RKRB5_IMPERSONATE;
+
+/*
+ * Builds the cache keys for an impersonation. The proxy ticket's key is
+ * "impersonator\0user\0target", and the evidence ticket's key is its first
+ * +evidence_length+ bytes.
+ */
+static krb5_error_code rkrb5_impersonate_key(RKRB5_IMPERSONATE* imp){
+  krb5_principal principals[3];
+  char* names[3] = {NULL, NULL, NULL};
+  size_t lengths[3], offset = 0;
+  krb5_error_code kerror = 0;
+  int i;
+
+  principals[0] = imp->impersonator;
+  principals[1] = imp->user;
+  principals[2] = imp->target;
+
+  for(i = 0; i < 3 && !kerror; i++){
+    kerror = krb5_unparse_name(imp->ctx, principals[i], &names[i]);
+
+    if(!kerror)
+      lengths[i] = strlen(names[i]) + 1;
+  }
+
+  if(!kerror){
+    imp->key_length = lengths[0] + lengths[1] + lengths[2];
+    imp->evidence_length = lengths[0] + lengths[1] - 1;
+
+    if(!(imp->key = malloc(imp->key_length)))
+      kerror = ENOMEM;
+  }
+
+  for(i = 0; i < 3 && !kerror; i++){
+    memcpy(imp->key + offset, names[i], lengths[i]);
+    offset += lengths[i];
+  }
+
+  for(i = 0; i < 3; i++){
+    if(names[i])
+      krb5_free_unparsed_name(imp->ctx, names[i]);
+  }
+
+  return kerror;
+}
+
+/*
+ * Gets a proxy ticket for the user to the target, from the cache if it
+ * can, and otherwise from the KDC with S4U2Proxy. The evidence ticket that
+ * needs is itself cached, so it only takes one KDC exchange to reach a new
+ * target for a user seen before. Does not need the GVL.
+ */
+static void* rkrb5_impersonate_nogvl(void* arg){
+  RKRB5_IMPERSONATE* imp = arg;
+  krb5_creds in_creds;
+  krb5_creds* evidence = NULL;
+  krb5_ticket* ticket = NULL;
+
+  if(rkrb5_s4u_cache_get(imp->key, imp->key_length, &imp->creds))
+    return NULL;
+
+  // Tickets are kept in our own cache rather than piling up in +ccache+.
+  if(!rkrb5_s4u_cache_get(imp->key, imp->evidence_length, &evidence)){
+    memset(&in_creds, 0, sizeof(in_creds));
+    in_creds.client = imp->user;
+    in_creds.server = imp->impersonator;
+
+    imp->func = "krb5_get_credentials_for_user";
+
+    imp->kerror = krb5_get_credentials_for_user(
+      imp->ctx,
+      KRB5_GC_NO_STORE,
+      imp->ccache,
+      &in_creds,
+      NULL,
+      &evidence
+    );
+
+    if(imp->kerror)
+      return NULL;
+
+    rkrb5_s4u_cache_put(imp->key, imp->evidence_length, evidence);
+  }
+
+  imp->func = "krb5_decode_ticket";
+
+  if((imp->kerror = krb5_decode_ticket(&evidence->ticket, &ticket)))
+    goto cleanup;
+
+  memset(&in_creds, 0, sizeof(in_creds));
+  in_creds.client = imp->impersonator;
+  in_creds.server = imp->target;
+
+  imp->func = "krb5_get_credentials_for_proxy";
+
+  imp->kerror = krb5_get_credentials_for_proxy(
+    imp->ctx,
+    KRB5_GC_NO_STORE,
+    imp->ccache,
+    &in_creds,
+    ticket,
+    &imp->creds
+  );
+
+  if(!imp->kerror)
+    rkrb5_s4u_cache_put(imp->key, imp->key_length, imp->creds);
+
+  cleanup:
+
+  if(ticket)
+    krb5_free_ticket(imp->ctx, ticket);
+
+  if(evidence)
+    krb5_free_creds(imp->ctx, evidence);
+
+  return NULL;
+}
+
+/*
+ * call-seq:
+ *   krb5.impersonate(user, target: server, ccache: nil)
+ *
+ * Returns a Credentials object holding a ticket for +user+ to the +target+
+ * service principal, obtained with constrained delegation: an S4U2Self
+ * exchange for an evidence ticket from +user+ to this service, then an
+ * S4U2Proxy exchange trading it for a ticket to +target+.
+ *
+ * The service's own TGT is taken from +ccache+, a CredentialsCache, or the
+ * default cache if none is given. Its principal must be allowed by the KDC
+ * to delegate to +target+. As with Krb5#mk_req, don't use one
+ * CredentialsCache object from several threads at once.
+ *
+ * Evidence and proxy tickets are kept in a process-wide LRU cache until
+ * shortly before they expire, so repeat calls for the same user skip both
+ * KDC exchanges. The GVL is released while talking to the KDC.
+ *
+ * Example:
+ *
+ *   creds = krb5.impersonate('alice@EXAMPLE.COM', :target => 'HTTP/backend.example.com')
+ *   cache = Kerberos::Krb5::CredentialsCache.new_unique('MEMORY', 'alice@EXAMPLE.COM')
+ *   cache.store(creds)
+ *   token = krb5.mk_req('HTTP/backend.example.com', :ccache => cache)
+ */
+static VALUE rkrb5_impersonate(int argc, VALUE* argv, VALUE self){
+  RUBY_KRB5* ptr;
+  RKRB5_IMPERSONATE imp;
+  krb5_error_code kerror;
+  krb5_creds creds;
+  char* user;
+  char* target;
+  VALUE v_user, v_opts, v_target = Qnil, v_ccache = Qnil;
+
+  Data_Get_Struct(self, RUBY_KRB5, ptr);
+
+  if(!ptr->ctx)
+    rb_raise(cKrb5Exception, "no context has been established");
+
+  rb_scan_args(argc, argv, "1:", &v_user, &v_opts);
+
+  if(!NIL_P(v_opts)){
+    v_target = rb_hash_aref2(v_opts, "target");
+    v_ccache = rb_hash_aref2(v_opts, "ccache");
+  }
+
+  if(NIL_P(v_target))
+    rb_raise(rb_eArgError, "missing keyword: :target");
+
+  Check_Type(v_user, T_STRING);
+  Check_Type(v_target, T_STRING);
+  user = StringValueCStr(v_user);
+  target = StringValueCStr(v_target);
+
+  if(!NIL_P(v_ccache) && !rb_obj_is_kind_of(v_ccache, cKrb5CCache))
+    rb_raise(rb_eTypeError, "ccache must be a Kerberos::Krb5::CredentialsCache");
+
+  memset(&imp, 0, sizeof(imp));
+
+  // A cache handle must be used with the context it was resolved in.
+  if(NIL_P(v_ccache)){
+    imp.ctx = ptr->ctx;
+    kerror = krb5_cc_default(imp.ctx, &imp.ccache);
+
+    if(kerror)
+      rb_raise(cKrb5Exception, "krb5_cc_default: %s", error_message(kerror));
+  }
+  else{
+    RUBY_KRB5_CCACHE* ccptr;
+    Data_Get_Struct(v_ccache, RUBY_KRB5_CCACHE, ccptr);
+
+    if(!ccptr->ctx)
+      rb_raise(cKrb5Exception, "no context has been established");
+
+    imp.ctx = ccptr->ctx;
+    imp.ccache = ccptr->ccache;
+  }
+
+  imp.func = "krb5_parse_name";
+  kerror = krb5_parse_name(imp.ctx, user, &imp.user);
+
+  if(!kerror)
+    kerror = krb5_parse_name(imp.ctx, target, &imp.target);
+
+  if(!kerror){
+    imp.func = "krb5_cc_get_principal";
+    kerror = krb5_cc_get_principal(imp.ctx, imp.ccache, &imp.impersonator);
+  }
+
+  if(!kerror){
+    imp.func = "krb5_unparse_name";
+    kerror = rkrb5_impersonate_key(&imp);
+  }
+
+  if(!kerror){
+    rb_thread_call_without_gvl(rkrb5_impersonate_nogvl, &imp, RUBY_UBF_IO, NULL);
+    kerror = imp.kerror;
+  }
+
+  free(imp.key);
+  krb5_free_principal(imp.ctx, imp.impersonator);
+  krb5_free_principal(imp.ctx, imp.target);
+  krb5_free_principal(imp.ctx, imp.user);
+
+  if(NIL_P(v_ccache))
+    krb5_cc_close(imp.ctx, imp.ccache);
+
+  if(kerror)
+    rb_raise(cKrb5Exception, "%s: %s", imp.func, error_message(kerror));
+
+  // Only the contents are handed over, so release the struct first.
+  creds = *imp.creds;
+  free(imp.creds);
+
+  return rkrb5_creds_new(imp.ctx, &creds);
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5.s4u_cache_stats
+ *
+ * Returns a hash with the number of :hits, :misses and :evictions for the
+ * process-wide ticket cache used by Krb5#impersonate, and its current
+ * :size. Each impersonation counts one lookup for its proxy ticket and,
+ * on a miss, another for its evidence ticket.
+ */
+static VALUE rkrb5_s_s4u_cache_stats(VALUE klass){
+  unsigned long hits, misses, evictions;
+  long size;
+  VALUE v_stats;
+
+  pthread_mutex_lock(&s4u_lock);
+  hits = s4u_hits;
+  misses = s4u_misses;
+  evictions = s4u_evictions;
+  size = s4u_count;
+  pthread_mutex_unlock(&s4u_lock);
+
+  v_stats = rb_hash_new();
+
+  rb_hash_aset(v_stats, ID2SYM(rb_intern("hits")), ULONG2NUM(hits));
+  rb_hash_aset(v_stats, ID2SYM(rb_intern("misses")), ULONG2NUM(misses));
+  rb_hash_aset(v_stats, ID2SYM(rb_intern("evictions")), ULONG2NUM(evictions));
+  rb_hash_aset(v_stats, ID2SYM(rb_intern("size")), LONG2NUM(size));
+
+  return v_stats;
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5.clear_s4u_cache
+ *
+ * Removes every ticket from the process-wide impersonation ticket cache and
+ * resets its counters.
+ */
+static VALUE rkrb5_s_clear_s4u_cache(VALUE klass){
+  pthread_mutex_lock(&s4u_lock);
+
+  while(s4u_oldest)
+    rkrb5_s4u_cache_remove(s4u_oldest);
+
+  s4u_hits = 0;
+  s4u_misses = 0;
+  s4u_evictions = 0;
+
+  pthread_mutex_unlock(&s4u_lock);
+
+  return klass;
+}
+
+void Init_s4u(){
+  // Singleton Methods
+  rb_define_singleton_method(cKrb5, "clear_s4u_cache", rkrb5_s_clear_s4u_cache, 0);
+  rb_define_singleton_method(cKrb5, "s4u_cache_stats", rkrb5_s_s4u_cache_stats, 0);
+
+  // Instance Methods
+  rb_define_method(cKrb5, "impersonate", rkrb5_impersonate, -1);
+}
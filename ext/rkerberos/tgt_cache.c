@@ -0,0 +1,197 @@
+#include <rkerberos.h>
+
+// A process-wide cache of TGTs keyed by the principal they were requested
+// for, the keytab they were requested with and the request options, so that
+// separate Krb5 objects in one process don't each ask the KDC for the same
+// ticket. Entries are only read and written while holding the lock, using
+// the cache's own context.
+
+// Cached tickets closer than this to their end time are not handed out.
+#define RKRB5_TGT_CACHE_MIN_LIFE 60
+
+typedef struct {
+  krb5_principal principal;
+  char* keytab_name;
+  RKRB5_INIT_OPTS opts;
+  krb5_creds* creds;
+} RKRB5_TGT_ENTRY;
+
+static pthread_mutex_t tgt_lock = PTHREAD_MUTEX_INITIALIZER;
+static krb5_context tgt_ctx = NULL;
+static RKRB5_TGT_ENTRY* tgt_entries = NULL;
+static long tgt_count = 0;
+static long tgt_capacity = 0;
+static unsigned long tgt_hits = 0;
+static unsigned long tgt_misses = 0;
+
+// Removes entry +i+, which must be called with the lock held.
+static void rkrb5_tgt_cache_remove(long i){
+  krb5_free_principal(tgt_ctx, tgt_entries[i].principal);
+  free(tgt_entries[i].keytab_name);
+  krb5_free_creds(tgt_ctx, tgt_entries[i].creds);
+  tgt_entries[i] = tgt_entries[--tgt_count];
+}
+
+// Returns whether entry +i+ is still usable at +now+.
+static int rkrb5_tgt_cache_valid(long i, krb5_timestamp now){
+  return tgt_entries[i].creds->times.endtime - now > RKRB5_TGT_CACHE_MIN_LIFE;
+}
+
+// Returns whether entry +i+ was requested the same way.
+static int rkrb5_tgt_cache_match(long i, krb5_principal principal, const char* keytab_name, RKRB5_INIT_OPTS* opts){
+  return !strcmp(tgt_entries[i].keytab_name, keytab_name) &&
+    !memcmp(&tgt_entries[i].opts, opts, sizeof(RKRB5_INIT_OPTS)) &&
+    krb5_principal_compare(tgt_ctx, tgt_entries[i].principal, principal);
+}
+
+/*
+ * Looks up a TGT for +principal+ from the keytab named +keytab_name+ with
+ * +opts+, which must have been filled by rkrb5_parse_init_opts. On a hit,
+ * a copy of the cached ticket is stored in +creds+, which the caller must
+ * free, and 1 is returned. Returns 0 on a miss, including when the cached
+ * ticket is about to expire.
+ */
+int rkrb5_tgt_cache_get(krb5_principal principal, const char* keytab_name, RKRB5_INIT_OPTS* opts, krb5_creds* creds){
+  krb5_creds* copy = NULL;
+  krb5_timestamp now;
+  long i;
+
+  pthread_mutex_lock(&tgt_lock);
+
+  if(tgt_ctx && krb5_timeofday(tgt_ctx, &now) == 0){
+    for(i = 0; i < tgt_count; i++){
+      if(rkrb5_tgt_cache_match(i, principal, keytab_name, opts)){
+        if(rkrb5_tgt_cache_valid(i, now))
+          krb5_copy_creds(tgt_ctx, tgt_entries[i].creds, &copy);
+        else
+          rkrb5_tgt_cache_remove(i);
+
+        break;
+      }
+    }
+  }
+
+  if(copy){
+    *creds = *copy;
+    free(copy);
+    tgt_hits++;
+  }
+  else{
+    tgt_misses++;
+  }
+
+  pthread_mutex_unlock(&tgt_lock);
+
+  return copy ? 1 : 0;
+}
+
+/*
+ * Stores a copy of +creds+ as the TGT for +principal+, +keytab_name+ and
+ * +opts+, replacing any older entry. Expired entries are dropped at the
+ * same time. Failures are ignored since the cache is only an optimization.
+ */
+void rkrb5_tgt_cache_put(krb5_principal principal, const char* keytab_name, RKRB5_INIT_OPTS* opts, krb5_creds* creds){
+  RKRB5_TGT_ENTRY entry;
+  krb5_timestamp now;
+  long i;
+
+  pthread_mutex_lock(&tgt_lock);
+
+  if(!tgt_ctx && krb5_init_context(&tgt_ctx))
+    tgt_ctx = NULL;
+
+  if(!tgt_ctx || krb5_timeofday(tgt_ctx, &now))
+    goto done;
+
+  for(i = tgt_count - 1; i >= 0; i--){
+    if(!rkrb5_tgt_cache_valid(i, now) || rkrb5_tgt_cache_match(i, principal, keytab_name, opts))
+      rkrb5_tgt_cache_remove(i);
+  }
+
+  if(tgt_count == tgt_capacity){
+    long capacity = tgt_capacity ? tgt_capacity * 2 : 8;
+    RKRB5_TGT_ENTRY* entries = realloc(tgt_entries, capacity * sizeof(RKRB5_TGT_ENTRY));
+
+    if(!entries)
+      goto done;
+
+    tgt_entries = entries;
+    tgt_capacity = capacity;
+  }
+
+  if(krb5_copy_principal(tgt_ctx, principal, &entry.principal))
+    goto done;
+
+  if(!(entry.keytab_name = strdup(keytab_name))){
+    krb5_free_principal(tgt_ctx, entry.principal);
+    goto done;
+  }
+
+  if(krb5_copy_creds(tgt_ctx, creds, &entry.creds)){
+    krb5_free_principal(tgt_ctx, entry.principal);
+    free(entry.keytab_name);
+    goto done;
+  }
+
+  entry.opts = *opts;
+
+  tgt_entries[tgt_count++] = entry;
+
+  done:
+
+  pthread_mutex_unlock(&tgt_lock);
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5.tgt_cache_stats
+ *
+ * Returns a hash with the number of :hits and :misses for the process-wide
+ * TGT cache used by Krb5#get_init_creds_keytab, and its current :size.
+ */
+static VALUE rkrb5_s_tgt_cache_stats(VALUE klass){
+  unsigned long hits, misses;
+  long size;
+  VALUE v_stats;
+
+  pthread_mutex_lock(&tgt_lock);
+  hits = tgt_hits;
+  misses = tgt_misses;
+  size = tgt_count;
+  pthread_mutex_unlock(&tgt_lock);
+
+  v_stats = rb_hash_new();
+
+  rb_hash_aset(v_stats, ID2SYM(rb_intern("hits")), ULONG2NUM(hits));
+  rb_hash_aset(v_stats, ID2SYM(rb_intern("misses")), ULONG2NUM(misses));
+  rb_hash_aset(v_stats, ID2SYM(rb_intern("size")), LONG2NUM(size));
+
+  return v_stats;
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5.clear_tgt_cache
+ *
+ * Removes every ticket from the process-wide TGT cache and resets its
+ * counters.
+ */
+static VALUE rkrb5_s_clear_tgt_cache(VALUE klass){
+  pthread_mutex_lock(&tgt_lock);
+
+  while(tgt_count > 0)
+    rkrb5_tgt_cache_remove(tgt_count - 1);
+
+  tgt_hits = 0;
+  tgt_misses = 0;
+
+  pthread_mutex_unlock(&tgt_lock);
+
+  return klass;
+}
+
+void Init_tgt_cache(){
+  // Singleton Methods
+  rb_define_singleton_method(cKrb5, "clear_tgt_cache", rkrb5_s_clear_tgt_cache, 0);
+  rb_define_singleton_method(cKrb5, "tgt_cache_stats", rkrb5_s_tgt_cache_stats, 0);
+}
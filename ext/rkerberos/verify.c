@@ -0,0 +1,370 @@
+#include <rkerberos.h>
+#include <stdio.h>
+#include <errno.h>
+
+// Process-wide state for Kerberos::Krb5.verify_password. Contexts are kept
+// on an idle list between calls, and each verification keytab is copied
+// into a MEMORY keytab the first time it's named, so a call allocates
+// nothing that outlives it. Both are only touched while holding the lock.
+// MIT keeps MEMORY keytabs after their last handle is closed, so each copy
+// is counted by the table and by every call using it, and its entries are
+// removed when the last of them lets go. Copies are never given the same
+// name twice, so one dropped by Krb5.clear_verify_keytabs can't be confused
+// with its reloaded copy.
+
+typedef struct {
+  char* name;
+  char memory_name[64];
+  krb5_keytab keytab;
+  long refs;
+} RKRB5_VERIFY_KEYTAB;
+
+static pthread_mutex_t verify_lock = PTHREAD_MUTEX_INITIALIZER;
+static krb5_context verify_ctx = NULL;
+static RKRB5_VERIFY_KEYTAB** verify_keytabs = NULL;
+static long verify_keytab_count = 0;
+static krb5_context* verify_idle = NULL;
+static long verify_idle_count = 0;
+static long verify_idle_capacity = 0;
+
+// Arguments for, and results of, a single Krb5.verify_password call.
+typedef struct {
+  const char* user;
+  const char* password;
+  const char* keytab_name;
+  krb5_error_code kerror;
+  const char* func;
+} RKRB5_VERIFY_PASSWORD;
+
+// Drops a reference to +entry+, emptying and freeing the copy once nothing
+// uses it. Must be called with the lock held.
+static void rkrb5_verify_keytab_unref(RKRB5_VERIFY_KEYTAB* entry){
+  if(--entry->refs > 0)
+    return;
+
+  rkrb5_kt_clear_memory(verify_ctx, entry->keytab);
+  krb5_kt_close(verify_ctx, entry->keytab);
+  free(entry->name);
+  free(entry);
+}
+
+/*
+ * Finds the MEMORY keytab holding a copy of the keytab called +name+, or
+ * the default keytab if +name+ is NULL, loading it on first use, and
+ * resolves it in +ctx+. The copy is stored in +used+ with a reference
+ * taken under the lock, so it lives until rkrb5_verify_keytab_release is
+ * called even if the keytabs are cleared meanwhile.
+ */
+static krb5_error_code rkrb5_verify_keytab(krb5_context ctx, const char* name, krb5_keytab* keytab, RKRB5_VERIFY_KEYTAB** used, const char** func){
+  RKRB5_VERIFY_KEYTAB** keytabs;
+  RKRB5_VERIFY_KEYTAB* entry = NULL;
+  krb5_keytab source;
+  krb5_error_code kerror = 0;
+  long i;
+
+  *used = NULL;
+
+  pthread_mutex_lock(&verify_lock);
+
+  for(i = 0; i < verify_keytab_count && !entry; i++){
+    if(name ? verify_keytabs[i]->name && !strcmp(verify_keytabs[i]->name, name) : !verify_keytabs[i]->name)
+      entry = verify_keytabs[i];
+  }
+
+  if(entry)
+    goto done;
+
+  *func = "krb5_init_context";
+
+  if(!verify_ctx && (kerror = krb5_init_context(&verify_ctx))){
+    verify_ctx = NULL;
+    goto done;
+  }
+
+  *func = "realloc";
+  keytabs = realloc(verify_keytabs, (verify_keytab_count + 1) * sizeof(RKRB5_VERIFY_KEYTAB*));
+
+  if(!keytabs){
+    kerror = ENOMEM;
+    goto done;
+  }
+
+  verify_keytabs = keytabs;
+
+  *func = "malloc";
+  entry = malloc(sizeof(RKRB5_VERIFY_KEYTAB));
+
+  if(!entry){
+    kerror = ENOMEM;
+    goto done;
+  }
+
+  memset(entry, 0, sizeof(RKRB5_VERIFY_KEYTAB));
+
+  *func = "krb5_kt_resolve";
+
+  if(name)
+    kerror = krb5_kt_resolve(verify_ctx, name, &source);
+  else
+    kerror = krb5_kt_default(verify_ctx, &source);
+
+  if(!kerror){
+    rkrb5_kt_memory_name(entry->memory_name, sizeof(entry->memory_name), "rkerberos_verify");
+    kerror = rkrb5_kt_load_memory(verify_ctx, source, entry->memory_name, &entry->keytab, func);
+    krb5_kt_close(verify_ctx, source);
+  }
+
+  if(!kerror && name && !(entry->name = strdup(name))){
+    rkrb5_kt_clear_memory(verify_ctx, entry->keytab);
+    krb5_kt_close(verify_ctx, entry->keytab);
+    kerror = ENOMEM;
+  }
+
+  if(kerror){
+    free(entry);
+    entry = NULL;
+  }
+  else{
+    // The table's own reference.
+    entry->refs = 1;
+    verify_keytabs[verify_keytab_count++] = entry;
+  }
+
+  done:
+
+  if(entry){
+    *func = "krb5_kt_resolve";
+    kerror = krb5_kt_resolve(ctx, entry->memory_name, keytab);
+
+    if(!kerror){
+      entry->refs++;
+      *used = entry;
+    }
+  }
+
+  pthread_mutex_unlock(&verify_lock);
+
+  return kerror;
+}
+
+// Lets go of a copy taken by rkrb5_verify_keytab.
+static void rkrb5_verify_keytab_release(RKRB5_VERIFY_KEYTAB* entry){
+  pthread_mutex_lock(&verify_lock);
+  rkrb5_verify_keytab_unref(entry);
+  pthread_mutex_unlock(&verify_lock);
+}
+
+// Takes a context from the idle list, or makes a new one if it's empty.
+static krb5_error_code rkrb5_verify_context_get(krb5_context* ctx){
+  *ctx = NULL;
+
+  pthread_mutex_lock(&verify_lock);
+
+  if(verify_idle_count > 0)
+    *ctx = verify_idle[--verify_idle_count];
+
+  pthread_mutex_unlock(&verify_lock);
+
+  return *ctx ? 0 : krb5_init_context(ctx);
+}
+
+// Returns a context to the idle list, freeing it if the list can't grow.
+static void rkrb5_verify_context_put(krb5_context ctx){
+  krb5_context* idle;
+
+  pthread_mutex_lock(&verify_lock);
+
+  if(verify_idle_count == verify_idle_capacity){
+    idle = realloc(verify_idle, sizeof(krb5_context) * (verify_idle_capacity + 16));
+
+    if(idle){
+      verify_idle = idle;
+      verify_idle_capacity += 16;
+    }
+  }
+
+  if(verify_idle_count < verify_idle_capacity){
+    verify_idle[verify_idle_count++] = ctx;
+    ctx = NULL;
+  }
+
+  pthread_mutex_unlock(&verify_lock);
+
+  if(ctx)
+    krb5_free_context(ctx);
+}
+
+/*
+ * Gets a TGT with the password, then checks that it really came from our
+ * KDC by getting a ticket to a service in the keytab and decrypting it.
+ * Does not need the GVL.
+ */
+static void* rkrb5_verify_password_nogvl(void* arg){
+  RKRB5_VERIFY_PASSWORD* v = arg;
+  krb5_context ctx;
+  krb5_principal principal = NULL;
+  krb5_keytab keytab = NULL;
+  RKRB5_VERIFY_KEYTAB* entry = NULL;
+  krb5_creds creds;
+  krb5_verify_init_creds_opt opt;
+
+  memset(&creds, 0, sizeof(creds));
+
+  v->func = "krb5_init_context";
+
+  if((v->kerror = rkrb5_verify_context_get(&ctx)))
+    return NULL;
+
+  if((v->kerror = rkrb5_verify_keytab(ctx, v->keytab_name, &keytab, &entry, &v->func)))
+    goto cleanup;
+
+  v->func = "krb5_parse_name";
+
+  if((v->kerror = krb5_parse_name(ctx, v->user, &principal)))
+    goto cleanup;
+
+  v->func = "krb5_get_init_creds_password";
+
+  v->kerror = krb5_get_init_creds_password(
+    ctx,
+    &creds,
+    principal,
+    v->password,
+    NULL,
+    NULL,
+    0,
+    NULL,
+    NULL
+  );
+
+  if(v->kerror)
+    goto cleanup;
+
+  // Fail rather than skip the check if the keytab has no usable key.
+  krb5_verify_init_creds_opt_init(&opt);
+  krb5_verify_init_creds_opt_set_ap_req_nofail(&opt, 1);
+
+  v->func = "krb5_verify_init_creds";
+  v->kerror = krb5_verify_init_creds(ctx, &creds, NULL, keytab, NULL, &opt);
+
+  cleanup:
+
+  if(keytab)
+    krb5_kt_close(ctx, keytab);
+
+  if(entry)
+    rkrb5_verify_keytab_release(entry);
+
+  if(principal)
+    krb5_free_principal(ctx, principal);
+
+  krb5_free_cred_contents(ctx, &creds);
+
+  rkrb5_verify_context_put(ctx);
+
+  return NULL;
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5.verify_password(user, password, verify_keytab: nil)
+ *
+ * Returns true if +password+ is correct for +user+, or false if the KDC
+ * rejects it or doesn't know the user. Any other failure raises a
+ * Kerberos::Krb5::Exception.
+ *
+ * A correct password alone is not enough, since whoever answers as the KDC
+ * could have made the reply. The TGT is also checked with
+ * krb5_verify_init_creds, which gets a ticket to a service in the
+ * +verify_keytab+ and decrypts it. The keytab may be given by name or as a
+ * Keytab object, and is the default keytab if omitted. It must contain a
+ * key for a service principal in the user's realm.
+ *
+ * Each keytab is read into memory the first time it's used and kept until
+ * Krb5.clear_verify_keytabs is called, so changes to the file are not seen
+ * before then.
+ * Contexts are pooled between calls, so no state is kept for a call once it
+ * returns. Calls may be made concurrently from any number of threads, and
+ * the GVL is released while talking to the KDC.
+ *
+ * Example:
+ *
+ *   if Kerberos::Krb5.verify_password(user, password, :verify_keytab => '/etc/krb5.keytab')
+ *     # logged in
+ *   end
+ */
+static VALUE rkrb5_s_verify_password(int argc, VALUE* argv, VALUE klass){
+  RKRB5_VERIFY_PASSWORD v;
+  VALUE v_user, v_password, v_opts, v_keytab = Qnil;
+
+  rb_scan_args(argc, argv, "2:", &v_user, &v_password, &v_opts);
+
+  if(!NIL_P(v_opts))
+    v_keytab = rb_hash_aref2(v_opts, "verify_keytab");
+
+  if(rb_obj_is_kind_of(v_keytab, cKrb5Keytab))
+    v_keytab = rb_iv_get(v_keytab, "@name");
+
+  Check_Type(v_user, T_STRING);
+  Check_Type(v_password, T_STRING);
+
+  if(!NIL_P(v_keytab))
+    Check_Type(v_keytab, T_STRING);
+
+  // Frozen copies can't be changed by another thread while we run.
+  v_user = rb_str_new_frozen(v_user);
+  v_password = rb_str_new_frozen(v_password);
+
+  memset(&v, 0, sizeof(v));
+  v.user = StringValueCStr(v_user);
+  v.password = StringValueCStr(v_password);
+
+  if(!NIL_P(v_keytab)){
+    v_keytab = rb_str_new_frozen(v_keytab);
+    v.keytab_name = StringValueCStr(v_keytab);
+  }
+
+  rb_thread_call_without_gvl(rkrb5_verify_password_nogvl, &v, RUBY_UBF_IO, NULL);
+
+  RB_GC_GUARD(v_user);
+  RB_GC_GUARD(v_password);
+  RB_GC_GUARD(v_keytab);
+
+  switch(v.kerror){
+    case 0:
+      return Qtrue;
+    case KRB5KDC_ERR_PREAUTH_FAILED:
+    case KRB5KRB_AP_ERR_BAD_INTEGRITY:
+    case KRB5KDC_ERR_C_PRINCIPAL_UNKNOWN:
+      if(!strcmp(v.func, "krb5_get_init_creds_password"))
+        return Qfalse;
+  }
+
+  rb_raise(cKrb5Exception, "%s: %s", v.func, error_message(v.kerror));
+}
+
+/*
+ * call-seq:
+ *   Kerberos::Krb5.clear_verify_keytabs
+ *
+ * Discards the in-memory copies of the keytabs used by
+ * Krb5.verify_password, so each is read again the next time it's used.
+ * Call this after a keytab has been rotated. Calls already in progress
+ * finish with the old copy, which is emptied once the last of them is done.
+ */
+static VALUE rkrb5_s_clear_verify_keytabs(VALUE klass){
+  pthread_mutex_lock(&verify_lock);
+
+  while(verify_keytab_count > 0)
+    rkrb5_verify_keytab_unref(verify_keytabs[--verify_keytab_count]);
+
+  pthread_mutex_unlock(&verify_lock);
+
+  return klass;
+}
+
+void Init_verify(){
+  // Singleton Methods
+  rb_define_singleton_method(cKrb5, "clear_verify_keytabs", rkrb5_s_clear_verify_keytabs, 0);
+  rb_define_singleton_method(cKrb5, "verify_password", rkrb5_s_verify_password, -1);
+}
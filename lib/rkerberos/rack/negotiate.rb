@@ -0,0 +1,165 @@
+require 'digest/sha2'
+require 'rkerberos'
+
+module Kerberos
+  module Rack
+    # Rack middleware that authenticates requests with HTTP Negotiate
+    # (SPNEGO) using a Kerberos::GSS::Acceptor.
+    #
+    # Clients on keep-alive connections often send the same Authorization
+    # header with every request. Successful verifications are remembered,
+    # keyed by a SHA-256 digest of the token and the client's address and
+    # port, so repeated headers on one connection are answered from memory.
+    # A remembered token is not checked against the replay cache again, so
+    # it's only kept for the :keep_alive timeout, or until the ticket ends
+    # if that's sooner. The same header sent from another connection is
+    # verified, and caught by the replay cache, as usual.
+    #
+    # Only single-leg Kerberos negotiation is supported. A token that
+    # needs a further leg to complete is rejected rather than answered
+    # with a continuation, since the next request could not resume it.
+    #
+    # On success the client principal is put in env['REMOTE_USER'] and
+    # env['kerberos.client_name'].
+    #
+    # Example:
+    #
+    #   use Kerberos::Rack::Negotiate, :keytab => '/etc/krb5.keytab'
+    #
+    class Negotiate
+      # A remembered verification.
+      Result = Struct.new(:client_name, :output_token, :expires_at)
+
+      # Counter names, in the order they're reported by #stats.
+      COUNTERS = [:hits, :misses, :failures, :challenges, :evictions].freeze
+
+      # Creates the middleware for +app+. The following options are supported:
+      #
+      #   :acceptor   => a Kerberos::GSS::Acceptor to use
+      #   :keytab     => a keytab for a new acceptor, if none was given
+      #   :cache_size => the most verifications to remember (default 10000)
+      #   :keep_alive => the seconds to remember a verification, which should
+      #                  match the server's keep-alive timeout (default 5)
+      #
+      def initialize(app, options = {})
+        @app        = app
+        @acceptor   = options[:acceptor] || Kerberos::GSS::Acceptor.new(:keytab => options[:keytab])
+        @cache_size = options.fetch(:cache_size, 10_000)
+        @keep_alive = options.fetch(:keep_alive, 5)
+        @cache      = {}
+        @counters   = Hash[COUNTERS.map{ |name| [name, 0] }]
+        @lock       = Mutex.new
+      end
+
+      def call(env)
+        header = env['HTTP_AUTHORIZATION'].to_s
+        match  = header.match(/\ANegotiate\s+(\S+)/i)
+
+        return challenge unless match
+
+        token  = match[1].unpack('m').first
+        key    = cache_key(env, token)
+        result = lookup(key) || verify(key, token)
+
+        return challenge unless result
+
+        env['REMOTE_USER'] = result.client_name
+        env['kerberos.client_name'] = result.client_name
+
+        status, headers, body = @app.call(env)
+
+        if result.output_token
+          headers = headers.merge('www-authenticate' => negotiate(result.output_token))
+        end
+
+        [status, headers, body]
+      end
+
+      # Returns a hash of the counters, and the number of verifications
+      # currently remembered as :size.
+      def stats
+        @lock.synchronize{ @counters.merge(:size => @cache.size) }
+      end
+
+      # Forgets every remembered verification.
+      def clear
+        @lock.synchronize{ @cache.clear }
+      end
+
+      private
+
+      # Memos are only shared by requests from the same client address and
+      # port, which in practice means the same connection.
+      def cache_key(env, token)
+        Digest::SHA256.digest([env['REMOTE_ADDR'], env['REMOTE_PORT'], token].join("\0"))
+      end
+
+      def lookup(key)
+        @lock.synchronize do
+          result = @cache[key]
+
+          if result && result.expires_at > Time.now
+            @counters[:hits] += 1
+            return result
+          end
+
+          @cache.delete(key) if result
+          @counters[:misses] += 1
+        end
+
+        nil
+      end
+
+      # Verifies +token+ and returns a Result, remembered under +key+, or nil
+      # if it was rejected or needs another leg.
+      def verify(key, token)
+        context = @acceptor.accept(token)
+
+        unless context.established?
+          @lock.synchronize{ @counters[:failures] += 1 }
+          return nil
+        end
+
+        expires_at = Time.now + [context.lifetime, @keep_alive].min
+        result = Result.new(context.client_name, context.output_token, expires_at)
+        store(key, result)
+
+        result
+      rescue Kerberos::GSS::Exception
+        @lock.synchronize{ @counters[:failures] += 1 }
+        nil
+      ensure
+        context.close if context
+      end
+
+      def store(key, result)
+        return if @cache_size < 1
+
+        @lock.synchronize do
+          if @cache.size >= @cache_size
+            now = Time.now
+            @cache.delete_if{ |_, cached| cached.expires_at <= now }
+
+            # Hashes keep insertion order, so the first entries are the oldest.
+            while @cache.size >= @cache_size
+              @cache.delete(@cache.first.first)
+              @counters[:evictions] += 1
+            end
+          end
+
+          @cache[key] = result
+        end
+      end
+
+      def challenge
+        @lock.synchronize{ @counters[:challenges] += 1 }
+
+        [401, {'www-authenticate' => 'Negotiate', 'content-type' => 'text/plain'}, ['Unauthorized']]
+      end
+
+      def negotiate(token)
+        'Negotiate ' + [token].pack('m0')
+      end
+    end
+  end
+end
@@ -0,0 +1,161 @@
+########################################################################
+# test_acceptor.rb
+#
+# Tests for the Kerberos::Krb5::Acceptor class.
+########################################################################
+require 'rubygems'
+gem 'test-unit'
+
+require 'test/unit'
+require 'rkerberos'
+
+class TC_Krb5_Acceptor < Test::Unit::TestCase
+  # A logon info buffer built from the values in the MS-PAC example: user
+  # lzhu in the NTDEV domain, with three groups and one extra SID.
+  LOGON_INFO = [<<-EOS.delete("\n ")].pack('H*').freeze
+    01100800ccccccccd001000000000000000002000049d90e656ac601ffffffff
+    ffffff7fffffffffffffff7f00c4e32c8362c60100844d574c63c601ffffffff
+    ffffff7f08000800040002002400240008000200120012000c00020000000000
+    00000000000000000000000000000000000000005410000097792c0001020000
+    030000001c000200200000000000000000000000000000000000000016001600
+    200002000a000a00240002002800020000000000000000001000000000000000
+    ffffffffffffff7fffffffffffffff7f0000000000000000010000002c000200
+    0000000000000000000000000400000000000000040000006c007a0068007500
+    1200000000000000120000004c0069007100690061006e00670028004c006100
+    720072007900290020005a00680075000900000000000000090000006e007400
+    6400730032002e00620061007400000003000000010200000700000068040000
+    0700000069040000070000000b000000000000000b0000004e00540044004500
+    56002d00440043002d003000350000000500000000000000050000004e005400
+    4400450056000000040000000104000000000005150000005951b81766725d25
+    64633b0b01000000300002000700000001000000010100000000001201000000
+  EOS
+
+  def setup
+    @keytab   = 'MEMORY:test_acceptor'
+    @acceptor = Kerberos::Krb5::Acceptor.new(:keytab => @keytab, :rcache => 'none:')
+  end
+
+  test "constructor accepts a keytab object" do
+    keytab = Kerberos::Krb5::Keytab.new(@keytab)
+    assert_nothing_raised{ Kerberos::Krb5::Acceptor.new(:keytab => keytab).close }
+  end
+
+  test "constructor validates its options" do
+    assert_raise(TypeError){ Kerberos::Krb5::Acceptor.new(:keytab => 1) }
+    assert_raise(TypeError){ Kerberos::Krb5::Acceptor.new(:rcache => 1) }
+    assert_raise(TypeError){ Kerberos::Krb5::Acceptor.new(:server => 1) }
+    assert_raise(TypeError){ Kerberos::Krb5::Acceptor.new(true) }
+  end
+
+  test "verify basic functionality" do
+    assert_respond_to(@acceptor, :verify)
+  end
+
+  test "verify requires a string argument" do
+    assert_raise(TypeError){ @acceptor.verify(1) }
+    assert_raise(ArgumentError){ @acceptor.verify }
+  end
+
+  test "verify rejects a malformed token" do
+    assert_raise(Kerberos::Krb5::Exception){ @acceptor.verify('bogus') }
+  end
+
+  test "verify may be called concurrently" do
+    threads = 4.times.map{ Thread.new{ @acceptor.verify('bogus') rescue $!.class } }
+    assert_equal([Kerberos::Krb5::Exception] * 4, threads.map(&:value))
+  end
+
+  test "verify_many basic functionality" do
+    assert_respond_to(@acceptor, :verify_many)
+    assert_equal([], @acceptor.verify_many([]))
+  end
+
+  test "verify_many returns a result for each token in order" do
+    results = @acceptor.verify_many(['bogus'] * 10, :concurrency => 3)
+    assert_equal(10, results.size)
+    results.each{ |result| assert_kind_of(Kerberos::Krb5::Exception, result) }
+  end
+
+  test "verify_many validates its arguments" do
+    assert_raise(TypeError){ @acceptor.verify_many('bogus') }
+    assert_raise(TypeError){ @acceptor.verify_many([1]) }
+    assert_raise(ArgumentError){ @acceptor.verify_many([], :concurrency => 0) }
+  end
+
+  test "result accessors" do
+    [:client, :server, :authtime, :starttime, :endtime, :flags, :enctype, :authdata, :pac].each{ |m|
+      assert_true(Kerberos::Krb5::Acceptor::Result.method_defined?(m))
+    }
+  end
+
+  test "pac accessors and constants" do
+    [:buffer, :types, :logon_info, :group_sids].each{ |m|
+      assert_true(Kerberos::Krb5::Pac.method_defined?(m))
+    }
+    assert_equal(1, Kerberos::Krb5::Pac::LOGON_INFO)
+    assert_equal(12, Kerberos::Krb5::Pac::UPN_DNS_INFO)
+  end
+
+  test "pacs cannot be created directly" do
+    assert_raise(NoMethodError){ Kerberos::Krb5::Pac.new }
+  end
+
+  test "decode_logon_info decodes a logon info buffer" do
+    info = Kerberos::Krb5::Pac.decode_logon_info(LOGON_INFO)
+    domain = 'S-1-5-21-397955417-626881126-188441444'
+    assert_true(info.frozen?)
+    assert_equal('lzhu', info[:effective_name])
+    assert_equal('Liqiang(Larry) Zhu', info[:full_name])
+    assert_equal(Encoding::UTF_8, info[:full_name].encoding)
+    assert_equal('ntds2.bat', info[:logon_script])
+    assert_nil(info[:profile_path])
+    assert_equal('NTDEV-DC-05', info[:logon_server])
+    assert_equal('NTDEV', info[:logon_domain_name])
+    assert_equal(4180, info[:logon_count])
+    assert_equal(0x10, info[:user_account_control])
+    assert_equal(Time.utc(2006, 4, 28, 1, 42, 50), info[:logon_time])
+    assert_nil(info[:logoff_time])
+    assert_equal(domain, info[:logon_domain_sid])
+    assert_equal("#{domain}-2914711", info[:user_sid])
+    assert_equal("#{domain}-513", info[:primary_group_sid])
+    assert_equal(['S-1-18-1'], info[:extra_sids])
+    assert_equal([513, 1128, 1129].map{ |rid| "#{domain}-#{rid}" } + ['S-1-18-1'], info[:group_sids])
+  end
+
+  test "decode_logon_info replaces invalid UTF-16" do
+    buffer = LOGON_INFO.dup
+    buffer[buffer.index("l\0z\0h\0u\0".b) + 4, 2] = "\x00\xD8".b
+    name = Kerberos::Krb5::Pac.decode_logon_info(buffer)[:effective_name]
+    assert_equal("lz\uFFFDu", name)
+    assert_true(name.valid_encoding?)
+  end
+
+  test "decode_logon_info rejects truncated buffers" do
+    [0, 16, 100, LOGON_INFO.bytesize - 20].each{ |length|
+      assert_raise(Kerberos::Krb5::Exception){ Kerberos::Krb5::Pac.decode_logon_info(LOGON_INFO.byteslice(0, length)) }
+    }
+  end
+
+  test "decode_logon_info rejects malformed buffers" do
+    buffer = LOGON_INFO.dup
+    buffer.setbyte(0, 2)
+    assert_raise(Kerberos::Krb5::Exception){ Kerberos::Krb5::Pac.decode_logon_info(buffer) }
+
+    # A domain SID whose sub-authority count disagrees with its array size.
+    buffer = LOGON_INFO.dup
+    buffer.setbyte(buffer.index("\x04\x00\x00\x00\x01\x04".b) + 5, 5)
+    assert_raise(Kerberos::Krb5::Exception){ Kerberos::Krb5::Pac.decode_logon_info(buffer) }
+
+    assert_raise(TypeError){ Kerberos::Krb5::Pac.decode_logon_info(1) }
+  end
+
+  test "calling verify after close raises an error" do
+    assert_true(@acceptor.close)
+    assert_raise_message('no context has been established'){ @acceptor.verify('bogus') }
+  end
+
+  def teardown
+    @acceptor.close
+    @acceptor = nil
+  end
+end
@@ -0,0 +1,64 @@
+#######################################################################
+# test_credentials.rb
+#
+# Tests for the Kerberos::Krb5::Credentials class.
+#######################################################################
+require 'rubygems'
+gem 'test-unit'
+
+require 'test/unit'
+require 'rkerberos'
+
+class TC_Krb5_Credentials < Test::Unit::TestCase
+  def setup
+    @creds = Kerberos::Krb5::Credentials.new
+  end
+
+  test "client basic functionality" do
+    assert_respond_to(@creds, :client)
+    assert_nil(@creds.client)
+  end
+
+  test "server basic functionality" do
+    assert_respond_to(@creds, :server)
+    assert_nil(@creds.server)
+  end
+
+  test "time methods return nil if unset" do
+    assert_nil(@creds.authtime)
+    assert_nil(@creds.starttime)
+    assert_nil(@creds.endtime)
+    assert_nil(@creds.renew_till)
+  end
+
+  test "flags basic functionality" do
+    assert_respond_to(@creds, :flags)
+    assert_equal(0, @creds.flags)
+    assert_false(@creds.renewable?)
+    assert_false(@creds.forwardable?)
+  end
+
+  test "enctype basic functionality" do
+    assert_respond_to(@creds, :enctype)
+    assert_kind_of(Integer, @creds.enctype)
+  end
+
+  test "ticket returns a binary string" do
+    assert_respond_to(@creds, :ticket)
+    assert_equal(Encoding::BINARY, @creds.ticket.encoding)
+  end
+
+  test "expired? basic functionality" do
+    assert_respond_to(@creds, :expired?)
+    assert_true(@creds.expired?)
+  end
+
+  test "ticket flag constants" do
+    assert_not_nil(Kerberos::Krb5::Credentials::TKT_FLG_RENEWABLE)
+    assert_not_nil(Kerberos::Krb5::Credentials::TKT_FLG_FORWARDABLE)
+  end
+
+  def teardown
+    @creds = nil
+  end
+end
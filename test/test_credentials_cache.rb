@@ -143,6 +143,222 @@ class TC_Krb5_Credentials_Cache < Test::Unit::TestCase
     assert_raise(ArgumentError){ @ccache.destroy(true) }
   end
 
+  test "each basic functionality" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    assert_respond_to(@ccache, :each)
+    assert_nothing_raised{ @ccache.each{} }
+  end
+
+  test "each yields nothing for a freshly initialized cache" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    assert_equal([], @ccache.to_a)
+  end
+
+  test "each returns an enumerator if no block is given" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    assert_kind_of(Enumerator, @ccache.each)
+  end
+
+  test "credentials cache is enumerable" do
+    assert_true(Kerberos::Krb5::CredentialsCache.include?(Enumerable))
+  end
+
+  test "each yields credentials objects" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    Kerberos::Krb5.new.get_init_creds_keytab(nil, nil, nil, @ccache) rescue omit("no keytab available")
+    assert_kind_of(Kerberos::Krb5::Credentials, @ccache.first)
+  end
+
+  test "calling each on a closed object raises an error" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    @ccache.close
+    assert_raise(Kerberos::Krb5::Exception){ @ccache.each{} }
+  end
+
+  test "get_credentials basic functionality" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    assert_respond_to(@ccache, :get_credentials)
+  end
+
+  test "get_credentials with cache_only raises an error if no ticket is cached" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    server = "krbtgt/#{Kerberos::Krb5.new.default_realm}"
+    assert_raise(Kerberos::Krb5::Exception){ @ccache.get_credentials(server, :cache_only => true) }
+  end
+
+  test "get_credentials requires a string server argument" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    assert_raise(ArgumentError){ @ccache.get_credentials }
+    assert_raise(TypeError){ @ccache.get_credentials(1) }
+  end
+
+  test "memory singleton method creates a memory cache" do
+    assert_respond_to(Kerberos::Krb5::CredentialsCache, :memory)
+    assert_nothing_raised{ @ccache = Kerberos::Krb5::CredentialsCache.memory(@princ) }
+    assert_match(/\AMEMORY:/, @ccache.name)
+    assert_equal(@princ, @ccache.primary_principal)
+    assert_false(cache_found)
+    @ccache.destroy
+  end
+
+  test "memory singleton method accepts a block and destroys the cache" do
+    name = nil
+    Kerberos::Krb5::CredentialsCache.memory(@princ){ |cc| name = cc.name }
+    assert_raise(Kerberos::Krb5::Exception){
+      Kerberos::Krb5::CredentialsCache.open(name).primary_principal
+    }
+  end
+
+  test "the block forms return the value of the block" do
+    assert_equal(42, Kerberos::Krb5::CredentialsCache.memory(@princ){ |cc| 42 })
+    assert_equal('MEMORY', Kerberos::Krb5::CredentialsCache.new_unique{ |cc| cc.name.split(':').first })
+  end
+
+  test "new_unique creates distinct caches" do
+    assert_respond_to(Kerberos::Krb5::CredentialsCache, :new_unique)
+    cc1 = Kerberos::Krb5::CredentialsCache.new_unique('MEMORY')
+    cc2 = Kerberos::Krb5::CredentialsCache.new_unique('MEMORY')
+    assert_not_equal(cc1.name, cc2.name)
+    cc1.destroy
+    cc2.destroy
+  end
+
+  test "the block may destroy the cache itself" do
+    assert_nothing_raised{ Kerberos::Krb5::CredentialsCache.memory(@princ){ |cc| cc.destroy } }
+    assert_nothing_raised{ Kerberos::Krb5::CredentialsCache.new_unique{ |cc| cc.destroy } }
+  end
+
+  test "open does not reinitialize an existing cache" do
+    Kerberos::Krb5::CredentialsCache.new(@princ, @cfile)
+    assert_nothing_raised{ @ccache = Kerberos::Krb5::CredentialsCache.open(@cfile) }
+    assert_equal(@princ, @ccache.primary_principal)
+  end
+
+  test "open requires a string argument" do
+    assert_raise(TypeError){ Kerberos::Krb5::CredentialsCache.open(1) }
+  end
+
+  test "keyring singleton method basic functionality" do
+    assert_respond_to(Kerberos::Krb5::CredentialsCache, :keyring)
+    assert_raise(ArgumentError){ Kerberos::Krb5::CredentialsCache.keyring }
+  end
+
+  test "name returns the full name of the cache" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(nil, "FILE:#{@cfile}")
+    assert_equal("FILE:#{@cfile}", @ccache.name)
+  end
+
+  test "each_in_collection basic functionality" do
+    assert_respond_to(Kerberos::Krb5::CredentialsCache, :each_in_collection)
+    assert_nothing_raised{ Kerberos::Krb5::CredentialsCache.each_in_collection{} }
+  end
+
+  test "each_in_collection yields credentials cache objects" do
+    Kerberos::Krb5::CredentialsCache.new(@princ)
+    caches = Kerberos::Krb5::CredentialsCache.each_in_collection.to_a
+    assert_kind_of(Kerberos::Krb5::CredentialsCache, caches.first)
+    assert_true(caches.any?{ |cc| (cc.primary_principal rescue nil) == @princ })
+  end
+
+  test "switch_to basic functionality" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    assert_respond_to(@ccache, :switch_to)
+  end
+
+  test "calling switch_to on a closed object raises an error" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    @ccache.close
+    assert_raise(Kerberos::Krb5::Exception){ @ccache.switch_to }
+  end
+
+  test "copy_to basic functionality" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    assert_respond_to(@ccache, :copy_to)
+  end
+
+  test "copy_to initializes the target cache for the same principal" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    Kerberos::Krb5::CredentialsCache.memory do |target|
+      assert_nothing_raised{ @ccache.copy_to(target) }
+      assert_equal(@princ, target.primary_principal)
+    end
+  end
+
+  test "copy_to accepts a cache name" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    assert_nothing_raised{ @ccache.copy_to("MEMORY:rkerberos_copy_to") }
+    Kerberos::Krb5::CredentialsCache.open("MEMORY:rkerberos_copy_to").destroy
+  end
+
+  test "store requires a credentials object" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    assert_respond_to(@ccache, :store)
+    assert_raise(TypeError){ @ccache.store("bogus") }
+  end
+
+  test "retrieve returns nil if no matching ticket is cached" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    assert_respond_to(@ccache, :retrieve)
+    assert_nil(@ccache.retrieve("bogus/service"))
+  end
+
+  test "store and retrieve round trip a ticket" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    Kerberos::Krb5.new.get_init_creds_keytab(@princ, nil, nil, @ccache) rescue omit("no keytab available")
+    creds = @ccache.first
+
+    Kerberos::Krb5::CredentialsCache.memory(@princ) do |target|
+      assert_nothing_raised{ target.store(creds) }
+      assert_equal(creds.endtime, target.retrieve(creds.server).endtime)
+    end
+  end
+
+  test "export basic functionality" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    assert_respond_to(@ccache, :export)
+    assert_kind_of(String, @ccache.export)
+    assert_equal(Encoding::BINARY, @ccache.export.encoding)
+  end
+
+  test "import basic functionality" do
+    assert_respond_to(Kerberos::Krb5::CredentialsCache, :import)
+  end
+
+  test "import of an empty export requires a principal" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    blob = @ccache.export
+    assert_raise(Kerberos::Krb5::Exception){ Kerberos::Krb5::CredentialsCache.import(blob) }
+
+    Kerberos::Krb5::CredentialsCache.import(blob, @princ) do |cc|
+      assert_match(/\AMEMORY:/, cc.name)
+      assert_equal(@princ, cc.primary_principal)
+    end
+  end
+
+  test "import rejects an invalid blob" do
+    assert_raise(Kerberos::Krb5::Exception){ Kerberos::Krb5::CredentialsCache.import("bogus") }
+    assert_raise(TypeError){ Kerberos::Krb5::CredentialsCache.import(1) }
+  end
+
+  test "export and import round trip tickets" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    Kerberos::Krb5.new.get_init_creds_keytab(@princ, nil, nil, @ccache) rescue omit("no keytab available")
+
+    imported = Kerberos::Krb5::CredentialsCache.import(@ccache.export)
+    assert_equal(@ccache.map(&:server), imported.map(&:server))
+    assert_equal(@ccache.first.ticket, imported.first.ticket)
+    imported.destroy
+  end
+
+  test "export accepts a block to select tickets" do
+    @ccache = Kerberos::Krb5::CredentialsCache.new(@princ)
+    Kerberos::Krb5.new.get_init_creds_keytab(@princ, nil, nil, @ccache) rescue omit("no keytab available")
+
+    blob = @ccache.export{ false }
+    assert_equal(0, blob.byteslice(4, 4).unpack('N').first)
+    assert_raise(Kerberos::Krb5::Exception){ Kerberos::Krb5::CredentialsCache.import(blob) }
+  end
+
   def teardown
     @login  = nil
     @princ  = nil
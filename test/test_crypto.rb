@@ -0,0 +1,83 @@
+########################################################################
+# test_crypto.rb
+#
+# Tests for the Kerberos::Krb5::Crypto class. These use a fixed key, so
+# no keytab or KDC is needed.
+########################################################################
+require 'rubygems'
+gem 'test-unit'
+
+require 'test/unit'
+require 'rkerberos'
+
+class TC_Krb5_Crypto < Test::Unit::TestCase
+  def setup
+    @enctype = Kerberos::Krb5::ENCTYPE_AES128_CTS_HMAC_SHA1_96
+    @crypto  = Kerberos::Krb5::Crypto.new(@enctype, "\x01" * 16)
+    @usage   = 1026
+  end
+
+  test "constructor validates its arguments" do
+    assert_raise(ArgumentError){ Kerberos::Krb5::Crypto.new }
+    assert_raise(TypeError){ Kerberos::Krb5::Crypto.new(@enctype, 1) }
+    assert_raise(Kerberos::Krb5::Exception){ Kerberos::Krb5::Crypto.new(@enctype, 'short') }
+  end
+
+  test "enctype returns the key's enctype" do
+    assert_equal(@enctype, @crypto.enctype)
+  end
+
+  test "encrypt and decrypt round trip" do
+    cipher = @crypto.encrypt(@usage, 'hello world')
+    assert_not_equal('hello world', cipher)
+    assert_equal('hello world', @crypto.decrypt(@usage, cipher))
+  end
+
+  test "decrypt fails for the wrong key usage" do
+    cipher = @crypto.encrypt(@usage, 'hello world')
+    assert_raise(Kerberos::Krb5::Exception){ @crypto.decrypt(@usage + 1, cipher) }
+  end
+
+  test "encrypt and decrypt write into a given buffer" do
+    buffer = String.new(:capacity => 1024)
+    cipher = @crypto.encrypt(@usage, 'hello world', buffer)
+    assert_same(buffer, cipher)
+
+    plain = String.new
+    assert_same(plain, @crypto.decrypt(@usage, cipher.dup, plain))
+    assert_equal('hello world', plain)
+  end
+
+  test "the output buffer cannot be the input" do
+    data = 'hello world'
+    assert_raise(ArgumentError){ @crypto.encrypt(@usage, data, data) }
+  end
+
+  test "checksum and verify_checksum" do
+    checksum = @crypto.checksum(@usage, 'hello world')
+    assert_true(@crypto.verify_checksum(@usage, 'hello world', checksum))
+    assert_false(@crypto.verify_checksum(@usage, 'goodbye world', checksum))
+  end
+
+  test "encrypt_many encrypts each string in order" do
+    plains  = %w[one two three] * 10
+    ciphers = @crypto.encrypt_many(@usage, plains)
+    assert_equal(plains.size, ciphers.size)
+    assert_equal(plains, ciphers.map{ |cipher| @crypto.decrypt(@usage, cipher) })
+    assert_equal([], @crypto.encrypt_many(@usage, []))
+  end
+
+  test "encrypt_many validates its arguments" do
+    assert_raise(TypeError){ @crypto.encrypt_many(@usage, 'one') }
+    assert_raise(TypeError){ @crypto.encrypt_many(@usage, [1]) }
+  end
+
+  test "methods raise an error after close" do
+    @crypto.close
+    assert_raise(Kerberos::Krb5::Exception){ @crypto.encrypt(@usage, 'hello') }
+  end
+
+  def teardown
+    @crypto.close
+  end
+end
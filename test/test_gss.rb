@@ -0,0 +1,74 @@
+########################################################################
+# test_gss.rb
+#
+# Tests for the Kerberos::GSS::Acceptor and Kerberos::GSS::Context
+# classes. Tests that need acceptor credentials require the default
+# keytab to exist.
+########################################################################
+require 'rubygems'
+gem 'test-unit'
+
+require 'test/unit'
+require 'rkerberos'
+
+class TC_GSS_Acceptor < Test::Unit::TestCase
+  def setup
+    @keytab   = Kerberos::Krb5::Keytab.new.default_name.split(':').last
+    @acceptor = nil
+  end
+
+  test "constructor validates its options" do
+    assert_raise(TypeError){ Kerberos::GSS::Acceptor.new(:keytab => 1) }
+    assert_raise(TypeError){ Kerberos::GSS::Acceptor.new(true) }
+  end
+
+  test "constructor raises an error for a keytab without entries" do
+    assert_raise(Kerberos::GSS::Exception){ Kerberos::GSS::Acceptor.new(:keytab => 'MEMORY:test_gss_empty') }
+  end
+
+  test "constructor accepts a keytab object" do
+    omit_unless(File.exist?(@keytab), "keytab file not found")
+    keytab = Kerberos::Krb5::Keytab.new(@keytab)
+    assert_nothing_raised{ @acceptor = Kerberos::GSS::Acceptor.new(:keytab => keytab) }
+  end
+
+  test "accept basic functionality" do
+    omit_unless(File.exist?(@keytab), "keytab file not found")
+    @acceptor = Kerberos::GSS::Acceptor.new(:keytab => @keytab)
+    assert_respond_to(@acceptor, :accept)
+    assert_raise(TypeError){ @acceptor.accept(1) }
+  end
+
+  test "accept rejects a malformed token" do
+    omit_unless(File.exist?(@keytab), "keytab file not found")
+    @acceptor = Kerberos::GSS::Acceptor.new(:keytab => @keytab)
+    assert_raise(Kerberos::GSS::Exception){ @acceptor.accept('bogus') }
+  end
+
+  test "accept raises an error after close" do
+    omit_unless(File.exist?(@keytab), "keytab file not found")
+    @acceptor = Kerberos::GSS::Acceptor.new(:keytab => @keytab)
+    @acceptor.close
+    assert_raise(Kerberos::GSS::Exception){ @acceptor.accept('bogus') }
+  end
+
+  test "contexts cannot be created directly" do
+    assert_raise(TypeError, NoMethodError){ Kerberos::GSS::Context.new }
+  end
+
+  test "contexts provide wrap_iov and unwrap_iov" do
+    assert_include(Kerberos::GSS::Context.instance_methods, :wrap_iov)
+    assert_include(Kerberos::GSS::Context.instance_methods, :unwrap_iov)
+    assert_equal(-1, Kerberos::GSS::Context.instance_method(:unwrap_iov).arity)
+  end
+
+  test "context flag constants are defined" do
+    assert_kind_of(Integer, Kerberos::GSS::DELEG_FLAG)
+    assert_kind_of(Integer, Kerberos::GSS::MUTUAL_FLAG)
+  end
+
+  def teardown
+    @acceptor.close if @acceptor
+    @acceptor = nil
+  end
+end
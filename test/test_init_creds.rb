@@ -0,0 +1,88 @@
+########################################################################
+# test_init_creds.rb
+#
+# Tests for the Kerberos::Krb5::InitCredsSession class. Like test_krb5.rb,
+# tests that contact the KDC require a keytab for "testuser1".
+########################################################################
+require 'rubygems'
+gem 'test-unit'
+
+require 'test/unit'
+require 'rkerberos'
+
+class TC_Krb5_InitCredsSession < Test::Unit::TestCase
+  def self.startup
+    @@krb5_conf = ENV['KRB5_CONFIG'] || '/etc/krb5.conf'
+    @@realm = IO.read(@@krb5_conf).split("\n").grep(/default_realm/).first.split('=').last.lstrip.chomp
+  end
+
+  def setup
+    @krb5    = Kerberos::Krb5.new
+    @keytab  = Kerberos::Krb5::Keytab.new.default_name.split(':').last
+    @user    = "testuser1@" + @@realm
+    @session = @krb5.prepare_init_creds(:principal => @user, :keytab => @keytab)
+  end
+
+  test "prepare_init_creds returns a session" do
+    assert_respond_to(@krb5, :prepare_init_creds)
+    assert_kind_of(Kerberos::Krb5::InitCredsSession, @session)
+  end
+
+  test "sessions cannot be created directly" do
+    assert_raise(TypeError, NoMethodError){ Kerberos::Krb5::InitCredsSession.new }
+  end
+
+  test "prepare_init_creds validates its arguments" do
+    assert_raise(TypeError){ @krb5.prepare_init_creds(:principal => 1) }
+    assert_raise(TypeError){ @krb5.prepare_init_creds(:keytab => 1) }
+    assert_raise(TypeError){ @krb5.prepare_init_creds(:principal => @user, :lifetime => 'x') }
+  end
+
+  test "principal returns the parsed principal" do
+    assert_respond_to(@session, :principal)
+    assert_equal(@user, @session.principal)
+  end
+
+  test "the session does not depend on the Krb5 object" do
+    @krb5.close
+    assert_equal(@user, @session.principal)
+  end
+
+  test "acquire returns a TGT" do
+    omit_unless(File.exist?(@keytab), "keytab file not found, skipping")
+    creds = @session.acquire
+    assert_kind_of(Kerberos::Krb5::Credentials, creds)
+    assert_equal(@user, creds.client)
+  end
+
+  test "acquire stores the TGT in a credentials cache" do
+    omit_unless(File.exist?(@keytab), "keytab file not found, skipping")
+    ccache = Kerberos::Krb5::CredentialsCache.memory
+    @session.acquire(ccache)
+    assert_equal(@user, ccache.primary_principal)
+    ccache.destroy
+  end
+
+  test "acquire may be called concurrently" do
+    omit_unless(File.exist?(@keytab), "keytab file not found, skipping")
+    threads = 4.times.map{ Thread.new{ 2.times.map{ @session.acquire.client } } }
+    assert_equal([@user] * 8, threads.map(&:value).flatten)
+  end
+
+  test "acquire accepts one optional argument" do
+    assert_raise(ArgumentError){ @session.acquire(nil, nil) }
+    assert_raise(TypeError){ @session.acquire(1) }
+  end
+
+  test "calling acquire after close raises an error" do
+    assert_true(@session.close)
+    assert_raise_message('no context has been established'){ @session.acquire }
+  end
+
+  def teardown
+    @session.close
+    @krb5.close
+    @session = nil
+    @krb5    = nil
+  end
+end
@@ -60,6 +60,15 @@ class TC_Krb5_KeytabEntry < Test::Unit::TestCase
     assert_equal(23, @kte.key)
   end
 
+  test "key_bytes basic functionality" do
+    assert_respond_to(@kte, :key_bytes)
+    assert_nothing_raised{ @kte.key_bytes }
+  end
+
+  test "key_bytes is nil for an entry not read from a keytab" do
+    assert_nil(@kte.key_bytes)
+  end
+
   def teardown
     @kte = nil
   end
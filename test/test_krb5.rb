@@ -149,11 +149,128 @@ class TC_Krb5 < Test::Unit::TestCase
     assert_raise(TypeError){ @krb5.get_init_creds_keytab(@user, @keytab, 1) }
   end
 
+  test "get_init_creds_keytab accepts initial credential options" do
+    omit_unless(File.exist?(@keytab), "keytab file not found, skipping")
+    ccache = Kerberos::Krb5::CredentialsCache.memory
+    aes = Kerberos::Krb5::ENCTYPE_AES256_CTS_HMAC_SHA1_96
+    assert_nothing_raised{ @krb5.get_init_creds_keytab(@user, @keytab, nil, ccache, :lifetime => 3600, :etypes => [aes]) }
+    assert_equal(aes, ccache.first.enctype)
+    ccache.destroy
+  end
+
+  test "initial credential options must be valid" do
+    assert_raise(TypeError){ @krb5.get_init_creds_keytab(@user, @keytab, lifetime: 'foo') }
+    assert_raise(TypeError){ @krb5.get_init_creds_password(@user, 'xxx', etypes: ['foo']) }
+    assert_raise(ArgumentError){ @krb5.get_init_creds_keytab(@user, @keytab, etypes: (1..17).to_a) }
+  end
+
+  test "tgt_cache_stats basic functionality" do
+    assert_respond_to(Kerberos::Krb5, :tgt_cache_stats)
+    assert_kind_of(Hash, Kerberos::Krb5.tgt_cache_stats)
+    assert_equal([:hits, :misses, :size], Kerberos::Krb5.tgt_cache_stats.keys.sort)
+  end
+
+  test "clear_tgt_cache resets the cache" do
+    assert_respond_to(Kerberos::Krb5, :clear_tgt_cache)
+    Kerberos::Krb5.clear_tgt_cache
+    assert_equal({:hits => 0, :misses => 0, :size => 0}, Kerberos::Krb5.tgt_cache_stats)
+  end
+
+  test "impersonate basic functionality" do
+    assert_respond_to(@krb5, :impersonate)
+    assert_raise(ArgumentError){ @krb5.impersonate(@user) }
+    assert_raise(TypeError){ @krb5.impersonate(1, :target => 'HTTP/foo') }
+    assert_raise(TypeError){ @krb5.impersonate(@user, :target => 'HTTP/foo', :ccache => 1) }
+  end
+
+  test "clear_s4u_cache resets the cache" do
+    Kerberos::Krb5.clear_s4u_cache
+    assert_equal({:hits => 0, :misses => 0, :evictions => 0, :size => 0}, Kerberos::Krb5.s4u_cache_stats)
+  end
+
+  test "verify_password basic functionality" do
+    assert_respond_to(Kerberos::Krb5, :verify_password)
+    assert_raise(ArgumentError){ Kerberos::Krb5.verify_password(@user) }
+    assert_raise(TypeError){ Kerberos::Krb5.verify_password(1, 'xxx') }
+    assert_raise(TypeError){ Kerberos::Krb5.verify_password(@user, 'xxx', :verify_keytab => 1) }
+  end
+
+  test "verify_password raises an error for a keytab without entries" do
+    assert_raise(Kerberos::Krb5::Exception){
+      Kerberos::Krb5.verify_password(@user, 'xxx', :verify_keytab => 'MEMORY:test_verify_empty')
+    }
+  end
+
+  test "verify_password returns false for a wrong password" do
+    omit_unless(File.exist?(@keytab), "keytab file not found, skipping")
+    assert_false(Kerberos::Krb5.verify_password(@user, 'not the password', :verify_keytab => @keytab))
+  end
+
+  test "clear_verify_keytabs basic functionality" do
+    assert_respond_to(Kerberos::Krb5, :clear_verify_keytabs)
+    assert_equal(Kerberos::Krb5, Kerberos::Krb5.clear_verify_keytabs)
+  end
+
+  test "get_init_creds_keytab shares TGTs between objects" do
+    omit_unless(File.exist?(@keytab), "keytab file not found, skipping")
+    Kerberos::Krb5.clear_tgt_cache
+    @krb5.get_init_creds_keytab(@user, @keytab)
+    Kerberos::Krb5.new{ |krb5| krb5.get_init_creds_keytab(@user, @keytab) }
+    assert_equal({:hits => 1, :misses => 1, :size => 1}, Kerberos::Krb5.tgt_cache_stats)
+  end
+
+  test "get_init_creds_keytab bypasses the TGT cache if asked" do
+    omit_unless(File.exist?(@keytab), "keytab file not found, skipping")
+    Kerberos::Krb5.clear_tgt_cache
+    @krb5.get_init_creds_keytab(@user, @keytab, :cache => false)
+    assert_equal(0, Kerberos::Krb5.tgt_cache_stats[:size])
+  end
+
+  test "the TGT cache is keyed by keytab and options" do
+    omit_unless(File.exist?(@keytab), "keytab file not found, skipping")
+    Kerberos::Krb5.clear_tgt_cache
+    @krb5.get_init_creds_keytab(@user, @keytab)
+    @krb5.get_init_creds_keytab(@user, @keytab, :lifetime => 3600)
+    assert_equal({:hits => 0, :misses => 2, :size => 2}, Kerberos::Krb5.tgt_cache_stats)
+    assert_raise(TypeError){ @krb5.get_init_creds_keytab(@user, 1) }
+  end
+
   test "calling get_init_creds_keytab after closing the object raises an error" do
     @krb5.close
     assert_raise(Kerberos::Krb5::Exception){ @krb5.get_init_creds_keytab(@user, @keytab) }
   end
 
+  test "mk_req basic functionality" do
+    assert_respond_to(@krb5, :mk_req)
+  end
+
+  test "mk_req validates its arguments" do
+    assert_raise(ArgumentError){ @krb5.mk_req }
+    assert_raise(TypeError){ @krb5.mk_req(1) }
+    assert_raise(TypeError){ @krb5.mk_req(@user, ccache: 'FILE:/tmp/foo') }
+    assert_raise(TypeError){ @krb5.mk_req(@user, data: 1) }
+  end
+
+  test "mk_req creates a request the acceptor can verify" do
+    omit_unless(File.exist?(@keytab), "keytab file not found, skipping")
+    ccache = Kerberos::Krb5::CredentialsCache.memory
+    @krb5.get_init_creds_keytab(@user, @keytab, nil, ccache, :cache => false)
+
+    token = @krb5.mk_req(@user, ccache: ccache, mutual: true)
+    acceptor = Kerberos::Krb5::Acceptor.new(keytab: @keytab, rcache: 'none:')
+
+    assert_equal(@user, acceptor.verify(token).client)
+    assert_equal(2, ccache.count)
+
+    acceptor.close
+    ccache.destroy
+  end
+
+  test "calling mk_req after closing the object raises an error" do
+    @krb5.close
+    assert_raise_message('no context has been established'){ @krb5.mk_req(@user) }
+  end
+
   test "change_password basic functionality" do
     assert_respond_to(@krb5, :change_password)
   end
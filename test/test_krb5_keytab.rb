@@ -119,6 +119,16 @@ class TC_Krb5_Keytab < Test::Unit::TestCase
     assert_kind_of(Kerberos::Krb5::Keytab::Entry, @entry)
   end
 
+  test "entries returned by get_entry carry their key bytes" do
+    @user = "testuser1@" + @realm
+    @keytab = Kerberos::Krb5::Keytab.new(@@key_file)
+    @entry = @keytab.get_entry(@user)
+    assert_kind_of(String, @entry.key_bytes)
+    assert_equal(16, @entry.key_bytes.size)
+    assert_equal(Encoding::BINARY, @entry.key_bytes.encoding)
+    assert_true(@entry.key_bytes.frozen?)
+  end
+
   test "get_entry raises an error if no entry is found" do
     @user = "bogus_user@" + @realm
     assert_nothing_raised{ @keytab = Kerberos::Krb5::Keytab.new(@@key_file) }
@@ -142,6 +152,116 @@ class TC_Krb5_Keytab < Test::Unit::TestCase
     assert_true(array.size >= 1)
   end
 
+  test "diff basic functionality" do
+    @keytab = Kerberos::Krb5::Keytab.new(@@key_file)
+    assert_respond_to(@keytab, :diff)
+    assert_nothing_raised{ @keytab.diff(Kerberos::Krb5::Keytab.new(@@key_file)) }
+  end
+
+  test "diff of a keytab against itself finds no differences" do
+    @keytab = Kerberos::Krb5::Keytab.new(@@key_file)
+    result = @keytab.diff(Kerberos::Krb5::Keytab.new(@@key_file))
+    assert_equal([], result[:added])
+    assert_equal([], result[:removed])
+    assert_equal([], result[:changed])
+  end
+
+  test "diff against an empty keytab reports every entry as removed" do
+    @keytab = Kerberos::Krb5::Keytab.new(@@key_file)
+    result = @keytab.diff(Kerberos::Krb5::Keytab.new("MEMORY:rkerberos_diff"))
+    assert_equal(2, result[:removed].size)
+    assert_kind_of(Kerberos::Krb5::Keytab::Entry, result[:removed].first)
+    assert_equal([], result[:added])
+  end
+
+  test "diff requires a keytab argument" do
+    assert_raise(ArgumentError){ @keytab.diff }
+    assert_raise(TypeError){ @keytab.diff(@@key_file) }
+  end
+
+  test "verify basic functionality" do
+    @keytab = Kerberos::Krb5::Keytab.new(@@key_file)
+    assert_respond_to(@keytab, :verify)
+    assert_nothing_raised{ @keytab.verify }
+    assert_kind_of(Hash, @keytab.verify(:concurrency => 2))
+  end
+
+  test "verify returns a result for each distinct principal" do
+    @keytab = Kerberos::Krb5::Keytab.new(@@key_file)
+    result = @keytab.verify
+    assert_equal(["testuser1@#{@realm}", "testuser2@#{@realm}"], result.keys.sort)
+    assert_boolean(result.values.first[:success])
+    assert_kind_of(Float, result.values.first[:latency])
+  end
+
+  test "verify on an empty keytab returns an empty hash" do
+    @keytab = Kerberos::Krb5::Keytab.new("MEMORY:rkerberos_verify")
+    assert_equal({}, @keytab.verify)
+  end
+
+  test "verify requires a positive concurrency" do
+    @keytab = Kerberos::Krb5::Keytab.new(@@key_file)
+    assert_raise(ArgumentError){ @keytab.verify(:concurrency => 0) }
+  end
+
+  test "add_password_entry basic functionality" do
+    assert_respond_to(@keytab, :add_password_entry)
+  end
+
+  test "add_password_entry adds an entry for each enctype" do
+    @keytab = Kerberos::Krb5::Keytab.new("MEMORY:rkerberos_s2k")
+    principal = "HTTP/www.example.com@#{@realm}"
+    @keytab.add_password_entry(principal, 'secret', :kvno => 3)
+
+    entries = []
+    @keytab.each{ |entry| entries << entry }
+
+    assert_equal(2, entries.size)
+    assert_equal([3, 3], entries.map(&:vno))
+    assert_equal([principal] * 2, entries.map(&:principal))
+  end
+
+  test "add_password_entry accepts enctype names" do
+    @keytab = Kerberos::Krb5::Keytab.new("MEMORY:rkerberos_s2k_names")
+    @keytab.add_password_entry("HTTP/www.example.com@#{@realm}", 'secret', :enctypes => ['aes128-cts'])
+    entry = nil
+    @keytab.each{ |e| entry = e }
+    assert_equal(Kerberos::Krb5::ENCTYPE_AES128_CTS_HMAC_SHA1_96, entry.key)
+  end
+
+  test "add_password_entry derives the same keys on every call" do
+    @keytab = Kerberos::Krb5::Keytab.new("MEMORY:rkerberos_s2k_same")
+    principal = "HTTP/www.example.com@#{@realm}"
+    @keytab.add_password_entry(principal, 'secret', :kvno => 1, :concurrency => 1)
+    @keytab.add_password_entry(principal, 'secret', :kvno => 2)
+
+    keys = Hash.new{ |h, k| h[k] = [] }
+    @keytab.each{ |entry| keys[entry.key] << entry.key_bytes }
+    keys.each_value{ |bytes| assert_equal(1, bytes.uniq.size) }
+  end
+
+  # RFC 3962, Appendix B, 1200 iterations.
+  test "add_password_entry derives the RFC 3962 test vector keys" do
+    @keytab = Kerberos::Krb5::Keytab.new("MEMORY:rkerberos_s2k_rfc3962")
+    @keytab.add_password_entry('raeburn@ATHENA.MIT.EDU', 'password', :iterations => 1200)
+
+    keys = {}
+    @keytab.each{ |entry| keys[entry.key] = entry.key_bytes.unpack('H*').first }
+
+    assert_equal('4c01cd46d632d01e6dbe230a01ed642a', keys[Kerberos::Krb5::ENCTYPE_AES128_CTS_HMAC_SHA1_96])
+    assert_equal('55a6ac740ad17b4846941051e1e8b0a7548d93b0ab30a8bc3ff16280382b8c2a', keys[Kerberos::Krb5::ENCTYPE_AES256_CTS_HMAC_SHA1_96])
+  end
+
+  test "add_password_entry validates its arguments" do
+    assert_raise(ArgumentError){ @keytab.add_password_entry('foo') }
+    assert_raise(TypeError){ @keytab.add_password_entry(1, 'secret') }
+    assert_raise(TypeError){ @keytab.add_password_entry('foo', 1) }
+    assert_raise(ArgumentError){ @keytab.add_password_entry('foo', 'secret', :enctypes => []) }
+    assert_raise(ArgumentError){ @keytab.add_password_entry('foo', 'secret', :enctypes => ['bogus']) }
+    assert_raise(ArgumentError){ @keytab.add_password_entry('foo', 'secret', :concurrency => 0) }
+    assert_raise(ArgumentError){ @keytab.add_password_entry('foo', 'secret', :iterations => 0) }
+  end
+
 =begin
   # These tests skipped until further notice.
 
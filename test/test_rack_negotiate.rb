@@ -0,0 +1,115 @@
+########################################################################
+# test_rack_negotiate.rb
+#
+# Tests for the Kerberos::Rack::Negotiate middleware. These use a stand-in
+# acceptor, so no keytab or KDC is needed.
+########################################################################
+require 'rubygems'
+gem 'test-unit'
+
+require 'test/unit'
+require 'rkerberos/rack/negotiate'
+
+class TC_Rack_Negotiate < Test::Unit::TestCase
+  FakeContext = Struct.new(:client_name, :output_token, :lifetime, :established) do
+    def established?; established; end
+    def close; self.established = :closed; end
+  end
+
+  class FakeAcceptor
+    attr_reader :calls, :last
+
+    def initialize
+      @calls = 0
+    end
+
+    def accept(token)
+      @calls += 1
+      raise Kerberos::GSS::Exception, 'bad token' if token == 'bogus'
+      @last = FakeContext.new('testuser1@EXAMPLE.COM', 'reply', token == 'short' ? 0 : 3600, token != 'partial')
+    end
+  end
+
+  def setup
+    @acceptor   = FakeAcceptor.new
+    @app        = lambda{ |env| [200, {}, [env['REMOTE_USER']]] }
+    @middleware = Kerberos::Rack::Negotiate.new(@app, :acceptor => @acceptor)
+  end
+
+  def header(token, port = '50000')
+    {
+      'HTTP_AUTHORIZATION' => 'Negotiate ' + [token].pack('m0'),
+      'REMOTE_ADDR'        => '192.0.2.1',
+      'REMOTE_PORT'        => port
+    }
+  end
+
+  test "requests without a token are challenged" do
+    status, headers, _ = @middleware.call({})
+    assert_equal(401, status)
+    assert_equal('Negotiate', headers['www-authenticate'])
+    assert_equal(1, @middleware.stats[:challenges])
+  end
+
+  test "a valid token sets REMOTE_USER and the reply token" do
+    status, headers, body = @middleware.call(header('good'))
+    assert_equal(200, status)
+    assert_equal(['testuser1@EXAMPLE.COM'], body)
+    assert_equal('Negotiate ' + ['reply'].pack('m0'), headers['www-authenticate'])
+  end
+
+  test "a repeated token is served from memory" do
+    3.times{ @middleware.call(header('good')) }
+    assert_equal(1, @acceptor.calls)
+    assert_equal(2, @middleware.stats[:hits])
+    assert_equal(1, @middleware.stats[:misses])
+    assert_equal(1, @middleware.stats[:size])
+  end
+
+  test "a repeated token from another connection is verified again" do
+    @middleware.call(header('good', '50000'))
+    @middleware.call(header('good', '50001'))
+    assert_equal(2, @acceptor.calls)
+    assert_equal(0, @middleware.stats[:hits])
+  end
+
+  test "verifications are only remembered for the keep-alive timeout" do
+    middleware = Kerberos::Rack::Negotiate.new(@app, :acceptor => @acceptor, :keep_alive => 0)
+    2.times{ middleware.call(header('good')) }
+    assert_equal(2, @acceptor.calls)
+  end
+
+  test "a token that needs another leg is rejected" do
+    status, headers, _ = @middleware.call(header('partial'))
+    assert_equal(401, status)
+    assert_equal('Negotiate', headers['www-authenticate'])
+    assert_equal(1, @middleware.stats[:failures])
+    assert_equal(:closed, @acceptor.last.established)
+  end
+
+  test "an expired verification is not reused" do
+    2.times{ @middleware.call(header('short')) }
+    assert_equal(2, @acceptor.calls)
+    assert_equal(0, @middleware.stats[:hits])
+  end
+
+  test "a rejected token is challenged and not remembered" do
+    2.times{ assert_equal(401, @middleware.call(header('bogus')).first) }
+    assert_equal(2, @acceptor.calls)
+    assert_equal(2, @middleware.stats[:failures])
+    assert_equal(0, @middleware.stats[:size])
+  end
+
+  test "the oldest verifications are evicted when the cache is full" do
+    middleware = Kerberos::Rack::Negotiate.new(@app, :acceptor => @acceptor, :cache_size => 2)
+    %w[a b c].each{ |token| middleware.call(header(token)) }
+    assert_equal(2, middleware.stats[:size])
+    assert_equal(1, middleware.stats[:evictions])
+  end
+
+  test "clear forgets every verification" do
+    @middleware.call(header('good'))
+    @middleware.clear
+    assert_equal(0, @middleware.stats[:size])
+  end
+end
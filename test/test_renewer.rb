@@ -0,0 +1,67 @@
+#######################################################################
+# test_renewer.rb
+#
+# Tests for the Kerberos::Krb5::Renewer class.
+#######################################################################
+require 'rubygems'
+gem 'test-unit'
+
+require 'test/unit'
+require 'rkerberos'
+
+class TC_Krb5_Renewer < Test::Unit::TestCase
+  def setup
+    @renewer = Kerberos::Krb5::Renewer.new
+    @ccache  = Kerberos::Krb5::CredentialsCache.memory
+  end
+
+  test "constructor accepts fraction and interval options" do
+    assert_nothing_raised{ Kerberos::Krb5::Renewer.new(:fraction => 0.75, :interval => 5) }
+  end
+
+  test "constructor rejects invalid options" do
+    assert_raise(ArgumentError){ Kerberos::Krb5::Renewer.new(:fraction => 0) }
+    assert_raise(ArgumentError){ Kerberos::Krb5::Renewer.new(:fraction => 1.5) }
+    assert_raise(ArgumentError){ Kerberos::Krb5::Renewer.new(:interval => 0) }
+    assert_raise(TypeError){ Kerberos::Krb5::Renewer.new(true) }
+  end
+
+  test "watch accepts a ccache or a cache name" do
+    assert_respond_to(@renewer, :watch)
+    assert_equal(@renewer, @renewer.watch(@ccache))
+    assert_nothing_raised{ @renewer.watch(@ccache.name, :keytab => 'FILE:/nonexistent') }
+    assert_raise(TypeError){ @renewer.watch(1) }
+    assert_raise(TypeError){ @renewer.watch(@ccache, :keytab => 1) }
+  end
+
+  test "status reports each watched cache" do
+    assert_equal([], @renewer.status)
+    @renewer.watch(@ccache)
+    status = @renewer.status.first
+    assert_equal(@ccache.name, status[:ccache])
+    assert_equal(0, status[:renewals])
+    assert_nil(status[:last_renewal])
+  end
+
+  test "start and stop basic functionality" do
+    assert_false(@renewer.running?)
+    assert_equal(@renewer, @renewer.start)
+    assert_true(@renewer.running?)
+    assert_equal(@renewer, @renewer.stop)
+    assert_false(@renewer.running?)
+  end
+
+  test "an empty cache without a keytab records an error" do
+    @renewer.watch(@ccache).start
+    50.times{ break if @renewer.status.first[:error]; sleep 0.1 }
+    assert_kind_of(String, @renewer.status.first[:error])
+    assert_equal(0, @renewer.status.first[:renewals])
+  end
+
+  def teardown
+    @renewer.stop
+    @ccache.destroy rescue nil
+    @renewer = nil
+    @ccache  = nil
+  end
+end
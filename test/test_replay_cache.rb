@@ -0,0 +1,68 @@
+########################################################################
+# test_replay_cache.rb
+#
+# Tests for the Kerberos::Krb5::ReplayCache class.
+########################################################################
+require 'rubygems'
+gem 'test-unit'
+
+require 'test/unit'
+require 'rkerberos'
+
+class TC_Krb5_ReplayCache < Test::Unit::TestCase
+  def setup
+    @rcache = Kerberos::Krb5::ReplayCache.new
+    @client = 'user@EXAMPLE.COM'
+    @server = 'HTTP/www.example.com@EXAMPLE.COM'
+    @now    = Time.now
+  end
+
+  test "constructor defaults to a memory replay cache" do
+    assert_equal(:memory, @rcache.type)
+    assert_equal('none:', @rcache.name)
+  end
+
+  test "constructor accepts none and file types" do
+    assert_equal('none:', Kerberos::Krb5::ReplayCache.new(:none).name)
+    assert_equal('dfl:', Kerberos::Krb5::ReplayCache.new(:file).name)
+    assert_equal(:file, Kerberos::Krb5::ReplayCache.new(:file, :name => 'dfl:').type)
+  end
+
+  test "constructor validates its arguments" do
+    assert_raise(ArgumentError){ Kerberos::Krb5::ReplayCache.new(:bogus) }
+    assert_raise(ArgumentError){ Kerberos::Krb5::ReplayCache.new(:memory, :shards => 0) }
+    assert_raise(ArgumentError){ Kerberos::Krb5::ReplayCache.new(:memory, :window => 0) }
+    assert_raise(TypeError){ Kerberos::Krb5::ReplayCache.new('memory') }
+    assert_raise(TypeError){ Kerberos::Krb5::ReplayCache.new(:file, :name => 1) }
+  end
+
+  test "replay? detects a repeated authenticator" do
+    assert_false(@rcache.replay?(@client, @server, @now, 1))
+    assert_true(@rcache.replay?(@client, @server, @now, 1))
+  end
+
+  test "replay? distinguishes authenticators" do
+    assert_false(@rcache.replay?(@client, @server, @now, 1))
+    assert_false(@rcache.replay?(@client, @server, @now, 2))
+    assert_false(@rcache.replay?(@client, 'host/foo@EXAMPLE.COM', @now, 1))
+    assert_false(@rcache.replay?('other@EXAMPLE.COM', @server, @now, 1))
+  end
+
+  test "replay? handles many authenticators across shards" do
+    1000.times{ |i| assert_false(@rcache.replay?(@client, @server, @now, i)) }
+    1000.times{ |i| assert_true(@rcache.replay?(@client, @server, @now, i)) }
+  end
+
+  test "replay? is always false for other types" do
+    rcache = Kerberos::Krb5::ReplayCache.new(:none)
+    2.times{ assert_false(rcache.replay?(@client, @server, @now)) }
+  end
+
+  test "an acceptor accepts a replay cache" do
+    assert_nothing_raised{ Kerberos::Krb5::Acceptor.new(:keytab => 'MEMORY:test_rcache', :rcache => @rcache).close }
+  end
+
+  def teardown
+    @rcache = nil
+  end
+end